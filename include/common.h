@@ -22,6 +22,9 @@ THE SOFTWARE.
 #ifndef __COMMON_H__
 #define __COMMON_H__
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
 
 enum modifier {
     CTRL = 1,
@@ -41,13 +44,78 @@ enum mouse_button {
     MOUSE_DOUBLE = 8,
 };
 
+enum symbol_kind {
+    SYMBOL_KEY,
+    SYMBOL_MODIFIER,
+    SYMBOL_BUTTON,
+};
+
+#define COMBO_MAX_KEYS 6
+
+// One chord such as ctrl+shift+f5 or mouse_left+ctrl
+typedef struct combo
+{
+    unsigned char modifiers;    // enum modifier bits
+    unsigned char buttons;      // enum mouse_button bits
+    unsigned char keys[COMBO_MAX_KEYS];
+    int key_count;
+} combo;
+
 bool parse_modifier(const char *arg, enum modifier *mod);
 bool parse_mouse_button(const char *arg, enum mouse_button *btn);
+/**
+ * Parses a combo expression in a single pass, e.g. "l_ctrl+r_shift+f5" or a
+ * sequence "ctrl+c,ctrl+v". Keys, modifiers and buttons are looked up in one
+ * hash table. Returns the number of combos stored in combos, or -1 with the
+ * reason in err.
+ */
+int parse_combos(const char *expr, combo *combos, int max, char *err, size_t err_size);
+
+typedef struct keymap_entry
+{
+    const char *name;
+    unsigned char value;
+} keymap_entry;
+
+// The names and usages of the US keymap, e.g. to compare lookups with a linear scan
+const keymap_entry *get_keymap(size_t *count);
 
-bool encode_string(const char *str, unsigned char *arr);
 bool encode_char(const char ch, unsigned char *b);
 bool encode_key(const char *key, unsigned char *b);
 
 const char* decode_byte(unsigned char b);
 
+/**
+ * Calls fn for each key which is pressed or released between two boot
+ * keyboard reports (modifiers, reserved byte, 6 keys). The modifiers are
+ * reported as their usages 0xe0-0xe7.
+ */
+void diff_reports(const uint8_t last[8], const uint8_t report[8],
+                  void (*fn)(uint8_t usage, bool pressed, void *arg), void *arg);
+
+// A keyboard layout generated from XKB data, see src/gen-keymaps.py
+typedef struct keyboard_layout
+{
+    const char *name;
+    const char *description;
+    const uint16_t *const *pages;   // usage | modifiers << 8 by code point
+} keyboard_layout;
+
+typedef struct keystroke
+{
+    unsigned char code;
+    unsigned char modifiers;        // enum modifier bits
+} keystroke;
+
+bool set_keyboard_layout(const char *name);
+void print_keyboard_layouts(FILE *f);
+/**
+ * Encodes UTF-8 text with the layout selected by set_keyboard_layout(), one
+ * table lookup per character. Without a layout, text is ASCII and encoded
+ * with the US keymap, where shifted characters have bit 7 of code set.
+ * Returns the number of keystrokes, -1 if a character cannot be typed or -2
+ * if text has more than max characters.
+ */
+int encode_text(const char *text, keystroke *keys, int max);
+
 #endif
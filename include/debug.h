@@ -21,13 +21,25 @@ THE SOFTWARE.
 */
 #ifndef __DEBUG_H__
 #define __DEBUG_H__
+#include <stdbool.h>
+#include "metrics.h"
 
 #define fatal(msg...) { \
+    metrics_add(METRIC_FAILURES, 1); \
     fprintf(stderr, msg); \
     fprintf(stderr, " [%s(), %s:%u]\n", __FUNCTION__, __FILE__, __LINE__); \
     exit(1); \
     }
 
+#define diag(msg...) { \
+    if (verbose) { \
+        fprintf(stderr, msg); \
+        fprintf(stderr, "\n"); \
+    } \
+    }
+
+extern bool verbose;
+
 void debug_arr(unsigned char data[], int length);
 
 #endif
@@ -0,0 +1,141 @@
+/*
+Copyright (c) 2012 Radoslav Gerganov <rgerganov@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+#ifndef __DEVICE_H__
+#define __DEVICE_H__
+#include <stdbool.h>
+#include <stddef.h>
+#include <getopt.h>
+#include <hidapi.h>
+
+// Long options shared by all tools; the values are outside of the range
+// used by the short options so they can live in the same switch. The only
+// shared short option is -o, the output of --compile.
+enum device_option {
+    OPT_PATH = 0x100,
+    OPT_SERIAL,
+    OPT_PORT,
+    OPT_TIMEOUT,
+    OPT_RETRIES,
+    OPT_JOURNAL,
+    OPT_LOCK_TIMEOUT,
+    OPT_VERBOSE,
+    OPT_COMPILE,
+    OPT_FLASH,
+    OPT_DRY_RUN,
+    OPT_RECORD,
+    OPT_REPLAY,
+    OPT_BACKEND,
+    OPT_METRICS,
+    OPT_DB,
+    OPT_RESET,
+    OPT_LAYOUT,
+    OPT_VERIFY,
+    OPT_WATCHDOG,
+    OPT_DEVICE_END,
+};
+
+#define DEVICE_LONG_OPTIONS \
+    {"path",   required_argument, NULL, OPT_PATH}, \
+    {"serial", required_argument, NULL, OPT_SERIAL}, \
+    {"port",   required_argument, NULL, OPT_PORT}, \
+    {"timeout", required_argument, NULL, OPT_TIMEOUT}, \
+    {"retries", required_argument, NULL, OPT_RETRIES}, \
+    {"journal", required_argument, NULL, OPT_JOURNAL}, \
+    {"lock-timeout", required_argument, NULL, OPT_LOCK_TIMEOUT}, \
+    {"verbose", no_argument, NULL, OPT_VERBOSE}, \
+    {"compile", no_argument, NULL, OPT_COMPILE}, \
+    {"flash", required_argument, NULL, OPT_FLASH}, \
+    {"dry-run", no_argument, NULL, OPT_DRY_RUN}, \
+    {"record", required_argument, NULL, OPT_RECORD}, \
+    {"replay", required_argument, NULL, OPT_REPLAY}, \
+    {"backend", required_argument, NULL, OPT_BACKEND}, \
+    {"metrics", required_argument, NULL, OPT_METRICS}, \
+    {"db", required_argument, NULL, OPT_DB}, \
+    {"reset", no_argument, NULL, OPT_RESET}, \
+    {"layout", required_argument, NULL, OPT_LAYOUT}, \
+    {"verify", no_argument, NULL, OPT_VERIFY}, \
+    {"watchdog", required_argument, NULL, OPT_WATCHDOG}
+
+#define DEVICE_USAGE \
+    "   --path path         - open the device with the specified path (e.g. /dev/hidraw3), skipping discovery\n" \
+    "   --serial serial     - use the device with the specified USB serial number\n" \
+    "   --port bus-port     - use the device attached to the specified USB port (e.g. 1-2.3)\n" \
+    "   --timeout ms        - wait at most ms milliseconds for each response (default 1000)\n" \
+    "   --retries n         - repeat failed transfers up to n times (default 4)\n" \
+    "   --journal file      - record the progress in file and resume an interrupted run from it\n" \
+    "   --lock-timeout ms   - wait at most ms milliseconds for other processes using the device\n" \
+    "   --verbose           - print diagnostics on stderr\n" \
+    "   --compile -o file   - save the packets which program the device in file instead of sending them\n" \
+    "   --flash file        - program the device with an image saved with --compile\n" \
+    "   --dry-run           - print the packets which would be sent instead of opening the device\n" \
+    "   --record file       - record all transfers with the device in file\n" \
+    "   --replay file       - replay a session recorded with --record instead of opening the device\n" \
+    "   --backend name      - access the device with hidapi (default) or hidraw (Linux only, keeps the kernel driver)\n" \
+    "   --metrics file      - write counters and timings in the Prometheus text format to file on exit\n" \
+    "   --db file           - program the device with its image in a database built with footswitch-db\n" \
+    "   --reset             - reset the device after programming it, instead of unplugging it (scythe, scythe2)\n" \
+    "   --layout name       - type the following -s strings with a keyboard layout, e.g. de or fr (footswitch, scythe2)\n" \
+    "   --verify            - read the pedals back after programming and resend the ones which differ (footswitch, scythe, footswitch1p)\n" \
+    "   --watchdog ms       - exit with status 75 if a transfer hangs for ms milliseconds (see footswitchd)\n"
+
+typedef struct device_id
+{
+    unsigned short vid;
+    unsigned short pid;
+    unsigned short release;     // bcdDevice, i.e. the firmware version
+} device_id;
+
+// Set by --reset
+extern bool reset_after_write;
+// Set by --verify
+extern bool verify_after_write;
+
+// How many times the pedals which don't verify are sent again
+#define VERIFY_ATTEMPTS 3
+
+bool parse_device_option(int opt, const char *arg);
+bool is_device_option(int opt);
+
+/**
+ * Opens the first device which has one of the specified VID:PID pairs, the
+ * specified interface number (-1 matches any interface) and matches the
+ * device selection options. If a path has been given, it is opened directly
+ * without enumerating the bus. The device is locked against concurrent use by
+ * other processes until close_device() is called.
+ */
+hid_device *open_device(const unsigned short vid_pid[][2], size_t count, int interface);
+void close_device(hid_device *dev);
+
+/**
+ * Resets the USB device, which activates a new configuration like a replug
+ * would, and opens it again once it is back. The old handle is closed.
+ * Returns NULL if the device cannot be reset or doesn't come back within
+ * timeout_ms.
+ */
+hid_device *reset_device(hid_device *dev, int timeout_ms);
+
+// Returns the VID:PID and release of the device opened with open_device()
+bool get_device_id(device_id *id);
+// Returns the USB serial number of the opened device, if it has one
+bool get_device_serial(char *serial, size_t size);
+
+#endif
@@ -0,0 +1,104 @@
+/*
+Copyright (c) 2012 Radoslav Gerganov <rgerganov@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+#ifndef __EVRING_H__
+#define __EVRING_H__
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+/**
+ * A ring of pedal events in POSIX shared memory with one writer (the
+ * publisher in footswitch-events) and any number of readers. Readers only
+ * map it and never write to it: each event carries its sequence number,
+ * which the writer stores last, so a reader can tell a complete event from
+ * one which is being overwritten. The writer bumps a futex word after each
+ * event and wakes all the readers which sleep on it with one syscall.
+ * Linux only.
+ */
+
+#define EVRING_NAME "/footswitch-events"
+#define EVRING_MAGIC 0x46535631     // "FSV1"
+#define EVRING_SLOTS 1024           // a power of 2
+#define EVRING_KEY_SIZE 16
+
+enum evring_type {
+    EVRING_RELEASE,
+    EVRING_PRESS,
+};
+
+// The event as a reader sees it
+typedef struct evring_event
+{
+    uint64_t seq;
+    uint64_t time_ns;       // CLOCK_MONOTONIC when the report was read
+    uint8_t type;
+    uint8_t usage;          // HID usage of the key, 0xe0-0xe7 for the modifiers
+    uint8_t modifiers;      // of the whole report
+    char key[EVRING_KEY_SIZE];  // the name from decode_byte()
+} evring_event;
+
+/*
+ * A slot is made of 64-bit words so that it can be written and read with
+ * atomic stores and loads, without a lock and without a data race.
+ */
+typedef struct evring_slot
+{
+    atomic_uint_least64_t seq;
+    atomic_uint_least64_t time_ns;
+    atomic_uint_least64_t info;
+    atomic_uint_least64_t key[EVRING_KEY_SIZE / 8];
+} evring_slot;
+
+typedef struct evring
+{
+    uint32_t magic;
+    uint32_t slots;
+    atomic_uint_least64_t head;     // the sequence number of the next event
+    _Atomic uint32_t futex;         // bumped with every event
+    _Atomic int32_t publisher;      // its pid, 0 when it has exited
+    evring_slot slot[EVRING_SLOTS];
+} evring;
+
+// The reader side of a ring
+typedef struct evring_reader
+{
+    const evring *ring;
+    uint64_t next;          // the sequence number of the next event to read
+    uint64_t lost;          // events overwritten before they were read
+} evring_reader;
+
+// Creates the ring, or takes it over from a publisher which has exited
+evring *evring_create(const char *name);
+void evring_destroy(evring *ring);
+void evring_publish(evring *ring, const evring_event *e);
+
+// Maps an existing ring read-only, new events are read from now on
+bool evring_open(evring_reader *r, const char *name);
+void evring_close(evring_reader *r);
+/**
+ * Reads the next event, waiting up to timeout_ms (-1 for ever). Returns 1,
+ * 0 on timeout and -1 on errors. Events overwritten before they were read
+ * are skipped and counted in r->lost.
+ */
+int evring_read(evring_reader *r, evring_event *e, int timeout_ms);
+
+#endif
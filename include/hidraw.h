@@ -0,0 +1,68 @@
+/*
+Copyright (c) 2012 Radoslav Gerganov <rgerganov@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+#ifndef __HIDRAW_H__
+#define __HIDRAW_H__
+#include <stdbool.h>
+#include <stddef.h>
+#include <hidapi.h>
+
+/**
+ * Direct access to /dev/hidraw* (Linux only), selected with --backend hidraw.
+ * Unlike hidapi-libusb it doesn't detach the kernel driver, so the keyboard
+ * interface of a pedal keeps working while its configuration interface is
+ * used. The functions mirror their hidapi counterparts; the devices are
+ * plain file descriptors and reads use poll() on non-blocking descriptors.
+ */
+struct hid_device_info *hidraw_enumerate(unsigned short vid, unsigned short pid);
+void hidraw_free_enumeration(struct hid_device_info *info);
+hid_device *hidraw_open_path(const char *path);
+void hidraw_close(hid_device *dev);
+int hidraw_write(hid_device *dev, const unsigned char *data, size_t len);
+int hidraw_read_timeout(hid_device *dev, unsigned char *data, size_t len, int timeout_ms);
+int hidraw_send_feature(hid_device *dev, const unsigned char *data, size_t len);
+int hidraw_get_feature(hid_device *dev, unsigned char *data, size_t len);
+const wchar_t *hidraw_error(hid_device *dev);
+// The file descriptor of the node, to wait for it together with others
+int hidraw_fileno(hid_device *dev);
+
+/**
+ * Finds the USB location of /dev/hidrawN in the format of hidapi-libusb
+ * paths, "<bus>-<port>[.<port>...]:<config>.<interface>".
+ */
+bool hidraw_location(const char *path, char *location, size_t size);
+
+/**
+ * Finds the USB location of a device from the path used by either backend:
+ * /dev/hidrawN or a hidapi-libusb path in the current or the old
+ * "<bus>:<address>:<interface>" format. Fails for devices which are not on
+ * USB and on other platforms.
+ */
+bool hidraw_usb_location(const char *path, char *location, size_t size);
+
+// The keyboard interface (the first one) of the first device with one of the
+// VID:PID pairs, which is where the presses of a pedal arrive
+bool hidraw_find_keyboard(const unsigned short vid_pid[][2], size_t count, char *path, size_t size);
+
+// Resets the USB device at port ("<bus>-<port>[.<port>...]"), like a replug
+bool hidraw_reset_port(const char *port);
+
+#endif
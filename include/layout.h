@@ -0,0 +1,166 @@
+/*
+Copyright (c) 2012 Radoslav Gerganov <rgerganov@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+#ifndef __LAYOUT_H__
+#define __LAYOUT_H__
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Packet layouts of the supported models. Each table lists the fields of one
+ * report as FIELD(model, name, offset, min, max, sign); sign is -1 for fields
+ * which the device expects negated. A table generates the offsets
+ * (<model>_<name>), the indexes of the field descriptors
+ * (<model>_FIELD_<name>) and static asserts which check that every field is
+ * inside the report and fits in a byte. The descriptors drive the bounds
+ * checks, the encoders, the decoders and the printing of numeric fields.
+ *
+ * A new clone of a supported model is added to the <model>_DEVICES table.
+ */
+
+// footswitch: the first 8 bytes of the pedal data, read back in the same layout
+#define FOOTSWITCH_SIZE 8
+#define FOOTSWITCH_FIELDS(FIELD) \
+    FIELD(FOOTSWITCH, LEN,      0,    0,  255,  1) \
+    FIELD(FOOTSWITCH, TYPE,     1,    0,  255,  1) \
+    FIELD(FOOTSWITCH, MOD,      2,    0,  255,  1) \
+    FIELD(FOOTSWITCH, KEY,      3,    0,  255,  1) \
+    FIELD(FOOTSWITCH, BUTTON,   4,    0,  255,  1) \
+    FIELD(FOOTSWITCH, X,        5, -128,  127,  1) \
+    FIELD(FOOTSWITCH, Y,        6, -128,  127,  1) \
+    FIELD(FOOTSWITCH, W,        7, -128,  127,  1)
+
+#define FOOTSWITCH_DEVICES(DEVICE) \
+    DEVICE(0x0c45, 0x7403) \
+    DEVICE(0x0c45, 0x7404) \
+    DEVICE(0x413d, 0x2107) \
+    DEVICE(0x1a86, 0xe026) \
+    DEVICE(0x3553, 0xb001)
+
+// scythe: the two feature reports which program a pedal
+#define SCYTHE_SIZE 16
+#define SCYTHE_FIELDS(FIELD) \
+    FIELD(SCYTHE, REPORT_ID,    0,    0,  255,  1) \
+    FIELD(SCYTHE, PEDAL,        1,    1,    3,  1) \
+    FIELD(SCYTHE, MOD,          4,    0,  255,  1) \
+    FIELD(SCYTHE, BUTTON,       4,    0,  255,  1) \
+    FIELD(SCYTHE, KEY1,         6,    0,  255,  1) \
+    FIELD(SCYTHE, KEY2,         7,    0,  255,  1) \
+    FIELD(SCYTHE, KEY3,         9,    0,  255,  1) \
+    FIELD(SCYTHE, KEY4,        10,    0,  255,  1) \
+    FIELD(SCYTHE, KEY5,        11,    0,  255,  1)
+
+// scythe: the response to a query of one pedal
+#define SCYTHE_RESPONSE_SIZE 8
+#define SCYTHE_RESPONSE_FIELDS(FIELD) \
+    FIELD(SCYTHE_RESPONSE, REPORT_ID,   0,    0,  255,  1) \
+    FIELD(SCYTHE_RESPONSE, MOD,         1,    0,  255,  1) \
+    FIELD(SCYTHE_RESPONSE, BUTTON,      1,    0,  255,  1) \
+    FIELD(SCYTHE_RESPONSE, KEY1,        3,    0,  255,  1) \
+    FIELD(SCYTHE_RESPONSE, KEY2,        4,    0,  255,  1) \
+    FIELD(SCYTHE_RESPONSE, KEY3,        5,    0,  255,  1) \
+    FIELD(SCYTHE_RESPONSE, KEY4,        6,    0,  255,  1) \
+    FIELD(SCYTHE_RESPONSE, KEY5,        7,    0,  255,  1)
+
+#define SCYTHE_DEVICES(DEVICE) \
+    DEVICE(0x0426, 0x3011)
+
+// scythe2: the UpdateEx feature report
+#define SCYTHE2_SIZE 0x48
+#define SCYTHE2_FIELDS(FIELD) \
+    FIELD(SCYTHE2, REPORT_ID,   0,    0,  255,  1) \
+    FIELD(SCYTHE2, MAGIC1,      1,    0,  255,  1) \
+    FIELD(SCYTHE2, MAGIC2,      2,    0,  255,  1) \
+    FIELD(SCYTHE2, COMMAND,     3,    0,  255,  1) \
+    FIELD(SCYTHE2, OFFSET_HI,   4,    0,  255,  1) \
+    FIELD(SCYTHE2, OFFSET_LO,   5,    0,  255,  1) \
+    FIELD(SCYTHE2, COUNT,       6,    0, 0x20,  1) \
+    FIELD(SCYTHE2, CHECKSUM,    7,    0,  255,  1) \
+    FIELD(SCYTHE2, PAYLOAD,     8,    0,  255,  1)
+
+// scythe2: the settings of one pedal, followed by (count - 1) more mod/code pairs
+#define SCYTHE2_PEDAL_SIZE 4
+#define SCYTHE2_PEDAL_FIELDS(FIELD) \
+    FIELD(SCYTHE2_PEDAL, COUNT,     0,    0,  255,  1) \
+    FIELD(SCYTHE2_PEDAL, TYPE,      1,    0,  255,  1) \
+    FIELD(SCYTHE2_PEDAL, MOD,       2,    0,  255,  1) \
+    FIELD(SCYTHE2_PEDAL, CODE,      3,    0,  255,  1)
+
+#define SCYTHE2_DEVICES(DEVICE) \
+    DEVICE(0x055a, 0x0998)
+
+// footswitch1p: the output report which programs the pedal
+#define FOOTSWITCH1P_SIZE 64
+#define FOOTSWITCH1P_FIELDS(FIELD) \
+    FIELD(FOOTSWITCH1P, REPORT_ID,  0,    0,  255,  1) \
+    FIELD(FOOTSWITCH1P, PIN,        1,    0,  255,  1) \
+    FIELD(FOOTSWITCH1P, COMMAND,    2,    0,  255,  1) \
+    FIELD(FOOTSWITCH1P, LENGTH,     3,    0,  255,  1) \
+    FIELD(FOOTSWITCH1P, MOD,        4,    0,  255,  1) \
+    FIELD(FOOTSWITCH1P, BUTTON,     4,    0,  255,  1) \
+    FIELD(FOOTSWITCH1P, KEY,        6,    0,  255,  1) \
+    FIELD(FOOTSWITCH1P, X,          5, -128,  127, -1) \
+    FIELD(FOOTSWITCH1P, Y,          6, -128,  127, -1) \
+    FIELD(FOOTSWITCH1P, W,          7, -128,  127,  1) \
+    FIELD(FOOTSWITCH1P, DEVICE_ID,  4,    0,  255,  1)
+
+#define FOOTSWITCH1P_DEVICES(DEVICE) \
+    DEVICE(0x5131, 0x2019)
+
+typedef struct layout_field
+{
+    const char *name;
+    uint8_t offset;
+    int8_t sign;
+    int16_t min, max;
+} layout_field;
+
+#define LAYOUT_OFFSET(model, name, offset, min, max, sign) model##_##name = offset,
+#define LAYOUT_INDEX(model, name, offset, min, max, sign) model##_FIELD_##name,
+#define LAYOUT_DESCRIPTOR(model, name, offset, min, max, sign) {#name, offset, sign, min, max},
+#define LAYOUT_ASSERT(model, name, offset, min, max, sign) \
+    _Static_assert(offset < model##_SIZE, #model "_" #name " is outside of the report"); \
+    _Static_assert(min >= -128 && max <= 255 && min <= max, #model "_" #name " doesn't fit in a byte");
+#define LAYOUT_VID_PID(vid, pid) {vid, pid},
+
+#define LAYOUT_DECLARE(model, fields) \
+    enum { fields(LAYOUT_OFFSET) }; \
+    enum { fields(LAYOUT_INDEX) model##_NUM_FIELDS }; \
+    fields(LAYOUT_ASSERT) \
+    extern const layout_field model##_fields[model##_NUM_FIELDS];
+
+LAYOUT_DECLARE(FOOTSWITCH, FOOTSWITCH_FIELDS)
+LAYOUT_DECLARE(SCYTHE, SCYTHE_FIELDS)
+LAYOUT_DECLARE(SCYTHE_RESPONSE, SCYTHE_RESPONSE_FIELDS)
+LAYOUT_DECLARE(SCYTHE2, SCYTHE2_FIELDS)
+LAYOUT_DECLARE(SCYTHE2_PEDAL, SCYTHE2_PEDAL_FIELDS)
+LAYOUT_DECLARE(FOOTSWITCH1P, FOOTSWITCH1P_FIELDS)
+
+#define LAYOUT_FIELD(model, name) (&model##_fields[model##_FIELD_##name])
+
+// Checks the bounds of the field and stores value in the report
+bool layout_encode(const layout_field *f, uint8_t *report, int value);
+int layout_decode(const layout_field *f, const uint8_t *report);
+// Appends count consecutive fields to out as <name>=<value> separated with spaces
+void layout_format(const layout_field *f, int count, const uint8_t *report, char *out, size_t size);
+
+#endif
@@ -0,0 +1,41 @@
+/*
+Copyright (c) 2012 Radoslav Gerganov <rgerganov@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+#ifndef __LOCK_H__
+#define __LOCK_H__
+#include <stdbool.h>
+
+// How long to wait for other processes using the same device, -1 is forever
+extern int lock_timeout_ms;
+
+/**
+ * Takes an advisory lock on the device with the specified path. Processes
+ * waiting for the same device are served in the order they have asked for
+ * it. A lock still held from an earlier call is released first. Returns
+ * false if the lock cannot be taken within lock_timeout_ms.
+ */
+bool lock_device(const char *path);
+void unlock_device();
+
+// Time spent waiting for the last lock in microseconds
+long lock_wait_us();
+
+#endif
@@ -0,0 +1,79 @@
+/*
+Copyright (c) 2012 Radoslav Gerganov <rgerganov@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+#ifndef __METRICS_H__
+#define __METRICS_H__
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * Counters and latency histograms in the Prometheus text format. Every
+ * thread records into its own shard with plain loads and stores, so nothing
+ * is shared on the transfer path; the shards are summed only on export.
+ */
+
+enum metric_counter {
+    METRIC_TRANSFERS,
+    METRIC_BYTES,
+    METRIC_RETRIES,
+    METRIC_FAILURES,        // fatal() errors
+    METRIC_EVENTS,
+    METRIC_MISMATCHES,      // pedals sent again by --verify
+    METRIC_RECOVERIES,      // devices recovered after hanging or failing (footswitchd, footswitch-events)
+    METRIC_COUNTERS,
+};
+
+enum metric_histogram {
+    METRIC_DISCOVERY,       // finding, locking and opening the device
+    METRIC_START_WAIT,      // the start packet and the pause after it
+    METRIC_PEDAL_WRITE,     // the remaining packets of a plan
+    METRIC_READBACK,        // reading the configuration of the device
+    METRIC_EVENT_DISPATCH,  // from a pedal event to its handler
+    METRIC_PLUG_TO_READY,   // from plugging a device in to its profile being applied
+    METRIC_RECOVERY,        // from a device hanging or failing to it working again
+    METRIC_HISTOGRAMS,
+};
+
+// Set by --metrics file, the metrics are written there when the tool exits
+extern const char *metrics_path;
+
+void metrics_add(enum metric_counter c, uint64_t n);
+// Monotonic time in microseconds, the start of an observation
+uint64_t metrics_now();
+// Records the time elapsed since start (from metrics_now())
+void metrics_observe(enum metric_histogram h, uint64_t start);
+
+void metrics_write(FILE *out);
+// Replaces path atomically, for the textfile collector of node_exporter
+bool metrics_write_textfile(const char *path);
+// Writes the metrics to metrics_path when the process exits
+void metrics_export_at_exit();
+
+/**
+ * Serving the metrics on a Unix socket, for long-running modes: every client
+ * which connects gets the current metrics and is disconnected. Call
+ * metrics_serve() when the socket returned by metrics_listen() is readable.
+ */
+int metrics_listen(const char *path);
+void metrics_serve(int fd);
+
+#endif
@@ -0,0 +1,43 @@
+/*
+Copyright (c) 2012 Radoslav Gerganov <rgerganov@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+#ifndef __PACING_H__
+#define __PACING_H__
+#include <stdbool.h>
+#include "device.h"
+
+typedef struct pacing
+{
+    unsigned int gap_us;    // pause after each packet
+    unsigned int start_us;  // additional pause after the packet which starts programming
+} pacing;
+
+/**
+ * Calibrated timings are cached per VID:PID and firmware release in
+ * $XDG_CACHE_HOME/footswitch/timing (~/.cache/footswitch/timing), one line
+ * per device model:
+ *
+ *   <vid>:<pid>:<release> <gap_us> <start_us>
+ */
+bool pacing_load(const device_id *id, pacing *p);
+bool pacing_save(const device_id *id, const pacing *p);
+
+#endif
@@ -0,0 +1,59 @@
+/*
+Copyright (c) 2012 Radoslav Gerganov <rgerganov@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+#ifndef __PEDAL_H__
+#define __PEDAL_H__
+#include <signal.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * What the tools which follow the presses of a pedal (footswitch-events and
+ * footswitch-midi) share: finding its keyboard interface, waiting for its
+ * reports and stopping on a signal.
+ */
+
+// Set by SIGINT and SIGTERM once pedal_catch_signals() has been called
+extern volatile sig_atomic_t pedal_stop;
+
+// Installs the handlers without SA_RESTART, so that a signal interrupts the
+// blocking reads and waits
+void pedal_catch_signals();
+
+// CLOCK_MONOTONIC in nanoseconds, the arrival time of a report
+uint64_t pedal_now_ns();
+
+// The hidraw node of the keyboard interface of the first supported pedal
+bool pedal_find(char *path, size_t size);
+
+/**
+ * Waits for a report on fd and meanwhile serves the metrics on the listening
+ * socket metrics (see metrics_listen()), unless it is -1. Returns false if
+ * interrupted.
+ */
+bool pedal_wait(int fd, int metrics);
+
+// The 8 bytes of a boot keyboard report, which follow the report ID if there
+// is one, or NULL if the report is too short
+const uint8_t *pedal_keys(const uint8_t *report, int len);
+
+#endif
@@ -0,0 +1,140 @@
+/*
+Copyright (c) 2012 Radoslav Gerganov <rgerganov@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+#ifndef __PLAN_H__
+#define __PLAN_H__
+#include <stdbool.h>
+#include <stdint.h>
+#include <hidapi.h>
+
+// The largest report we send (scythe2)
+#define PACKET_SIZE 0x48
+
+// Estimated duration of one transfer (one interrupt interval of a full speed
+// device), used to predict the programming time
+#define PACKET_XFER_US 1000
+
+enum packet_type {
+    PACKET_OUTPUT = 0,      // sent with hid_write()
+    PACKET_FEATURE = 1,     // sent with hid_send_feature_report()
+};
+
+enum packet_flags {
+    PACKET_COMMIT = 1,      // the device is in a consistent state after this packet
+    PACKET_PREAMBLE = 2,    // must be sent again before resuming after this packet
+};
+
+typedef struct packet
+{
+    uint8_t type;
+    uint8_t flags;
+    uint16_t len;
+    uint32_t delay_us;      // pause after sending the packet
+    uint8_t data[PACKET_SIZE];
+} packet;
+
+// Packets are stored as they are in images and journals
+_Static_assert(sizeof(packet) == 8 + PACKET_SIZE, "packet must not have padding");
+
+/**
+ * A plan is the exact sequence of packets which programs a device. Packets
+ * between two commit points form a unit which is sent again from its first
+ * packet if any of them fails.
+ */
+typedef struct plan
+{
+    packet *packets;
+    int count;
+    int capacity;
+    size_t mapped;          // size of the mapping if loaded with plan_map()
+} plan;
+
+/**
+ * A compiled image is a header followed by the packets of a plan, so it can
+ * be mapped and sent without any parsing.
+ */
+typedef struct image_header
+{
+    char magic[4];
+    char model[16];         // the program which has compiled the image, 0-terminated
+    uint32_t count;
+} image_header;
+
+// When set, plan_run() records its progress in this file and resumes an
+// interrupted run of the same plan from its last commit point
+extern const char *journal_path;
+
+// Set by --compile -o <file> and --flash <file>
+extern bool compile_only;
+extern const char *output_path;
+extern const char *flash_path;
+// Set by --dry-run, the plan is printed instead of sent
+extern bool dry_run;
+
+void plan_add(plan *p, enum packet_type type, const uint8_t *data, int len, unsigned int delay_us, int flags);
+void plan_free(plan *p);
+/**
+ * Adds the preamble of src and then the units (the packets up to the next
+ * commit point) which start at the packets in first[], so that only some
+ * parts of a plan are sent again.
+ */
+void plan_add_units(plan *dst, const plan *src, const int *first, int count);
+bool plan_run(hid_device *dev, const plan *p);
+// Prints the packets with their pauses and the predicted programming time
+void plan_print(const plan *p);
+
+bool plan_save(const plan *p, const char *model, const char *path);
+// Maps an image created with plan_save(), plan_free() unmaps it
+bool plan_map(plan *p, const char *model, const char *path);
+// Uses an image which is already in memory (any model if NULL), the plan
+// doesn't own the packets and plan_free() leaves them alone. Images with a
+// packet of an unknown type or flags, or longer than PACKET_SIZE, are rejected.
+bool plan_view(plan *p, const char *model, const void *image, size_t size);
+
+/**
+ * Checks that --compile, -o, --flash and --dry-run are not mixed with each
+ * other or with options which configure pedals (write) or select other modes.
+ */
+bool image_options_valid(bool write, bool other);
+// Saves the plan to output_path or exits
+void save_image(const plan *p, const char *model);
+// Maps the image in flash_path or exits
+void load_image(plan *p, const char *model);
+
+// What run_image_options() needs from a tool
+typedef struct image_tool
+{
+    const char *model;
+    void (*build)(plan *p);         // compiles the plan of the pedal options
+    void (*init)();                 // opens the device
+    void (*run)(const plan *p);     // sends the plan (and verifies it) or exits
+    void (*deinit)();
+} image_tool;
+
+/**
+ * Handles --flash, --db, --compile and --dry-run: the plan is loaded from an
+ * image or built from the pedal options, then printed, saved or sent.
+ * Returns false if none of them is given and the tool has to do its usual
+ * work.
+ */
+bool run_image_options(const image_tool *tool);
+
+#endif
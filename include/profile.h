@@ -0,0 +1,73 @@
+/*
+Copyright (c) 2012 Radoslav Gerganov <rgerganov@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+#ifndef __PROFILE_H__
+#define __PROFILE_H__
+#include <stdbool.h>
+#include "pacing.h"
+#include "plan.h"
+
+// KEY and MOUSE types can be combined
+#define KEY_TYPE    1
+#define MOUSE_TYPE    2
+// STRING must be by itself
+#define STRING_TYPE    4
+
+// Timing which works for all supported devices, see calibrate()
+#define DEFAULT_GAP_US      (30 * 1000)
+#define DEFAULT_START_US    (1000 * 1000)
+
+typedef struct pedal_data
+{
+    unsigned char header[8];
+    unsigned char data[48];
+    int data_len;
+} pedal_data;
+
+/**
+ * The configuration of the three pedals of a footswitch. A profile does not
+ * use any global state, so profiles can be compiled on several threads.
+ */
+typedef struct profile
+{
+    unsigned char start[8];
+    pedal_data pedals[3];
+    pedal_data *curr;       // the pedal which is configured by the options
+    char error[128];        // why the last option has been rejected
+} profile;
+
+enum profile_status {
+    PROFILE_OK = 0,
+    PROFILE_INVALID,        // the argument of the option is invalid
+    PROFILE_CONFLICT,       // the option cannot be combined with the previous ones
+};
+
+void profile_init(profile *pr);
+/**
+ * Applies one of the pedal options of footswitch (-123sSakmbcxyw) to the
+ * profile. The argument may be modified.
+ */
+enum profile_status profile_option(profile *pr, int opt, char *arg);
+bool profile_is_option(int opt);
+bool profile_option_has_arg(int opt);
+void profile_plan(const profile *pr, const pacing *pace, plan *p);
+
+#endif
@@ -0,0 +1,89 @@
+/*
+Copyright (c) 2012 Radoslav Gerganov <rgerganov@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+#ifndef __PROFILEDB_H__
+#define __PROFILEDB_H__
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "plan.h"
+
+/**
+ * A profile database maps device serial numbers or VID:PIDs ("0c45:7403")
+ * to compiled images. It is a header, an open addressing hash table and the
+ * keys and images, so a lookup is a hash, a few probes and a pointer into
+ * the mapping. Databases are only written by profiledb_build(), which
+ * renames a complete file over the old one, so readers never see a torn
+ * database and keep their old mapping until they open it again.
+ */
+
+#define PROFILEDB_MAGIC "FSD1"
+
+typedef struct profiledb_header
+{
+    char magic[4];
+    uint32_t slots;         // a power of two
+    uint32_t count;
+    uint32_t reserved;
+} profiledb_header;
+
+typedef struct profiledb_slot
+{
+    uint32_t hash;
+    uint32_t key_offset;    // 0 for empty slots
+    uint32_t image_offset;
+    uint32_t image_size;
+} profiledb_slot;
+
+typedef struct profiledb
+{
+    const uint8_t *base;
+    size_t size;
+} profiledb;
+
+// Set by --db file, the image is looked up by the device which is found
+extern const char *db_path;
+
+// Only the header is checked, lookups check the entry which they return
+bool profiledb_open(profiledb *db, const char *path);
+void profiledb_close(profiledb *db);
+
+// Returns true if every entry has a valid key and image (see plan_view())
+bool profiledb_check(const profiledb *db);
+
+/**
+ * Finds the image stored for key and checks that it has been compiled by
+ * model. The packets of the plan point into the mapping, so the plan must
+ * not be used after profiledb_close().
+ */
+bool profiledb_lookup(const profiledb *db, const char *key, const char *model, plan *p);
+
+// Calls fn for each entry
+void profiledb_foreach(const profiledb *db, void (*fn)(const char *key, const image_header *hdr));
+
+// Writes a database with the images in the specified files
+bool profiledb_build(const char *path, char *const keys[], char *const images[], int count);
+
+// Looks up the image of the opened device in db_path by its serial number,
+// then by its VID:PID, or exits
+void db_load_image(plan *p, const char *model);
+
+#endif
@@ -0,0 +1,71 @@
+/*
+Copyright (c) 2012 Radoslav Gerganov <rgerganov@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+#ifndef __SESSION_H__
+#define __SESSION_H__
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <hidapi.h>
+#include "device.h"
+#include "transfer.h"
+
+/**
+ * A session log records every transfer with its time, result and data:
+ *
+ *   session_header, then for each transfer a session_entry followed by
+ *   len bytes (the data sent, or the data received if the result > 0)
+ *
+ * A replayed session feeds the recorded input reports and errors to the
+ * program instead of a device and compares the output reports with the
+ * recorded ones.
+ */
+typedef struct session_header
+{
+    char magic[4];
+    uint16_t vid, pid, release;
+    uint16_t reserved;
+} session_header;
+
+typedef struct session_entry
+{
+    uint32_t time_us;       // since the device has been opened
+    uint8_t op;             // enum xfer_op
+    uint8_t err;            // errno if the transfer has failed
+    int16_t result;
+    uint16_t len;
+    uint16_t reserved;
+} session_entry;
+
+// Set by --record <file> and --replay <file>
+extern const char *record_path;
+extern const char *replay_path;
+
+bool session_record_start(const device_id *id);
+void session_record(enum xfer_op op, const unsigned char *data, size_t len, int result, int err);
+
+// Loads the replayed session and returns the device which stands in for the real one
+hid_device *session_replay_start(device_id *id);
+bool session_replaying();
+// Returns the recorded result of the transfer and sets errno like hidapi does
+int session_replay(enum xfer_op op, unsigned char *data, size_t len);
+
+#endif
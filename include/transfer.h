@@ -0,0 +1,98 @@
+/*
+Copyright (c) 2012 Radoslav Gerganov <rgerganov@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+#ifndef __TRANSFER_H__
+#define __TRANSFER_H__
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <hidapi.h>
+
+// Negative results of the xfer_* functions
+enum xfer_status {
+    XFER_TRANSIENT = -1,    // timeout or a glitch, the operation may be repeated
+    XFER_PERMANENT = -2,    // the device is gone or cannot be accessed
+};
+
+struct xfer_policy {
+    int timeout_ms;     // deadline for a single read
+    int retries;        // how many times a failed operation is repeated
+    int backoff_ms;     // delay before the first retry, doubled on each next one
+    int watchdog_ms;    // a transfer which doesn't return by then ends the process, 0 for never
+};
+
+// The exit status of a process whose device has stopped responding, see
+// xfer_policy.watchdog_ms (EX_TEMPFAIL)
+#define XFER_HUNG_EXIT 75
+
+extern struct xfer_policy xfer_policy;
+
+enum xfer_backend {
+    BACKEND_HIDAPI,
+    BACKEND_HIDRAW,     // /dev/hidraw*, see hidraw.h
+};
+
+extern enum xfer_backend xfer_backend;
+
+enum xfer_op {
+    OP_WRITE,
+    OP_READ,
+    OP_SEND_FEATURE,
+    OP_GET_FEATURE,
+    OP_DRAIN,           // a read which doesn't wait
+};
+
+/**
+ * Writes, sends and gets are retried with exponential backoff as long as the
+ * errors are transient. Reads are bounded by xfer_policy.timeout_ms and are
+ * not retried because the device answers only once per query, so the caller
+ * has to repeat the whole query.
+ *
+ * All functions return the number of bytes transferred or one of the
+ * xfer_status values.
+ */
+int xfer_write(hid_device *dev, const unsigned char *data, size_t len);
+int xfer_read(hid_device *dev, unsigned char *data, size_t len);
+int xfer_send_feature(hid_device *dev, const unsigned char *data, size_t len);
+int xfer_get_feature(hid_device *dev, unsigned char *data, size_t len);
+
+// Discards any input reports which are still queued, e.g. late answers to a
+// query which has timed out
+void xfer_drain(hid_device *dev);
+
+/**
+ * Runs a multi-packet sequence until it succeeds, restarting it from its
+ * beginning with exponential backoff. Returns false if it still fails after
+ * xfer_policy.retries restarts.
+ */
+bool xfer_sequence(bool (*seq)(void *arg), void *arg);
+
+// Sleeps before the specified retry attempt
+void xfer_backoff(int attempt);
+
+// hid_error() which also works for replayed sessions and other backends
+const wchar_t *xfer_error(hid_device *dev);
+
+// Prints the number, average and maximum duration of the transfers of each
+// type made so far, to compare the backends
+void xfer_print_stats(FILE *out);
+
+#endif
@@ -0,0 +1,53 @@
+/*
+Copyright (c) 2012 Radoslav Gerganov <rgerganov@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+#ifndef __VDEV_H__
+#define __VDEV_H__
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Virtual HID devices created with /dev/uhid (Linux only), used by fsemu and
+ * latency to stand in for real pedals.
+ */
+typedef struct vdev
+{
+    int fd;
+    char uniq[64];
+    char path[32];          // the hidraw node, once it appears
+} vdev;
+
+// A boot keyboard, which is what the pedals look like to the host
+extern const uint8_t vdev_keyboard_rdesc[];
+extern const size_t vdev_keyboard_rdesc_size;
+
+// role tells the devices of one process apart, it is part of the unique ID
+bool vdev_create(vdev *d, const char *name, const char *role, unsigned short vid, unsigned short pid,
+                 const uint8_t *rdesc, size_t size);
+void vdev_destroy(vdev *d);
+bool vdev_input(vdev *d, const uint8_t *data, size_t len);
+// Finds the hidraw node of the device by its unique ID and stores it in d->path
+bool vdev_find_hidraw(vdev *d);
+// Finds the evdev node of the device, after vdev_find_hidraw() has succeeded
+bool vdev_find_event(const vdev *d, char *path, size_t size);
+
+#endif
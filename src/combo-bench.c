@@ -0,0 +1,142 @@
+/*
+Copyright (c) 2012 Radoslav Gerganov <rgerganov@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+/**
+ * Compares parse_combos() with the per-token scans which the tools used
+ * before: a strcasecmp chain for modifiers and buttons and a linear search
+ * of the keymap for keys. Built and run with 'make bench'.
+ */
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include "common.h"
+
+#define ROUNDS 200000
+
+static const char *exprs[] = {
+    "l_ctrl+r_shift+f5",
+    "ctrl+c,ctrl+v",
+    "mouse_left+ctrl",
+    "alt+f4",
+    "win+XF86AudioMute",
+    "shift+KP_Enter",
+    "ctrl+alt+delete",
+    "r_alt+Hangul_Hanja",
+    "a,b,c,d,e,f,g,h",
+    "mouse_double",
+};
+
+#define EXPRS_SIZE (sizeof(exprs) / sizeof(exprs[0]))
+
+static const char *scan_names[] = {
+    "ctrl", "alt", "win", "shift", "l_ctrl", "l_alt", "l_win", "l_shift",
+    "r_ctrl", "r_alt", "r_win", "r_shift",
+};
+static const unsigned char scan_values[] = {
+    CTRL, ALT, WIN, SHIFT, CTRL, ALT, WIN, SHIFT, R_CTRL, R_ALT, R_WIN, R_SHIFT,
+};
+static const char *scan_buttons[] = {"mouse_left", "mouse_middle", "mouse_right", "mouse_double"};
+static const unsigned char scan_button_values[] = {MOUSE_LEFT, MOUSE_MIDDLE, MOUSE_RIGHT, MOUSE_DOUBLE};
+
+static const keymap_entry *keymap = NULL;
+static size_t keymap_size = 0;
+
+static bool scan_token(const char *tok, combo *c) {
+    for (int i = 0 ; i < sizeof(scan_names) / sizeof(scan_names[0]) ; i++) {
+        if (strcasecmp(scan_names[i], tok) == 0) {
+            c->modifiers |= scan_values[i];
+            return true;
+        }
+    }
+    for (int i = 0 ; i < 4 ; i++) {
+        if (strcasecmp(scan_buttons[i], tok) == 0) {
+            c->buttons |= scan_button_values[i];
+            return true;
+        }
+    }
+    for (size_t i = 0 ; i < keymap_size ; i++) {
+        if (strcasecmp(keymap[i].name, tok) == 0) {
+            c->keys[c->key_count++] = keymap[i].value;
+            return true;
+        }
+    }
+    return false;
+}
+
+// The expression is split with strtok_r and every token is scanned
+static int scan_combos(const char *expr, combo *combos, int max) {
+    char buf[256], *seq_save = NULL, *seq = NULL;
+    int count = 0;
+
+    snprintf(buf, sizeof(buf), "%s", expr);
+    for (seq = strtok_r(buf, ",", &seq_save) ; seq != NULL && count < max ; seq = strtok_r(NULL, ",", &seq_save)) {
+        char *save = NULL, *tok = NULL;
+        combo *c = &combos[count++];
+
+        memset(c, 0, sizeof(*c));
+        for (tok = strtok_r(seq, "+", &save) ; tok != NULL ; tok = strtok_r(NULL, "+", &save)) {
+            if (!scan_token(tok, c)) {
+                return -1;
+            }
+        }
+    }
+    return count;
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int main(void) {
+    combo a[8], b[8];
+    char err[128];
+    uint64_t start, scan_ns, hash_ns;
+    unsigned sum = 0;
+
+    keymap = get_keymap(&keymap_size);
+    for (int i = 0 ; i < EXPRS_SIZE ; i++) {
+        int n = scan_combos(exprs[i], a, 8);
+        if (n != parse_combos(exprs[i], b, 8, err, sizeof(err)) || memcmp(a, b, n * sizeof(combo)) != 0) {
+            fprintf(stderr, "Results differ for '%s'\n", exprs[i]);
+            return 1;
+        }
+    }
+    start = now_ns();
+    for (int r = 0 ; r < ROUNDS ; r++) {
+        sum += scan_combos(exprs[r % EXPRS_SIZE], a, 8);
+    }
+    scan_ns = now_ns() - start;
+    start = now_ns();
+    for (int r = 0 ; r < ROUNDS ; r++) {
+        sum += parse_combos(exprs[r % EXPRS_SIZE], b, 8, err, sizeof(err));
+    }
+    hash_ns = now_ns() - start;
+    printf("%d expressions (%u combos)\n", ROUNDS, sum / 2);
+    printf("per-token scans: %8.1f ns/expression\n", (double) scan_ns / ROUNDS);
+    printf("hashed parser:   %8.1f ns/expression\n", (double) hash_ns / ROUNDS);
+    printf("speedup:         %8.1fx\n", (double) scan_ns / hash_ns);
+    return 0;
+}
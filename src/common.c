@@ -21,16 +21,13 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
 THE SOFTWARE.
 */
 #include <ctype.h>
+#include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include <strings.h>
 #include "common.h"
-
-typedef struct keymap_entry
-{
-    const char *name;
-    unsigned char value;
-} keymap_entry;
+#include "keymaps.h"
 
 // see http://www.freebsddiary.org/APC/usb_hid_usages.php
 static const keymap_entry keymap[] =
@@ -315,92 +312,277 @@ static const keymap_entry keymap[] =
 
 #define KEYMAP_SIZE (sizeof(keymap)/sizeof(keymap_entry))
 
+static const keymap_entry modifiers[] =
+{
+    {"ctrl",        CTRL},
+    {"shift",       SHIFT},
+    {"alt",         ALT},
+    {"win",         WIN},
+    {"l_ctrl",      CTRL},
+    {"l_shift",     SHIFT},
+    {"l_alt",       ALT},
+    {"l_win",       WIN},
+    {"r_ctrl",      R_CTRL},
+    {"r_shift",     R_SHIFT},
+    {"r_alt",       R_ALT},
+    {"r_win",       R_WIN},
+};
+
+static const keymap_entry buttons[] =
+{
+    {"mouse_left",   MOUSE_LEFT},
+    {"mouse_right",  MOUSE_RIGHT},
+    {"mouse_middle", MOUSE_MIDDLE},
+    {"mouse_double", MOUSE_DOUBLE},
+};
+
+typedef struct symbol
+{
+    const char *name;
+    enum symbol_kind kind;
+    unsigned char value;
+} symbol;
+
+// Open addressing, the size is a power of two and more than twice the number of names
+#define SYMBOLS_SIZE 1024
+
+static symbol symbols[SYMBOLS_SIZE];
+static bool char_valid[256];
+static unsigned char char_codes[256];
+
+// FNV-1a of the lower case name, names are case insensitive
+static uint32_t hash_name(const char *name, size_t len) {
+    uint32_t h = 2166136261u;
+
+    for (size_t i = 0 ; i < len ; i++) {
+        h ^= (unsigned char) tolower((unsigned char) name[i]);
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static void add_symbol(const char *name, enum symbol_kind kind, unsigned char value) {
+    for (uint32_t i = hash_name(name, strlen(name)) ; ; i++) {
+        symbol *s = &symbols[i & (SYMBOLS_SIZE - 1)];
+        if (s->name == NULL) {
+            s->name = name;
+            s->kind = kind;
+            s->value = value;
+            return;
+        }
+        // the first name wins, as it did with the linear scans of keymap
+        if (strcasecmp(s->name, name) == 0) {
+            return;
+        }
+    }
+}
+
+static const symbol *lookup_symbol(const char *name, size_t len) {
+    for (uint32_t i = hash_name(name, len) ; ; i++) {
+        const symbol *s = &symbols[i & (SYMBOLS_SIZE - 1)];
+        if (s->name == NULL) {
+            return NULL;
+        }
+        if (strncasecmp(s->name, name, len) == 0 && s->name[len] == 0) {
+            return s;
+        }
+    }
+}
+
+// Runs before main(), so the tables are complete before any thread is started
+__attribute__((constructor))
+static void init_symbols(void) {
+    for (int i = 0 ; i < sizeof(modifiers) / sizeof(modifiers[0]) ; i++) {
+        add_symbol(modifiers[i].name, SYMBOL_MODIFIER, modifiers[i].value);
+    }
+    for (int i = 0 ; i < sizeof(buttons) / sizeof(buttons[0]) ; i++) {
+        add_symbol(buttons[i].name, SYMBOL_BUTTON, buttons[i].value);
+    }
+    for (int i = 0 ; i < KEYMAP_SIZE ; i++) {
+        unsigned char ch = keymap[i].name[0];
+        add_symbol(keymap[i].name, SYMBOL_KEY, keymap[i].value);
+        if (strlen(keymap[i].name) == 1 && !char_valid[ch]) {
+            char_valid[ch] = true;
+            char_codes[ch] = keymap[i].value;
+        }
+    }
+}
+
+static bool lookup(const char *name, enum symbol_kind kind, unsigned char *value) {
+    const symbol *s = lookup_symbol(name, strlen(name));
+
+    if (s == NULL || s->kind != kind) {
+        return false;
+    }
+    *value = s->value;
+    return true;
+}
+
 bool parse_modifier(const char *arg, enum modifier *mod) {
-    if (strcasecmp("ctrl", arg) == 0) {
-        *mod = CTRL;
-        return true;
-    } else if (strcasecmp("alt", arg) == 0) {
-        *mod = ALT;
-        return true;
-    } else if (strcasecmp("win", arg) == 0) {
-        *mod = WIN;
-        return true;
-    } else if (strcasecmp("shift", arg) == 0) {
-        *mod = SHIFT;
-        return true;
-    } else if (strcasecmp("l_ctrl", arg) == 0) {
-        *mod = CTRL;
-        return true;
-    } else if (strcasecmp("l_alt", arg) == 0) {
-        *mod = ALT;
-        return true;
-    } else if (strcasecmp("l_win", arg) == 0) {
-        *mod = WIN;
-        return true;
-    } else if (strcasecmp("l_shift", arg) == 0) {
-        *mod = SHIFT;
-        return true;
-    }  else if (strcasecmp("r_ctrl", arg) == 0) {
-        *mod = R_CTRL;
-        return true;
-    } else if (strcasecmp("r_alt", arg) == 0) {
-        *mod = R_ALT;
-        return true;
-    } else if (strcasecmp("r_win", arg) == 0) {
-        *mod = R_WIN;
-        return true;
-    } else if (strcasecmp("r_shift", arg) == 0) {
-        *mod = R_SHIFT;
-        return true;
+    unsigned char value;
+
+    if (!lookup(arg, SYMBOL_MODIFIER, &value)) {
+        return false;
     }
-    return false;
+    *mod = value;
+    return true;
 }
 
 bool parse_mouse_button(const char *arg, enum mouse_button *btn) {
-    if (strcasecmp("mouse_left", arg) == 0) {
-        *btn = MOUSE_LEFT;
-        return true;
-    } else if (strcasecmp("mouse_middle", arg) == 0) {
-        *btn = MOUSE_MIDDLE;
-        return true;
-    } else if (strcasecmp("mouse_right", arg) == 0) {
-        *btn = MOUSE_RIGHT;
-        return true;
-    } else if (strcasecmp("mouse_double", arg) == 0) {
-        *btn = MOUSE_DOUBLE;
-        return true;
+    unsigned char value;
+
+    if (!lookup(arg, SYMBOL_BUTTON, &value)) {
+        return false;
+    }
+    *btn = value;
+    return true;
+}
+
+static int combo_error(char *err, size_t err_size, const char *fmt, ...) {
+    va_list ap;
+
+    va_start(ap, fmt);
+    vsnprintf(err, err_size, fmt, ap);
+    va_end(ap);
+    return -1;
+}
+
+int parse_combos(const char *expr, combo *combos, int max, char *err, size_t err_size) {
+    const char *p = expr;
+    int count = 0;
+
+    for (;;) {
+        combo *c = &combos[count];
+
+        if (count++ == max) {
+            if (max == 1) {
+                return combo_error(err, err_size, "Sequences such as '%s' are not supported", expr);
+            }
+            return combo_error(err, err_size, "More than %d combos in '%s'", max, expr);
+        }
+        memset(c, 0, sizeof(*c));
+        for (;;) {
+            const char *tok = p;
+            const symbol *s = NULL;
+
+            if (*p == 0) {
+                return combo_error(err, err_size, "Missing key in '%s'", expr);
+            }
+            // the first character always belongs to the token, so '+' and ',' can be keys
+            p++;
+            p += strcspn(p, "+,");
+            if ((s = lookup_symbol(tok, p - tok)) == NULL) {
+                return combo_error(err, err_size, "Unknown key, modifier or button '%.*s'", (int) (p - tok), tok);
+            }
+            switch (s->kind) {
+                case SYMBOL_KEY:
+                    if (c->key_count == COMBO_MAX_KEYS) {
+                        return combo_error(err, err_size, "More than %d keys in '%s'", COMBO_MAX_KEYS, expr);
+                    }
+                    c->keys[c->key_count++] = s->value;
+                    break;
+                case SYMBOL_MODIFIER:
+                    c->modifiers |= s->value;
+                    break;
+                case SYMBOL_BUTTON:
+                    c->buttons |= s->value;
+                    break;
+            }
+            if (*p != '+') {
+                break;
+            }
+            p++;
+        }
+        if (*p == 0) {
+            return count;
+        }
+        p++;
     }
-    return false;
 }
 
 bool encode_char(const char ch, unsigned char *b) {
-    for (int i = 0 ; i < KEYMAP_SIZE ; i++) {
-        if (strlen(keymap[i].name) == 1 && keymap[i].name[0] == ch) {
-            *b = keymap[i].value;
+    if (!char_valid[(unsigned char) ch]) {
+        return false;
+    }
+    *b = char_codes[(unsigned char) ch];
+    return true;
+}
+
+bool encode_key(const char *key, unsigned char *b) {
+    return lookup(key, SYMBOL_KEY, b);
+}
+
+// NULL selects the US keymap above
+static const keyboard_layout *current_layout = NULL;
+
+bool set_keyboard_layout(const char *name) {
+    for (int i = 0 ; i < sizeof(keyboard_layouts) / sizeof(keyboard_layouts[0]) ; i++) {
+        if (strcmp(keyboard_layouts[i].name, name) == 0) {
+            current_layout = &keyboard_layouts[i];
             return true;
         }
     }
     return false;
 }
 
-bool encode_string(const char *str, unsigned char *arr) {
-    for (int i = 0 ; i < strlen(str) ; i++) {
-        if (!encode_char(str[i], &arr[i])) {
-            return false;
-        }
+void print_keyboard_layouts(FILE *f) {
+    for (int i = 0 ; i < sizeof(keyboard_layouts) / sizeof(keyboard_layouts[0]) ; i++) {
+        fprintf(f, "  %-4s %s\n", keyboard_layouts[i].name, keyboard_layouts[i].description);
+    }
+}
+
+// Decodes one UTF-8 sequence of at most 3 bytes, the layouts only cover the BMP
+static bool decode_utf8(const char **text, uint32_t *cp) {
+    const unsigned char *p = (const unsigned char *) *text;
+    int len = 0;
+
+    if (p[0] < 0x80) {
+        *cp = p[0];
+        len = 1;
+    } else if ((p[0] & 0xe0) == 0xc0 && (p[1] & 0xc0) == 0x80) {
+        *cp = (p[0] & 0x1f) << 6 | (p[1] & 0x3f);
+        len = 2;
+    } else if ((p[0] & 0xf0) == 0xe0 && (p[1] & 0xc0) == 0x80 && (p[2] & 0xc0) == 0x80) {
+        *cp = (p[0] & 0x0f) << 12 | (p[1] & 0x3f) << 6 | (p[2] & 0x3f);
+        len = 3;
+    } else {
+        return false;
     }
+    *text += len;
     return true;
 }
 
-bool encode_key(const char *key, unsigned char *b) {
-    for (int i = 0 ; i < KEYMAP_SIZE ; i++) {
-        if (strcasecmp(keymap[i].name, key) != 0) {
+int encode_text(const char *text, keystroke *keys, int max) {
+    int count = 0;
+
+    while (*text != 0) {
+        keystroke *k = &keys[count];
+        uint32_t cp = 0;
+        uint16_t entry = 0;
+
+        if (count++ == max) {
+            return -2;
+        }
+        if (current_layout == NULL) {
+            k->modifiers = 0;
+            if (!encode_char(*text++, &k->code)) {
+                return -1;
+            }
             continue;
         }
-        *b = keymap[i].value;
-        return true;
+        if (!decode_utf8(&text, &cp) || current_layout->pages[cp >> 8] == NULL ||
+                (entry = current_layout->pages[cp >> 8][cp & 0xff]) == 0) {
+            return -1;
+        }
+        k->code = entry & 0xff;
+        k->modifiers = entry >> 8;
     }
-    return false;
+    return count;
+}
+
+const keymap_entry *get_keymap(size_t *count) {
+    *count = KEYMAP_SIZE;
+    return keymap;
 }
 
 const char* decode_byte(unsigned char b) {
@@ -412,3 +594,34 @@ const char* decode_byte(unsigned char b) {
     return "";
 }
 
+
+static bool in_report(uint8_t usage, const uint8_t *keys) {
+    for (int i = 0 ; i < 6 ; i++) {
+        if (keys[i] == usage) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void diff_reports(const uint8_t last[8], const uint8_t report[8],
+                  void (*fn)(uint8_t usage, bool pressed, void *arg), void *arg) {
+    uint8_t changed = last[0] ^ report[0];
+
+    for (int i = 0 ; i < 8 ; i++) {
+        if (changed & (1 << i)) {
+            fn(0xe0 + i, (report[0] & (1 << i)) != 0, arg);
+        }
+    }
+    // 1 is the rollover error
+    for (int i = 2 ; i < 8 ; i++) {
+        if (last[i] > 1 && !in_report(last[i], report + 2)) {
+            fn(last[i], false, arg);
+        }
+    }
+    for (int i = 2 ; i < 8 ; i++) {
+        if (report[i] > 1 && !in_report(report[i], last + 2)) {
+            fn(report[i], true, arg);
+        }
+    }
+}
@@ -22,6 +22,8 @@ THE SOFTWARE.
 #include <stdio.h>
 #include "debug.h"
 
+bool verbose = false;
+
 void debug_arr(unsigned char data[], int length) {
     for (int i = 0 ; i < length ; i++) {
         if (i > 0 && i % 16 == 0) {
@@ -0,0 +1,393 @@
+/*
+Copyright (c) 2012 Radoslav Gerganov <rgerganov@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include "common.h"
+#include "device.h"
+#include "hidraw.h"
+#include "lock.h"
+#include "metrics.h"
+#include "plan.h"
+#include "profiledb.h"
+#include "session.h"
+#include "transfer.h"
+#include "debug.h"
+
+#define RESET_SETTLE_US (100 * 1000)
+#define RESET_POLL_US (20 * 1000)
+
+static const char *sel_path = NULL;
+static wchar_t *sel_serial = NULL;
+static const char *sel_port = NULL;
+static device_id opened_id;
+static bool have_id = false;
+static char opened_serial[128];
+static char opened_path[256];
+// the arguments of open_device(), to find the device again after a reset
+static const unsigned short (*opened_vid_pid)[2] = NULL;
+static size_t opened_count = 0;
+static int opened_interface = -1;
+
+bool reset_after_write = false;
+bool verify_after_write = false;
+
+bool is_device_option(int opt) {
+    return opt == 'o' || (opt >= OPT_PATH && opt < OPT_DEVICE_END);
+}
+
+static int parse_count(const char *arg, int min) {
+    char *end = NULL;
+    long val = strtol(arg, &end, 10);
+    if (*arg == 0 || *end != 0 || val < min || val > 60000) {
+        fprintf(stderr, "Invalid number '%s'\n", arg);
+        exit(1);
+    }
+    return val;
+}
+
+bool parse_device_option(int opt, const char *arg) {
+    size_t len = 0;
+
+    switch (opt) {
+        case OPT_PATH:
+            sel_path = arg;
+            return true;
+        case OPT_SERIAL:
+            len = mbstowcs(NULL, arg, 0);
+            if (len == (size_t) -1) {
+                fprintf(stderr, "Invalid serial number '%s'\n", arg);
+                exit(1);
+            }
+            free(sel_serial);
+            sel_serial = calloc(len + 1, sizeof(wchar_t));
+            if (!sel_serial) {
+                fprintf(stderr, "Not enough memory\n");
+                exit(1);
+            }
+            mbstowcs(sel_serial, arg, len + 1);
+            return true;
+        case OPT_PORT:
+            sel_port = arg;
+            return true;
+        case OPT_TIMEOUT:
+            xfer_policy.timeout_ms = parse_count(arg, 1);
+            return true;
+        case OPT_RETRIES:
+            xfer_policy.retries = parse_count(arg, 0);
+            return true;
+        case OPT_WATCHDOG:
+            xfer_policy.watchdog_ms = parse_count(arg, 1);
+            return true;
+        case OPT_JOURNAL:
+            journal_path = arg;
+            return true;
+        case OPT_LOCK_TIMEOUT:
+            lock_timeout_ms = parse_count(arg, 0);
+            return true;
+        case OPT_VERBOSE:
+            verbose = true;
+            return true;
+        case OPT_COMPILE:
+            compile_only = true;
+            return true;
+        case 'o':
+            output_path = arg;
+            return true;
+        case OPT_FLASH:
+            flash_path = arg;
+            return true;
+        case OPT_DRY_RUN:
+            dry_run = true;
+            return true;
+        case OPT_RECORD:
+            record_path = arg;
+            return true;
+        case OPT_REPLAY:
+            replay_path = arg;
+            return true;
+        case OPT_BACKEND:
+            if (strcmp(arg, "hidapi") == 0) {
+                xfer_backend = BACKEND_HIDAPI;
+            } else if (strcmp(arg, "hidraw") == 0) {
+                xfer_backend = BACKEND_HIDRAW;
+            } else {
+                return false;
+            }
+            return true;
+        case OPT_RESET:
+            reset_after_write = true;
+            return true;
+        case OPT_VERIFY:
+            verify_after_write = true;
+            return true;
+        case OPT_LAYOUT:
+            if (!set_keyboard_layout(arg)) {
+                fprintf(stderr, "Unknown keyboard layout '%s', the supported layouts are:\n", arg);
+                print_keyboard_layouts(stderr);
+                exit(1);
+            }
+            return true;
+        case OPT_DB:
+            db_path = arg;
+            return true;
+        case OPT_METRICS:
+            metrics_path = arg;
+            metrics_export_at_exit();
+            return true;
+    }
+    return false;
+}
+
+// hidapi-libusb paths look like "<bus>-<port>[.<port>...]:<config>.<interface>",
+// hidraw paths are translated to the same format
+static bool port_matches(const char *path) {
+    char location[256];
+    size_t len = strlen(sel_port);
+
+    if (xfer_backend == BACKEND_HIDRAW) {
+        if (!hidraw_location(path, location, sizeof(location))) {
+            return false;
+        }
+        path = location;
+    }
+    return strncmp(path, sel_port, len) == 0 && path[len] == ':';
+}
+
+static struct hid_device_info *enumerate(unsigned short vid, unsigned short pid) {
+    return xfer_backend == BACKEND_HIDRAW ? hidraw_enumerate(vid, pid) : hid_enumerate(vid, pid);
+}
+
+static void free_enumeration(struct hid_device_info *info) {
+    if (xfer_backend == BACKEND_HIDRAW) {
+        hidraw_free_enumeration(info);
+    } else {
+        hid_free_enumeration(info);
+    }
+}
+
+static void set_serial(const wchar_t *serial) {
+    opened_serial[0] = 0;
+    if (serial != NULL && wcstombs(opened_serial, serial, sizeof(opened_serial)) == (size_t) -1) {
+        opened_serial[0] = 0;
+    }
+    opened_serial[sizeof(opened_serial) - 1] = 0;
+}
+
+// hid_get_device_info() for --path with the hidraw backend
+static void hidraw_path_id(const char *path) {
+    struct hid_device_info *info = hidraw_enumerate(0, 0), *ptr = NULL;
+
+    for (ptr = info ; ptr != NULL ; ptr = ptr->next) {
+        if (strcmp(ptr->path, path) == 0) {
+            opened_id.vid = ptr->vendor_id;
+            opened_id.pid = ptr->product_id;
+            opened_id.release = ptr->release_number;
+            have_id = true;
+            set_serial(ptr->serial_number);
+            break;
+        }
+    }
+    hidraw_free_enumeration(info);
+}
+
+static bool info_matches(const struct hid_device_info *info, int interface) {
+    if (interface >= 0 && info->interface_number != interface) {
+        return false;
+    }
+    if (sel_serial != NULL) {
+        if (info->serial_number == NULL || wcscmp(info->serial_number, sel_serial) != 0) {
+            return false;
+        }
+    }
+    if (sel_port != NULL && !port_matches(info->path)) {
+        return false;
+    }
+    return true;
+}
+
+// hidapi-libusb claims the interface on open, so the lock is taken first
+static hid_device *lock_and_open(const char *path) {
+    hid_device *dev = NULL;
+
+    if (!lock_device(path)) {
+        fatal("Timed out after %ld ms waiting for '%s' which is used by another process", lock_wait_us() / 1000, path);
+    }
+    diag("Waited %ld.%03ld ms for the lock of '%s'", lock_wait_us() / 1000, lock_wait_us() % 1000, path);
+    snprintf(opened_path, sizeof(opened_path), "%s", path);
+    dev = xfer_backend == BACKEND_HIDRAW ? hidraw_open_path(path) : hid_open_path(path);
+    if (dev == NULL) {
+        // e.g. a node which udev hasn't given us access to yet
+        unlock_device();
+    }
+    return dev;
+}
+
+static hid_device *find_device(const unsigned short vid_pid[][2], size_t count, int interface) {
+    struct hid_device_info *info = NULL, *ptr = NULL;
+    hid_device *dev = NULL;
+
+    if (sel_path != NULL) {
+        dev = lock_and_open(sel_path);
+        if (dev == NULL) {
+            fatal("Cannot open device '%s'.\nCheck the path and that you have the correct permissions to access it.", sel_path);
+        }
+        if (xfer_backend == BACKEND_HIDRAW) {
+            hidraw_path_id(sel_path);
+            return dev;
+        }
+        // hidapi < 0.10 has neither of the version macros
+#ifdef HID_API_VERSION
+#if HID_API_VERSION >= HID_API_MAKE_VERSION(0, 13, 0)
+        const struct hid_device_info *dev_info = hid_get_device_info(dev);
+        if (dev_info != NULL) {
+            opened_id.vid = dev_info->vendor_id;
+            opened_id.pid = dev_info->product_id;
+            opened_id.release = dev_info->release_number;
+            have_id = true;
+            set_serial(dev_info->serial_number);
+        }
+#endif
+#endif
+        return dev;
+    }
+    for (size_t i = 0 ; i < count && dev == NULL ; i++) {
+        info = enumerate(vid_pid[i][0], vid_pid[i][1]);
+        for (ptr = info ; ptr != NULL ; ptr = ptr->next) {
+            if (info_matches(ptr, interface)) {
+                dev = lock_and_open(ptr->path);
+                opened_id.vid = ptr->vendor_id;
+                opened_id.pid = ptr->product_id;
+                opened_id.release = ptr->release_number;
+                have_id = dev != NULL;
+                set_serial(ptr->serial_number);
+                break;
+            }
+        }
+        free_enumeration(info);
+#ifdef OSX
+        // Older hidapi (<0.14) doesn't report interface_number on macOS, so the
+        // loop finds nothing -- fall back to opening by vid/pid. There is no
+        // path to lock in this case.
+        if (dev == NULL && sel_port == NULL && xfer_backend == BACKEND_HIDAPI) {
+            dev = hid_open(vid_pid[i][0], vid_pid[i][1], sel_serial);
+        }
+#endif
+    }
+    return dev;
+}
+
+hid_device *open_device(const unsigned short vid_pid[][2], size_t count, int interface) {
+    hid_device *dev = NULL;
+    uint64_t start = 0;
+
+    if (replay_path != NULL) {
+        dev = session_replay_start(&opened_id);
+        if (dev == NULL) {
+            fatal("'%s' is not a valid session log", replay_path);
+        }
+        have_id = true;
+        return dev;
+    }
+    opened_vid_pid = vid_pid;
+    opened_count = count;
+    opened_interface = interface;
+    start = metrics_now();
+    dev = find_device(vid_pid, count, interface);
+    metrics_observe(METRIC_DISCOVERY, start);
+    if (dev != NULL && record_path != NULL) {
+        device_id unknown = {0};
+        if (!session_record_start(have_id ? &opened_id : &unknown)) {
+            fatal("Cannot record the session in '%s'", record_path);
+        }
+    }
+    return dev;
+}
+
+static void close_handle(hid_device *dev) {
+    if (!session_replaying()) {
+        if (xfer_backend == BACKEND_HIDRAW) {
+            hidraw_close(dev);
+        } else {
+            hid_close(dev);
+        }
+    }
+}
+
+void close_device(hid_device *dev) {
+    if (verbose) {
+        xfer_print_stats(stderr);
+    }
+    close_handle(dev);
+    unlock_device();
+}
+
+hid_device *reset_device(hid_device *dev, int timeout_ms) {
+    static char port[256];
+    uint64_t deadline = 0;
+
+    if (session_replaying()) {
+        return dev;
+    }
+    // "<bus>-<port>[.<port>...]:<config>.<interface>"
+    if (strncmp(opened_path, "/dev/", 5) != 0) {
+        snprintf(port, sizeof(port), "%s", opened_path);
+    } else if (!hidraw_location(opened_path, port, sizeof(port))) {
+        fprintf(stderr, "Cannot find the USB port of '%s'\n", opened_path);
+        return NULL;
+    }
+    port[strcspn(port, ":")] = 0;
+    close_handle(dev);
+    unlock_device();
+    if (!hidraw_reset_port(port)) {
+        return NULL;
+    }
+    diag("Reset the device at port %s", port);
+    // the old device may still be around for a moment
+    usleep(RESET_SETTLE_US);
+    sel_path = NULL;
+    sel_port = port;
+    deadline = metrics_now() + timeout_ms * 1000ULL;
+    while ((dev = find_device(opened_vid_pid, opened_count, opened_interface)) == NULL && metrics_now() < deadline) {
+        usleep(RESET_POLL_US);
+    }
+    return dev;
+}
+
+bool get_device_id(device_id *id) {
+    if (have_id) {
+        *id = opened_id;
+    }
+    return have_id;
+}
+
+bool get_device_serial(char *serial, size_t size) {
+    if (opened_serial[0] == 0) {
+        return false;
+    }
+    snprintf(serial, size, "%s", opened_serial);
+    return true;
+}
@@ -0,0 +1,225 @@
+/*
+Copyright (c) 2012 Radoslav Gerganov <rgerganov@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "evring.h"
+
+#define BUSY UINT64_MAX
+
+// The futex is shared between processes, so it is not FUTEX_PRIVATE
+static long futex(_Atomic uint32_t *word, int op, uint32_t val, const struct timespec *timeout) {
+    return syscall(SYS_futex, word, op, val, timeout, NULL, 0);
+}
+
+evring *evring_create(const char *name) {
+    evring *ring = NULL;
+    struct stat st;
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+
+    if (fd < 0) {
+        return NULL;
+    }
+    if (fstat(fd, &st) < 0 || (st.st_size != sizeof(evring) && ftruncate(fd, sizeof(evring)) < 0)) {
+        close(fd);
+        return NULL;
+    }
+    ring = mmap(NULL, sizeof(evring), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (ring == MAP_FAILED) {
+        return NULL;
+    }
+    pid_t pid = atomic_load(&ring->publisher);
+    if (pid != 0 && pid != getpid() && kill(pid, 0) == 0) {
+        munmap(ring, sizeof(evring));
+        errno = EBUSY;
+        return NULL;
+    }
+    /*
+     * The ring is left in place when its publisher exits, so that readers
+     * keep their mapping. A new publisher continues its sequence numbers.
+     */
+    if (ring->magic != EVRING_MAGIC || ring->slots != EVRING_SLOTS) {
+        memset(ring, 0, sizeof(evring));
+        for (int i = 0 ; i < EVRING_SLOTS ; i++) {
+            atomic_store(&ring->slot[i].seq, BUSY);
+        }
+        ring->slots = EVRING_SLOTS;
+        ring->magic = EVRING_MAGIC;
+    }
+    atomic_store(&ring->publisher, getpid());
+    return ring;
+}
+
+void evring_destroy(evring *ring) {
+    atomic_store(&ring->publisher, 0);
+    // wake the readers so that they can notice
+    atomic_fetch_add(&ring->futex, 1);
+    futex(&ring->futex, FUTEX_WAKE, INT_MAX, NULL);
+    munmap(ring, sizeof(evring));
+}
+
+void evring_publish(evring *ring, const evring_event *e) {
+    uint64_t seq = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    evring_slot *s = &ring->slot[seq & (EVRING_SLOTS - 1)];
+    uint64_t key[EVRING_KEY_SIZE / 8];
+
+    memcpy(key, e->key, sizeof(key));
+    // a seqlock with one writer: the slot is marked busy while it is written
+    atomic_store_explicit(&s->seq, BUSY, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&s->time_ns, e->time_ns, memory_order_relaxed);
+    atomic_store_explicit(&s->info, e->type | e->usage << 8 | e->modifiers << 16, memory_order_relaxed);
+    for (int i = 0 ; i < EVRING_KEY_SIZE / 8 ; i++) {
+        atomic_store_explicit(&s->key[i], key[i], memory_order_relaxed);
+    }
+    atomic_store_explicit(&s->seq, seq, memory_order_release);
+    atomic_store(&ring->head, seq + 1);
+    atomic_fetch_add(&ring->futex, 1);
+    futex(&ring->futex, FUTEX_WAKE, INT_MAX, NULL);
+}
+
+bool evring_open(evring_reader *r, const char *name) {
+    struct stat st;
+    int fd = shm_open(name, O_RDONLY | O_CLOEXEC, 0);
+
+    memset(r, 0, sizeof(*r));
+    if (fd < 0) {
+        return false;
+    }
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t) sizeof(evring)) {
+        close(fd);
+        errno = EINVAL;
+        return false;
+    }
+    r->ring = mmap(NULL, sizeof(evring), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (r->ring == MAP_FAILED) {
+        r->ring = NULL;
+        return false;
+    }
+    if (r->ring->magic != EVRING_MAGIC || r->ring->slots != EVRING_SLOTS) {
+        evring_close(r);
+        errno = EINVAL;
+        return false;
+    }
+    r->next = atomic_load(&r->ring->head);
+    return true;
+}
+
+void evring_close(evring_reader *r) {
+    if (r->ring != NULL) {
+        munmap((void *) r->ring, sizeof(evring));
+        r->ring = NULL;
+    }
+}
+
+// Copies event seq out of its slot, false if it has been overwritten meanwhile
+static bool read_slot(const evring *ring, uint64_t seq, evring_event *e) {
+    const evring_slot *s = &ring->slot[seq & (EVRING_SLOTS - 1)];
+    uint64_t key[EVRING_KEY_SIZE / 8], info;
+
+    if (atomic_load_explicit(&s->seq, memory_order_acquire) != seq) {
+        return false;
+    }
+    e->time_ns = atomic_load_explicit(&s->time_ns, memory_order_relaxed);
+    info = atomic_load_explicit(&s->info, memory_order_relaxed);
+    for (int i = 0 ; i < EVRING_KEY_SIZE / 8 ; i++) {
+        key[i] = atomic_load_explicit(&s->key[i], memory_order_relaxed);
+    }
+    atomic_thread_fence(memory_order_acquire);
+    if (atomic_load_explicit(&s->seq, memory_order_relaxed) != seq) {
+        return false;
+    }
+    e->seq = seq;
+    e->type = info & 0xff;
+    e->usage = (info >> 8) & 0xff;
+    e->modifiers = (info >> 16) & 0xff;
+    memcpy(e->key, key, sizeof(key));
+    e->key[EVRING_KEY_SIZE - 1] = 0;
+    return true;
+}
+
+int evring_read(evring_reader *r, evring_event *e, int timeout_ms) {
+    struct timespec deadline, now, left;
+
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+    for (;;) {
+        // the futex word is read before the head, so no event can slip in between
+        uint32_t word = atomic_load(&r->ring->futex);
+        uint64_t head = atomic_load(&r->ring->head);
+
+        while (r->next < head) {
+            if (head - r->next > EVRING_SLOTS) {
+                r->lost += head - EVRING_SLOTS - r->next;
+                r->next = head - EVRING_SLOTS;
+            }
+            if (read_slot(r->ring, r->next, e)) {
+                r->next++;
+                return 1;
+            }
+            // overwritten by the time it was read
+            r->lost++;
+            r->next++;
+        }
+        // a new publisher may have started the ring over
+        if (r->next > head) {
+            r->next = head;
+        }
+        if (timeout_ms >= 0) {
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            left.tv_sec = deadline.tv_sec - now.tv_sec;
+            left.tv_nsec = deadline.tv_nsec - now.tv_nsec;
+            if (left.tv_nsec < 0) {
+                left.tv_sec--;
+                left.tv_nsec += 1000000000L;
+            }
+            if (left.tv_sec < 0) {
+                return 0;
+            }
+        }
+        if (futex((_Atomic uint32_t *) &r->ring->futex, FUTEX_WAIT, word, timeout_ms >= 0 ? &left : NULL) < 0) {
+            // a signal ends the wait as a timeout does
+            if (errno == EINTR) {
+                return 0;
+            }
+            if (errno != EAGAIN && errno != ETIMEDOUT) {
+                return -1;
+            }
+        }
+    }
+}
@@ -0,0 +1,249 @@
+/*
+Copyright (c) 2012 Radoslav Gerganov <rgerganov@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "common.h"
+#include "layout.h"
+
+/**
+ * Generates a HID-BPF program which remaps the keys sent by the pedals in
+ * the kernel, before the reports reach the input subsystem or userspace.
+ * The program is built with clang and loaded with udev-hid-bpf, so the
+ * mapping can be changed by loading another program, without reprogramming
+ * the pedal. It patches the boot keyboard reports of the keyboard interface:
+ * each configured key in the key array is replaced and its modifiers are
+ * added to the modifier byte.
+ */
+
+#define MAX_RULES 32
+#define MAX_DEVICES 16
+
+typedef struct rule
+{
+    unsigned char from;
+    unsigned char key;      // 0 keeps the original key
+    unsigned char mod;
+} rule;
+
+static rule rules[MAX_RULES];
+static int rule_count = 0;
+static unsigned short devices[MAX_DEVICES][2];
+static int device_count = 0;
+static int report_id = -1;
+
+void usage() {
+    fprintf(stderr, "Usage: footswitch-bpf [-d vid:pid] [-R id] [-o file] -i <key> [-k <key>] [-m <modifier>] ...\n"
+        "   -i key     - remap the key which the pedal sends, the following -k and -m apply to it\n"
+        "   -k key     - send this key instead\n"
+        "   -m mod     - add the modifier (ctrl|shift|alt|win, may be prefixed with l_ or r_)\n"
+        "   -d vid:pid - attach to this device (default: all supported devices), may be repeated\n"
+        "   -R id      - the keyboard reports start with this report ID\n"
+        "   -o file    - write the program to file instead of stdout\n");
+    exit(1);
+}
+
+static unsigned char parse_key(const char *key) {
+    unsigned char b = 0;
+
+    if (!encode_key(key, &b)) {
+        fprintf(stderr, "Cannot encode key '%s'\n", key);
+        exit(1);
+    }
+    return b;
+}
+
+static rule *current_rule() {
+    if (rule_count == 0) {
+        fprintf(stderr, "-k and -m must follow -i\n");
+        usage();
+    }
+    return &rules[rule_count - 1];
+}
+
+static void add_device(unsigned short vid, unsigned short pid) {
+    for (int i = 0 ; i < device_count ; i++) {
+        if (devices[i][0] == vid && devices[i][1] == pid) {
+            return;
+        }
+    }
+    if (device_count == MAX_DEVICES) {
+        fprintf(stderr, "Too many devices\n");
+        exit(1);
+    }
+    devices[device_count][0] = vid;
+    devices[device_count][1] = pid;
+    device_count++;
+}
+
+static void default_devices() {
+    static const unsigned short all[][2] = {
+        FOOTSWITCH_DEVICES(LAYOUT_VID_PID)
+        SCYTHE_DEVICES(LAYOUT_VID_PID)
+        SCYTHE2_DEVICES(LAYOUT_VID_PID)
+        FOOTSWITCH1P_DEVICES(LAYOUT_VID_PID)
+    };
+
+    for (size_t i = 0 ; i < sizeof(all) / sizeof(all[0]) ; i++) {
+        add_device(all[i][0], all[i][1]);
+    }
+}
+
+static void print_modifiers(FILE *out, unsigned char mod) {
+    static const char *names[] = {"ctrl", "shift", "alt", "win", "r_ctrl", "r_shift", "r_alt", "r_win"};
+    const char *sep = "";
+
+    for (int i = 0 ; i < 8 ; i++) {
+        if (mod & (1 << i)) {
+            fprintf(out, "%s%s", sep, names[i]);
+            sep = "+";
+        }
+    }
+}
+
+static void generate(FILE *out) {
+    int offset = report_id >= 0 ? 1 : 0;
+
+    fprintf(out, "// SPDX-License-Identifier: GPL-2.0-only\n");
+    fprintf(out, "/* Generated by footswitch-bpf, build with udev-hid-bpf:\n");
+    fprintf(out, " *   footswitch-bpf ... -o src/bpf/testing/0010-footswitch.bpf.c\n");
+    fprintf(out, " *   meson compile && udev-hid-bpf add /sys/bus/hid/devices/<device> 0010-footswitch.bpf.o\n");
+    fprintf(out, " */\n\n");
+    fprintf(out, "#include \"vmlinux.h\"\n#include \"hid_bpf.h\"\n#include \"hid_bpf_helpers.h\"\n");
+    fprintf(out, "#include <bpf/bpf_tracing.h>\n\n");
+    fprintf(out, "HID_BPF_CONFIG(\n");
+    for (int i = 0 ; i < device_count ; i++) {
+        fprintf(out, "\tHID_DEVICE(BUS_USB, HID_GROUP_GENERIC, 0x%04X, 0x%04X)%s\n",
+                devices[i][0], devices[i][1], i + 1 < device_count ? "," : "");
+    }
+    fprintf(out, ");\n\n");
+    fprintf(out, "#define REPORT_SIZE %d\n\n", 8 + offset);
+    fprintf(out, "static __always_inline void remap(__u8 *mods, __u8 *key)\n{\n\tswitch (*key) {\n");
+    for (int i = 0 ; i < rule_count ; i++) {
+        const rule *r = &rules[i];
+        fprintf(out, "\tcase 0x%02x: /* %s -> ", r->from, decode_byte(r->from));
+        if (r->mod) {
+            print_modifiers(out, r->mod);
+            fprintf(out, "+");
+        }
+        fprintf(out, "%s */\n", decode_byte(r->key ? r->key : r->from));
+        if (r->key) {
+            fprintf(out, "\t\t*key = 0x%02x;\n", r->key);
+        }
+        if (r->mod) {
+            fprintf(out, "\t\t*mods |= 0x%02x;\n", r->mod);
+        }
+        fprintf(out, "\t\tbreak;\n");
+    }
+    fprintf(out, "\t}\n}\n\n");
+    fprintf(out, "SEC(HID_BPF_DEVICE_EVENT)\n");
+    fprintf(out, "int BPF_PROG(footswitch_remap, struct hid_bpf_ctx *hctx)\n{\n");
+    fprintf(out, "\t__u8 *data = hid_bpf_get_data(hctx, 0, REPORT_SIZE);\n\n");
+    fprintf(out, "\tif (!data)\n\t\treturn 0;\n");
+    if (report_id >= 0) {
+        fprintf(out, "\tif (data[0] != %d)\n\t\treturn 0;\n", report_id);
+    }
+    fprintf(out, "\t/* modifiers, reserved byte, 6 keys */\n");
+    fprintf(out, "\tfor (int i = %d; i < REPORT_SIZE; i++)\n", 2 + offset);
+    fprintf(out, "\t\tremap(&data[%d], &data[i]);\n", offset);
+    fprintf(out, "\treturn 0;\n}\n\n");
+    fprintf(out, "HID_BPF_OPS(footswitch) = {\n\t.hid_device_event = (void *)footswitch_remap,\n};\n\n");
+    fprintf(out, "/* Only the keyboard interface, the configuration interface is left alone */\n");
+    fprintf(out, "SEC(\"syscall\")\nint probe(struct hid_bpf_probe_args *ctx)\n{\n");
+    fprintf(out, "\t/* Usage Page (Generic Desktop), Usage (Keyboard) */\n");
+    fprintf(out, "\tctx->retval = ctx->rdesc_size > 4 && ctx->rdesc[0] == 0x05 && ctx->rdesc[1] == 0x01 &&\n");
+    fprintf(out, "\t\tctx->rdesc[2] == 0x09 && ctx->rdesc[3] == 0x06 ? 0 : -EINVAL;\n");
+    fprintf(out, "\treturn 0;\n}\n\n");
+    fprintf(out, "char _license[] SEC(\"license\") = \"GPL\";\n");
+}
+
+int main(int argc, char *argv[]) {
+    const char *output = NULL;
+    FILE *out = stdout;
+    unsigned int vid = 0, pid = 0;
+    enum modifier mod;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "i:k:m:d:R:o:")) != -1) {
+        switch (opt) {
+            case 'i':
+                if (rule_count == MAX_RULES) {
+                    fprintf(stderr, "Too many keys\n");
+                    exit(1);
+                }
+                rules[rule_count++].from = parse_key(optarg);
+                break;
+            case 'k':
+                current_rule()->key = parse_key(optarg);
+                break;
+            case 'm':
+                if (!parse_modifier(optarg, &mod)) {
+                    fprintf(stderr, "Invalid modifier '%s'\n", optarg);
+                    exit(1);
+                }
+                current_rule()->mod |= mod;
+                break;
+            case 'd':
+                if (sscanf(optarg, "%x:%x", &vid, &pid) != 2 || vid > 0xffff || pid > 0xffff) {
+                    usage();
+                }
+                add_device(vid, pid);
+                break;
+            case 'R':
+                report_id = atoi(optarg);
+                if (report_id < 1 || report_id > 255) {
+                    usage();
+                }
+                break;
+            case 'o':
+                output = optarg;
+                break;
+            default:
+                usage();
+        }
+    }
+    if (optind < argc || rule_count == 0) {
+        usage();
+    }
+    for (int i = 0 ; i < rule_count ; i++) {
+        for (int j = 0 ; j < i ; j++) {
+            if (rules[i].from == rules[j].from) {
+                fprintf(stderr, "Key '%s' is remapped twice\n", decode_byte(rules[i].from));
+                exit(1);
+            }
+        }
+    }
+    if (device_count == 0) {
+        default_devices();
+    }
+    if (output != NULL && (out = fopen(output, "w")) == NULL) {
+        perror(output);
+        exit(1);
+    }
+    generate(out);
+    if (out != stdout && fclose(out) != 0) {
+        perror(output);
+        exit(1);
+    }
+    return 0;
+}
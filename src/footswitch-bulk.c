@@ -0,0 +1,420 @@
+/*
+Copyright (c) 2012 Radoslav Gerganov <rgerganov@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <sys/stat.h>
+#include "common.h"
+#include "profile.h"
+
+/**
+ * Compiles footswitch profiles into images on a pool of threads. A profile
+ * contains the same pedal options as the footswitch command line, e.g.
+ *
+ *   -1 -k a -2 -m ctrl -k c -3 -s "hello world"   # comment
+ *
+ * Profiles are read from files (one profile per file) or from the standard
+ * input (one profile per line, prefixed with its name). All errors are
+ * reported with their positions, compilation doesn't stop at the first one.
+ */
+
+typedef struct job
+{
+    char *name;             // the image is saved as <name>.img
+    char *source;           // where the profile comes from, for error messages
+    char *text;             // NULL if the profile has to be read from source
+    int line, col;          // position of text in source
+    char *errors;
+    size_t errors_len;
+    int error_count;
+} job;
+
+typedef struct cursor
+{
+    char *p;
+    int line, col;
+} cursor;
+
+static job *jobs = NULL;
+static size_t job_count = 0, job_capacity = 0;
+static atomic_size_t next_job = 0;
+static const char *output_dir = NULL;
+
+void usage() {
+    fprintf(stderr, "Usage: footswitch-bulk [-j jobs] [-o dir] [-l layout] [path...]\n"
+        "   -j jobs - compile on this many threads (default is the number of CPUs)\n"
+        "   -o dir  - save the image of each profile in dir/<name>.img\n"
+        "   -l name - type -s strings with a keyboard layout, e.g. de or fr\n"
+        "   path    - a profile or a directory with profiles, - reads profiles from the\n"
+        "             standard input, one per line: <name> <options>\n"
+        "Profiles contain footswitch options (-123sSakmbcxyw), quoted with ' or \" when needed\n");
+    exit(1);
+}
+
+static job *add_job(const char *name, const char *source, const char *text, int line, int col) {
+    job *j = NULL;
+
+    if (job_count == job_capacity) {
+        job_capacity = job_capacity ? job_capacity * 2 : 256;
+        jobs = realloc(jobs, job_capacity * sizeof(job));
+        if (!jobs) {
+            fprintf(stderr, "Not enough memory\n");
+            exit(1);
+        }
+    }
+    j = &jobs[job_count++];
+    memset(j, 0, sizeof(job));
+    j->name = strdup(name);
+    j->source = strdup(source);
+    j->text = text ? strdup(text) : NULL;
+    j->line = line;
+    j->col = col;
+    return j;
+}
+
+static void advance(cursor *c) {
+    if (*c->p == '\n') {
+        c->line++;
+        c->col = 1;
+    } else {
+        c->col++;
+    }
+    c->p++;
+}
+
+/**
+ * Returns the next token and its position. Quotes are removed in place, so
+ * the token points into the text. Returns NULL at the end of the text.
+ */
+static char *next_token(cursor *c, int *line, int *col, bool *unterminated) {
+    char *tok = NULL, *out = NULL;
+    char quote = 0;
+
+    for (;;) {
+        while (*c->p == ' ' || *c->p == '\t' || *c->p == '\n' || *c->p == '\r') {
+            advance(c);
+        }
+        if (*c->p != '#') {
+            break;
+        }
+        while (*c->p != 0 && *c->p != '\n') {
+            advance(c);
+        }
+    }
+    if (*c->p == 0) {
+        return NULL;
+    }
+    *line = c->line;
+    *col = c->col;
+    *unterminated = false;
+    tok = out = c->p;
+    while (*c->p != 0) {
+        char ch = *c->p;
+        if (quote == 0 && (ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r')) {
+            break;
+        }
+        advance(c);
+        if (quote == 0 && (ch == '\'' || ch == '"')) {
+            quote = ch;
+        } else if (ch == quote) {
+            quote = 0;
+        } else {
+            *out++ = ch;
+        }
+    }
+    *unterminated = quote != 0;
+    if (*c->p != 0) {
+        advance(c);
+    }
+    *out = 0;
+    return tok;
+}
+
+static void report(job *j, FILE *err, int line, int col, const char *msg, const char *arg) {
+    if (line > 0) {
+        fprintf(err, "%s:%d:%d: ", j->source, line, col);
+    } else {
+        fprintf(err, "%s: ", j->source);
+    }
+    fprintf(err, msg, arg);
+    fprintf(err, "\n");
+    j->error_count++;
+}
+
+static char *read_file(const char *path) {
+    char *text = NULL;
+    struct stat st;
+    FILE *f = fopen(path, "r");
+
+    if (f == NULL) {
+        return NULL;
+    }
+    if (fstat(fileno(f), &st) == 0 && (text = malloc(st.st_size + 1)) != NULL) {
+        size_t len = fread(text, 1, st.st_size, f);
+        text[len] = 0;
+    }
+    fclose(f);
+    return text;
+}
+
+static void compile_profile(job *j, FILE *err) {
+    profile pr;
+    cursor c = {j->text, j->line, j->col};
+    int line, col;
+    bool unterminated;
+    char *tok;
+
+    profile_init(&pr);
+    while ((tok = next_token(&c, &line, &col, &unterminated)) != NULL) {
+        int opt = tok[0] == '-' && tok[1] != 0 ? tok[1] : 0;
+        char *arg = NULL;
+
+        if (unterminated) {
+            report(j, err, line, col, "Unterminated quote", NULL);
+            return;
+        }
+        if (!profile_is_option(opt)) {
+            report(j, err, line, col, "Invalid option '%s'", tok);
+            continue;
+        }
+        if (profile_option_has_arg(opt)) {
+            if (tok[2] != 0) {
+                arg = &tok[2];
+            } else if ((arg = next_token(&c, &line, &col, &unterminated)) == NULL) {
+                report(j, err, line, col, "Option '%s' requires an argument", tok);
+                return;
+            } else if (unterminated) {
+                report(j, err, line, col, "Unterminated quote", NULL);
+                return;
+            }
+        } else if (tok[2] != 0) {
+            report(j, err, line, col, "Invalid option '%s'", tok);
+            continue;
+        }
+        if (profile_option(&pr, opt, arg) != PROFILE_OK) {
+            report(j, err, line, col, "%s", pr.error);
+        }
+    }
+    if (j->error_count == 0 && output_dir != NULL) {
+        char path[PATH_MAX];
+        plan p = {0};
+
+        snprintf(path, sizeof(path), "%s/%s.img", output_dir, j->name);
+        profile_plan(&pr, &(pacing) {DEFAULT_GAP_US, DEFAULT_START_US}, &p);
+        if (!plan_save(&p, "footswitch", path)) {
+            report(j, err, j->line, j->col, "Cannot save %s", path);
+        }
+        plan_free(&p);
+    }
+}
+
+static void run_job(job *j) {
+    FILE *err = NULL;
+
+    if (j->error_count != 0) {
+        return;
+    }
+    if ((err = open_memstream(&j->errors, &j->errors_len)) == NULL) {
+        fprintf(stderr, "Not enough memory\n");
+        exit(1);
+    }
+    if (j->text == NULL && (j->text = read_file(j->source)) == NULL) {
+        report(j, err, 0, 0, "Cannot read the profile", NULL);
+    } else {
+        compile_profile(j, err);
+    }
+    fclose(err);
+}
+
+static void *worker(void *arg) {
+    size_t i;
+
+    while ((i = atomic_fetch_add(&next_job, 1)) < job_count) {
+        run_job(&jobs[i]);
+    }
+    return NULL;
+}
+
+// The image of a profile file is named after the file without its extension
+static void add_file(const char *path) {
+    const char *base = strrchr(path, '/');
+    char name[NAME_MAX + 1];
+    char *dot;
+
+    snprintf(name, sizeof(name), "%s", base ? base + 1 : path);
+    if ((dot = strrchr(name, '.')) != NULL && dot != name) {
+        *dot = 0;
+    }
+    add_job(name, path, NULL, 1, 1);
+}
+
+static int compare_names(const void *a, const void *b) {
+    return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+static void add_dir(const char *dir) {
+    DIR *d = opendir(dir);
+    struct dirent *ent;
+    char **paths = NULL;
+    size_t count = 0;
+
+    if (d == NULL) {
+        perror(dir);
+        exit(1);
+    }
+    while ((ent = readdir(d)) != NULL) {
+        char path[PATH_MAX];
+        struct stat st;
+
+        snprintf(path, sizeof(path), "%s/%s", dir, ent->d_name);
+        if (ent->d_name[0] == '.' || stat(path, &st) < 0 || !S_ISREG(st.st_mode)) {
+            continue;
+        }
+        paths = realloc(paths, (count + 1) * sizeof(char *));
+        if (!paths || !(paths[count++] = strdup(path))) {
+            fprintf(stderr, "Not enough memory\n");
+            exit(1);
+        }
+    }
+    closedir(d);
+    // same order of images and errors on every run
+    qsort(paths, count, sizeof(char *), compare_names);
+    for (size_t i = 0 ; i < count ; i++) {
+        add_file(paths[i]);
+        free(paths[i]);
+    }
+    free(paths);
+}
+
+static void add_stream(FILE *f) {
+    char *line = NULL;
+    size_t size = 0;
+    int num = 0;
+
+    while (getline(&line, &size, f) != -1) {
+        cursor c = {line, ++num, 1};
+        int name_line, name_col;
+        bool unterminated;
+        char *name = next_token(&c, &name_line, &name_col, &unterminated);
+
+        if (name == NULL) {
+            continue;
+        }
+        if (unterminated || strchr(name, '/') != NULL) {
+            job *j = add_job("", "-", "", num, 1);
+            FILE *err = open_memstream(&j->errors, &j->errors_len);
+            if (err != NULL) {
+                report(j, err, name_line, name_col, "Invalid profile name '%s'", name);
+                fclose(err);
+            }
+            continue;
+        }
+        add_job(name, "-", c.p, c.line, c.col);
+    }
+    free(line);
+}
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[]) {
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t failed = 0;
+    pthread_t *pool = NULL;
+    double start, elapsed;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "j:o:l:")) != -1) {
+        switch (opt) {
+            case 'j':
+                threads = atol(optarg);
+                if (threads < 1) {
+                    usage();
+                }
+                break;
+            case 'o':
+                output_dir = optarg;
+                break;
+            case 'l':
+                if (!set_keyboard_layout(optarg)) {
+                    fprintf(stderr, "Unknown keyboard layout '%s', the supported layouts are:\n", optarg);
+                    print_keyboard_layouts(stderr);
+                    return 1;
+                }
+                break;
+            default:
+                usage();
+        }
+    }
+    if (optind == argc) {
+        add_stream(stdin);
+    }
+    for (int i = optind ; i < argc ; i++) {
+        struct stat st;
+
+        if (strcmp(argv[i], "-") == 0) {
+            add_stream(stdin);
+        } else if (stat(argv[i], &st) == 0 && S_ISDIR(st.st_mode)) {
+            add_dir(argv[i]);
+        } else {
+            add_file(argv[i]);
+        }
+    }
+    if (threads < 1) {
+        threads = 1;
+    }
+    if (threads > job_count && job_count > 0) {
+        threads = job_count;
+    }
+    pool = calloc(threads, sizeof(pthread_t));
+    start = now();
+    for (long i = 0 ; i < threads ; i++) {
+        if (pthread_create(&pool[i], NULL, worker, NULL) != 0) {
+            fprintf(stderr, "Cannot create thread\n");
+            exit(1);
+        }
+    }
+    for (long i = 0 ; i < threads ; i++) {
+        pthread_join(pool[i], NULL);
+    }
+    elapsed = now() - start;
+    for (size_t i = 0 ; i < job_count ; i++) {
+        if (jobs[i].error_count != 0) {
+            failed++;
+        }
+        if (jobs[i].errors_len > 0) {
+            fputs(jobs[i].errors, stderr);
+        }
+    }
+    fprintf(stderr, "%zu profiles, %zu with errors, %.3f s on %ld threads (%.0f profiles/s)\n",
+            job_count, failed, elapsed, threads, elapsed > 0 ? job_count / elapsed : 0);
+    return failed == 0 ? 0 : 1;
+}
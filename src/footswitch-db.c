@@ -0,0 +1,143 @@
+/*
+Copyright (c) 2012 Radoslav Gerganov <rgerganov@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <dirent.h>
+#include "profiledb.h"
+
+/**
+ * Builds the profile databases used with --db. Each entry maps a device
+ * serial number or a VID:PID ("0c45:7403") to an image compiled with
+ * --compile or footswitch-bulk. The images of footswitch-bulk are named
+ * after their profiles, so a directory of them can be added at once.
+ */
+
+static char **keys = NULL, **images = NULL;
+static int count = 0, capacity = 0;
+
+void usage() {
+    fprintf(stderr, "Usage: footswitch-db -o db [-d dir] [key=image...]\n"
+        "       footswitch-db -l db\n"
+        "   -o db      - write the database to db, replacing it atomically\n"
+        "   -d dir     - add dir/<key>.img for each image in dir\n"
+        "   key=image  - add image with the key (a serial number or vid:pid)\n"
+        "   -l db      - list the entries of db and check all of them\n");
+    exit(1);
+}
+
+static void add(const char *key, const char *image) {
+    if (count == capacity) {
+        capacity = capacity ? capacity * 2 : 64;
+        keys = realloc(keys, capacity * sizeof(char *));
+        images = realloc(images, capacity * sizeof(char *));
+        if (keys == NULL || images == NULL) {
+            fprintf(stderr, "Not enough memory\n");
+            exit(1);
+        }
+    }
+    keys[count] = strdup(key);
+    images[count] = strdup(image);
+    if (keys[count] == NULL || images[count] == NULL) {
+        fprintf(stderr, "Not enough memory\n");
+        exit(1);
+    }
+    count++;
+}
+
+static void add_dir(const char *dir) {
+    char key[NAME_MAX + 1], path[PATH_MAX];
+    struct dirent *ent = NULL;
+    DIR *d = opendir(dir);
+
+    if (d == NULL) {
+        perror(dir);
+        exit(1);
+    }
+    while ((ent = readdir(d)) != NULL) {
+        size_t len = strlen(ent->d_name);
+        if (len <= 4 || strcmp(ent->d_name + len - 4, ".img") != 0) {
+            continue;
+        }
+        snprintf(key, sizeof(key), "%.*s", (int) len - 4, ent->d_name);
+        snprintf(path, sizeof(path), "%s/%s", dir, ent->d_name);
+        add(key, path);
+    }
+    closedir(d);
+}
+
+static void print_entry(const char *key, const image_header *hdr) {
+    printf("%-24s %-12s %u packets\n", key, hdr->model, hdr->count);
+}
+
+int main(int argc, char *argv[]) {
+    const char *output = NULL, *list = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "o:d:l:")) != -1) {
+        switch (opt) {
+            case 'o':
+                output = optarg;
+                break;
+            case 'd':
+                add_dir(optarg);
+                break;
+            case 'l':
+                list = optarg;
+                break;
+            default:
+                usage();
+        }
+    }
+    if ((output == NULL) == (list == NULL) || (list != NULL && (count > 0 || optind < argc))) {
+        usage();
+    }
+    if (list != NULL) {
+        profiledb db;
+        bool valid = false;
+        if (!profiledb_open(&db, list)) {
+            fprintf(stderr, "'%s' is not a valid profile database\n", list);
+            return 1;
+        }
+        profiledb_foreach(&db, print_entry);
+        if (!(valid = profiledb_check(&db))) {
+            fprintf(stderr, "'%s' has invalid entries\n", list);
+        }
+        profiledb_close(&db);
+        return valid ? 0 : 1;
+    }
+    for (int i = optind ; i < argc ; i++) {
+        char *eq = strchr(argv[i], '=');
+        if (eq == NULL || eq == argv[i] || eq[1] == 0) {
+            usage();
+        }
+        *eq = 0;
+        add(argv[i], eq + 1);
+    }
+    if (!profiledb_build(output, keys, images, count)) {
+        return 1;
+    }
+    printf("%d entries written to %s\n", count, output);
+    return 0;
+}
@@ -0,0 +1,285 @@
+/*
+Copyright (c) 2012 Radoslav Gerganov <rgerganov@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <unistd.h>
+#include "common.h"
+#include "evring.h"
+#include "hidraw.h"
+#include "metrics.h"
+#include "pedal.h"
+
+/**
+ * Fans the pedal events out to any number of local programs (recorders,
+ * macro engines, overlays). With -P the keyboard interface of the pedal is
+ * read once and every key press and release is published, timestamped and
+ * decoded, in a ring in shared memory (see evring.h). Without -P the events
+ * of the ring are printed, which is what a subscriber does.
+ *
+ * A pedal which fails is opened again at the same USB port once it is back,
+ * and reset if it doesn't come back by itself.
+ */
+
+#define REOPEN_POLL_US (100 * 1000)
+// How long a pedal may be gone before it is reset
+#define RESET_AFTER_US (3 * 1000000ULL)
+
+// decode_byte() scans the keymap, so the names are looked up once
+static const char *names[256];
+static bool verbose = false;
+// The listening socket of -M, -1 without it
+static int metrics = -1;
+
+void usage() {
+    fprintf(stderr, "Usage: footswitch-events [-s name] [-M socket] [-v] -P [device]\n"
+        "       footswitch-events [-s name] [-n events]\n"
+        "   -P        - publish the events of the pedal\n"
+        "   -s name   - the shared memory of the ring (default " EVRING_NAME ")\n"
+        "   -M socket - serve metrics in the Prometheus text format on this Unix socket\n"
+        "   -n events - exit after printing this many events\n"
+        "   -v        - print each published event\n"
+        "   device    - /dev/hidrawN of the keyboard interface of the pedal (default: the first pedal)\n");
+    exit(1);
+}
+
+// The hidraw node at a USB port, which may change when the pedal comes back
+static bool find_location(const char *location, char *path, size_t size) {
+    struct hid_device_info *info = hidraw_enumerate(0, 0);
+    char other[64];
+    bool found = false;
+
+    for (struct hid_device_info *i = info ; i != NULL && !found ; i = i->next) {
+        if (hidraw_location(i->path, other, sizeof(other)) && strcmp(other, location) == 0) {
+            snprintf(path, size, "%s", i->path);
+            found = true;
+        }
+    }
+    hidraw_free_enumeration(info);
+    return found;
+}
+
+static hid_device *reopen(const char *location, char *path, size_t size) {
+    uint64_t start = pedal_now_ns();
+    bool reset = false;
+    hid_device *dev = NULL;
+
+    while (!pedal_stop) {
+        if ((location[0] == 0 || find_location(location, path, size)) &&
+                (dev = hidraw_open_path(path)) != NULL) {
+            return dev;
+        }
+        if (!reset && location[0] != 0 && pedal_now_ns() - start > RESET_AFTER_US * 1000) {
+            char port[64];
+            snprintf(port, sizeof(port), "%s", location);
+            port[strcspn(port, ":")] = 0;
+            fprintf(stderr, "Resetting the pedal at %s\n", port);
+            hidraw_reset_port(port);
+            reset = true;
+        }
+        usleep(REOPEN_POLL_US);
+    }
+    return NULL;
+}
+
+// A change between two reports of the pedal
+typedef struct change
+{
+    evring *ring;
+    uint64_t time_ns;
+    uint8_t modifiers;
+} change;
+
+static void publish(uint8_t usage, bool pressed, void *arg) {
+    const change *c = arg;
+    evring_event e = {0, c->time_ns, pressed ? EVRING_PRESS : EVRING_RELEASE, usage, c->modifiers, {0}};
+
+    strncpy(e.key, names[usage], sizeof(e.key) - 1);
+    evring_publish(c->ring, &e);
+    metrics_observe(METRIC_EVENT_DISPATCH, c->time_ns / 1000);
+    metrics_add(METRIC_EVENTS, 1);
+    if (verbose) {
+        printf("%s %s\n", pressed ? "press" : "release", e.key);
+    }
+}
+
+static void publish_changes(evring *ring, uint64_t time_ns, const uint8_t *last, const uint8_t *report) {
+    change c = {ring, time_ns, report[0]};
+
+    diff_reports(last, report, publish, &c);
+}
+
+static int run_publisher(const char *name, const char *device) {
+    static const uint8_t released[8] = {0};
+    char path[64], location[64] = "";
+    uint8_t last[8] = {0}, report[16];
+    const uint8_t *keys = NULL;
+    hid_device *dev = NULL;
+    evring *ring = NULL;
+    int r = 0, recoveries = 0;
+
+    if (device == NULL) {
+        if (!pedal_find(path, sizeof(path))) {
+            fprintf(stderr, "Cannot find a pedal\n");
+            return 1;
+        }
+    } else {
+        snprintf(path, sizeof(path), "%s", device);
+    }
+    if ((dev = hidraw_open_path(path)) == NULL) {
+        perror(path);
+        return 1;
+    }
+    if (!hidraw_location(path, location, sizeof(location))) {
+        location[0] = 0;
+    }
+    if ((ring = evring_create(name)) == NULL) {
+        fprintf(stderr, "Cannot create the ring %s: %s\n", name, errno == EBUSY ? "it has a publisher" : strerror(errno));
+        hidraw_close(dev);
+        return 1;
+    }
+    for (int i = 0 ; i < 256 ; i++) {
+        names[i] = decode_byte(i);
+    }
+    fprintf(stderr, "Publishing the events of %s on %s\n", path, name);
+    while (!pedal_stop) {
+        if (!pedal_wait(hidraw_fileno(dev), metrics)) {
+            continue;
+        }
+        // no deadline, the pedal reports only changes of its keys, so a
+        // silent pedal cannot be told apart from a hung one; only errors
+        // (e.g. an unplugged pedal) are recovered from
+        if ((r = hidraw_read_timeout(dev, report, sizeof(report), -1)) < 0) {
+            uint64_t start = pedal_now_ns();
+            if (errno == EINTR) {
+                r = 0;
+                continue;
+            }
+            fprintf(stderr, "Cannot read %s: %ls\n", path, hidraw_error(dev));
+            hidraw_close(dev);
+            // the keys which are down won't be released by the pedal
+            publish_changes(ring, start, last, released);
+            memcpy(last, released, sizeof(last));
+            if ((dev = reopen(location, path, sizeof(path))) == NULL) {
+                r = 0;
+                break;
+            }
+            r = 0;
+            metrics_add(METRIC_RECOVERIES, 1);
+            metrics_observe(METRIC_RECOVERY, start / 1000);
+            fprintf(stderr, "Reopened %s after %.1f ms (%d recoveries)\n", path,
+                    (pedal_now_ns() - start) / 1e6, ++recoveries);
+            continue;
+        }
+        if ((keys = pedal_keys(report, r)) != NULL) {
+            publish_changes(ring, pedal_now_ns(), last, keys);
+            memcpy(last, keys, sizeof(last));
+        }
+    }
+    evring_destroy(ring);
+    if (dev != NULL) {
+        hidraw_close(dev);
+    }
+    return r < 0 ? 1 : 0;
+}
+
+static int run_subscriber(const char *name, long count) {
+    evring_reader reader;
+    evring_event e;
+    uint64_t lost = 0;
+    int r = 0;
+
+    if (!evring_open(&reader, name)) {
+        fprintf(stderr, "Cannot open the ring %s: %s\n", name, strerror(errno));
+        return 1;
+    }
+    while (!pedal_stop && count != 0) {
+        if ((r = evring_read(&reader, &e, 1000)) < 0) {
+            perror("futex");
+            break;
+        }
+        if (reader.lost != lost) {
+            fprintf(stderr, "Lost %llu events\n", (unsigned long long) (reader.lost - lost));
+            lost = reader.lost;
+        }
+        if (r == 0) {
+            continue;
+        }
+        printf("%llu.%06llu %s %s\n", (unsigned long long) (e.time_ns / 1000000000),
+            (unsigned long long) (e.time_ns % 1000000000 / 1000), e.type == EVRING_PRESS ? "press" : "release", e.key);
+        fflush(stdout);
+        if (count > 0) {
+            count--;
+        }
+    }
+    evring_close(&reader);
+    return r < 0 ? 1 : 0;
+}
+
+int main(int argc, char *argv[]) {
+    const char *name = EVRING_NAME, *metrics_socket = NULL;
+    bool publisher = false;
+    long count = -1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "Ps:M:n:v")) != -1) {
+        switch (opt) {
+            case 'P':
+                publisher = true;
+                break;
+            case 's':
+                name = optarg;
+                break;
+            case 'M':
+                metrics_socket = optarg;
+                break;
+            case 'n':
+                count = atol(optarg);
+                break;
+            case 'v':
+                verbose = true;
+                break;
+            default:
+                usage();
+        }
+    }
+    if (optind + (publisher ? 1 : 0) < argc || name[0] != '/' || (metrics_socket != NULL && !publisher)) {
+        usage();
+    }
+    if (metrics_socket != NULL && (metrics = metrics_listen(metrics_socket)) < 0) {
+        perror(metrics_socket);
+        return 1;
+    }
+    // a signal interrupts the reads and the futex waits
+    pedal_catch_signals();
+    if (publisher) {
+        int r = run_publisher(name, optind < argc ? argv[optind] : NULL);
+        if (metrics_socket != NULL) {
+            unlink(metrics_socket);
+        }
+        return r;
+    }
+    return run_subscriber(name, count);
+}
@@ -0,0 +1,345 @@
+/*
+Copyright (c) 2012 Radoslav Gerganov <rgerganov@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sound/asequencer.h>
+#include "common.h"
+#include "metrics.h"
+#include "pedal.h"
+
+/**
+ * Turns pedal presses into MIDI events on a port of the ALSA sequencer,
+ * e.g. for sustain or transport, without going through the keyboard input
+ * stack (and the window focus) of the desktop. The input reports are read
+ * from the hidraw node of the pedal and each mapped key is sent as a control
+ * change or a note directly to the subscribers of the port. The sequencer
+ * is used through its kernel interface (/dev/snd/seq), so there is nothing
+ * between the two file descriptors but the mapping.
+ */
+
+#define SEQ_DEVICE "/dev/snd/seq"
+
+enum action_type {
+    ACTION_NONE,
+    ACTION_CC,
+    ACTION_NOTE,
+};
+
+// What a key of the pedal sends, by its HID usage
+typedef struct action
+{
+    uint8_t type;
+    uint8_t number;         // the controller or the note
+    uint8_t on;             // the value or velocity of a press
+    uint8_t off;            // the value of a release
+} action;
+
+static action actions[256];
+static int channel = 0;
+static int seq = -1;
+static int port = 0;
+static bool print_only = false;
+static bool verbose = false;
+// The listening socket of -M, -1 without it
+static int metrics = -1;
+
+void usage() {
+    fprintf(stderr, "Usage: footswitch-midi -m map [-m map ...] [-C channel] [-t client:port] [-n name] [-M socket] [-r] [-p] [-v] [device]\n"
+        "   -m map         - key=cc:number[:on[:off]] or key=note:number[:velocity], e.g. a=cc:64 for sustain;\n"
+        "                    the key is a key or modifier name as in -k and -m of footswitch\n"
+        "   -C channel     - the MIDI channel, 1-16 (default 1)\n"
+        "   -t client:port - connect the port to this destination, e.g. 128:0\n"
+        "   -n name        - the name of the sequencer client and port (default footswitch)\n"
+        "   -M socket      - serve metrics in the Prometheus text format on this Unix socket\n"
+        "   -r             - run with real-time priority and locked memory\n"
+        "   -p             - print the MIDI events instead of sending them\n"
+        "   -v             - print each event with its forwarding time\n"
+        "   device         - /dev/hidrawN of the keyboard interface of the pedal (default: the first pedal)\n");
+    exit(1);
+}
+
+static bool parse_byte(const char *arg, uint8_t *b, int max) {
+    char *end = NULL;
+    long val = strtol(arg, &end, 10);
+
+    if (*arg == 0 || (*end != 0 && *end != ':') || val < 0 || val > max) {
+        return false;
+    }
+    *b = val;
+    return true;
+}
+
+// key=cc:number[:on[:off]] or key=note:number[:velocity]
+static bool parse_map(const char *arg) {
+    const char *eq = strchr(arg, '='), *spec = NULL, *colon = NULL;
+    char key[32];
+    unsigned char usage = 0;
+    enum modifier mod;
+    action a = {ACTION_NONE, 0, 127, 0};
+
+    if (eq == NULL || eq - arg >= (int) sizeof(key)) {
+        return false;
+    }
+    snprintf(key, sizeof(key), "%.*s", (int) (eq - arg), arg);
+    spec = eq + 1;
+    if (parse_modifier(key, &mod)) {
+        usage = 0xe0 + __builtin_ctz(mod);
+    } else if (!encode_key(key, &usage) || usage == 0) {
+        fprintf(stderr, "Cannot encode key '%s'\n", key);
+        return false;
+    }
+    if (strncmp(spec, "cc:", 3) == 0) {
+        a.type = ACTION_CC;
+    } else if (strncmp(spec, "note:", 5) == 0) {
+        a.type = ACTION_NOTE;
+        a.on = 100;
+    } else {
+        return false;
+    }
+    colon = strchr(spec, ':');
+    if (!parse_byte(colon + 1, &a.number, 127)) {
+        return false;
+    }
+    if ((colon = strchr(colon + 1, ':')) != NULL && !parse_byte(colon + 1, &a.on, 127)) {
+        return false;
+    }
+    if (colon != NULL && a.type == ACTION_CC && (colon = strchr(colon + 1, ':')) != NULL &&
+            !parse_byte(colon + 1, &a.off, 127)) {
+        return false;
+    }
+    // a note has no off value and nothing follows the off value of a controller
+    if (colon != NULL && strchr(colon + 1, ':') != NULL) {
+        return false;
+    }
+    actions[usage] = a;
+    return true;
+}
+
+static bool open_sequencer(const char *name, const char *target) {
+    struct snd_seq_client_info client;
+    struct snd_seq_port_info info;
+    int id = 0;
+
+    if ((seq = open(SEQ_DEVICE, O_RDWR | O_CLOEXEC)) < 0) {
+        perror(SEQ_DEVICE);
+        return false;
+    }
+    memset(&client, 0, sizeof(client));
+    if (ioctl(seq, SNDRV_SEQ_IOCTL_CLIENT_ID, &id) < 0) {
+        perror("SNDRV_SEQ_IOCTL_CLIENT_ID");
+        return false;
+    }
+    client.client = id;
+    if (ioctl(seq, SNDRV_SEQ_IOCTL_GET_CLIENT_INFO, &client) == 0) {
+        snprintf(client.name, sizeof(client.name), "%s", name);
+        ioctl(seq, SNDRV_SEQ_IOCTL_SET_CLIENT_INFO, &client);
+    }
+    memset(&info, 0, sizeof(info));
+    info.addr.client = id;
+    snprintf(info.name, sizeof(info.name), "%s", name);
+    info.capability = SNDRV_SEQ_PORT_CAP_READ | SNDRV_SEQ_PORT_CAP_SUBS_READ;
+    info.type = SNDRV_SEQ_PORT_TYPE_MIDI_GENERIC | SNDRV_SEQ_PORT_TYPE_APPLICATION;
+    info.midi_channels = 16;
+    if (ioctl(seq, SNDRV_SEQ_IOCTL_CREATE_PORT, &info) < 0) {
+        perror("SNDRV_SEQ_IOCTL_CREATE_PORT");
+        return false;
+    }
+    port = info.addr.port;
+    fprintf(stderr, "Sending MIDI events from %d:%d\n", id, port);
+    if (target != NULL) {
+        struct snd_seq_port_subscribe sub;
+        int dest_client = 0, dest_port = 0;
+        memset(&sub, 0, sizeof(sub));
+        if (sscanf(target, "%d:%d", &dest_client, &dest_port) != 2) {
+            fprintf(stderr, "Invalid destination '%s'\n", target);
+            return false;
+        }
+        sub.sender.client = id;
+        sub.sender.port = port;
+        sub.dest.client = dest_client;
+        sub.dest.port = dest_port;
+        if (ioctl(seq, SNDRV_SEQ_IOCTL_SUBSCRIBE_PORT, &sub) < 0) {
+            perror(target);
+            return false;
+        }
+    }
+    return true;
+}
+
+// Sends the event of a key directly (without a queue) to the subscribers
+static void send_action(uint8_t usage, bool pressed, void *arg) {
+    const action *a = &actions[usage];
+    uint64_t *arrived = arg;
+    struct snd_seq_event ev;
+
+    if (a->type == ACTION_NONE) {
+        return;
+    }
+    memset(&ev, 0, sizeof(ev));
+    ev.flags = SNDRV_SEQ_TIME_STAMP_TICK | SNDRV_SEQ_TIME_MODE_REL | SNDRV_SEQ_EVENT_LENGTH_FIXED |
+        SNDRV_SEQ_PRIORITY_HIGH;
+    ev.queue = SNDRV_SEQ_QUEUE_DIRECT;
+    ev.source.port = port;
+    ev.dest.client = SNDRV_SEQ_ADDRESS_SUBSCRIBERS;
+    ev.dest.port = SNDRV_SEQ_ADDRESS_UNKNOWN;
+    if (a->type == ACTION_CC) {
+        ev.type = SNDRV_SEQ_EVENT_CONTROLLER;
+        ev.data.control.channel = channel;
+        ev.data.control.param = a->number;
+        ev.data.control.value = pressed ? a->on : a->off;
+    } else {
+        ev.type = pressed ? SNDRV_SEQ_EVENT_NOTEON : SNDRV_SEQ_EVENT_NOTEOFF;
+        ev.data.note.channel = channel;
+        ev.data.note.note = a->number;
+        ev.data.note.velocity = pressed ? a->on : 0;
+    }
+    if (print_only) {
+        printf("%s %s %d %d\n", decode_byte(usage), a->type == ACTION_CC ? "cc" : pressed ? "note_on" : "note_off",
+               a->number, a->type == ACTION_CC ? ev.data.control.value : ev.data.note.velocity);
+        fflush(stdout);
+    } else if (write(seq, &ev, sizeof(ev)) != sizeof(ev)) {
+        perror(SEQ_DEVICE);
+    }
+    metrics_observe(METRIC_EVENT_DISPATCH, *arrived / 1000);
+    metrics_add(METRIC_EVENTS, 1);
+    if (verbose) {
+        fprintf(stderr, "%s %s forwarded in %.1f us\n", pressed ? "press" : "release", decode_byte(usage),
+                (pedal_now_ns() - *arrived) / 1e3);
+    }
+}
+
+// Real-time priority keeps other processes from delaying the forwarding
+static void set_realtime() {
+    struct sched_param sp = {.sched_priority = sched_get_priority_min(SCHED_FIFO) + 10};
+
+    if (sched_setscheduler(0, SCHED_FIFO, &sp) < 0) {
+        perror("sched_setscheduler");
+    }
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0) {
+        perror("mlockall");
+    }
+}
+
+int main(int argc, char *argv[]) {
+    const char *name = "footswitch", *target = NULL, *metrics_socket = NULL;
+    char path[64];
+    uint8_t last[8] = {0}, released[8] = {0}, report[16];
+    uint64_t arrived = 0;
+    bool mapped = false, realtime = false;
+    int opt, fd = -1, status = 0;
+
+    while ((opt = getopt(argc, argv, "m:C:t:n:M:rpv")) != -1) {
+        switch (opt) {
+            case 'm':
+                if (!parse_map(optarg)) {
+                    fprintf(stderr, "Invalid mapping '%s'\n", optarg);
+                    usage();
+                }
+                mapped = true;
+                break;
+            case 'C':
+                channel = atoi(optarg) - 1;
+                break;
+            case 't':
+                target = optarg;
+                break;
+            case 'n':
+                name = optarg;
+                break;
+            case 'M':
+                metrics_socket = optarg;
+                break;
+            case 'r':
+                realtime = true;
+                break;
+            case 'p':
+                print_only = true;
+                break;
+            case 'v':
+                verbose = true;
+                break;
+            default:
+                usage();
+        }
+    }
+    if (optind + 1 < argc || !mapped || channel < 0 || channel > 15) {
+        usage();
+    }
+    if (!print_only && !open_sequencer(name, target)) {
+        return 1;
+    }
+    if (optind < argc) {
+        snprintf(path, sizeof(path), "%s", argv[optind]);
+    } else if (!pedal_find(path, sizeof(path))) {
+        fprintf(stderr, "Cannot find a pedal\n");
+        return 1;
+    }
+    // a blocking read, the reports are forwarded as soon as they arrive
+    if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0) {
+        perror(path);
+        return 1;
+    }
+    if (metrics_socket != NULL && (metrics = metrics_listen(metrics_socket)) < 0) {
+        perror(metrics_socket);
+        return 1;
+    }
+    if (realtime) {
+        set_realtime();
+    }
+    pedal_catch_signals();
+    while (!pedal_stop) {
+        ssize_t r = pedal_wait(fd, metrics) ? read(fd, report, sizeof(report)) : -1;
+        const uint8_t *keys = NULL;
+        arrived = pedal_now_ns();
+        if (r < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror(path);
+            status = 1;
+            break;
+        }
+        if (r == 0) {
+            break;
+        }
+        if ((keys = pedal_keys(report, r)) != NULL) {
+            diff_reports(last, keys, send_action, &arrived);
+            memcpy(last, keys, sizeof(last));
+        }
+    }
+    // the held notes and controllers would otherwise hang in the synth
+    arrived = pedal_now_ns();
+    diff_reports(last, released, send_action, &arrived);
+    if (metrics_socket != NULL) {
+        unlink(metrics_socket);
+    }
+    return status;
+}
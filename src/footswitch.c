@@ -27,34 +27,24 @@ THE SOFTWARE.
 #include <unistd.h>
 #include <hidapi.h>
 #include "common.h"
+#include "device.h"
+#include "layout.h"
+#include "metrics.h"
+#include "pacing.h"
+#include "plan.h"
+#include "profiledb.h"
+#include "profile.h"
+#include "transfer.h"
 #include "debug.h"
 
 hid_device *dev = NULL;
 
-typedef struct pedal_data
-{
-    unsigned char header[8];
-    unsigned char data[48];
-    int data_len;
-} pedal_data;
-
-typedef struct pedal_protocol
-{
-    unsigned char start[8];
-    pedal_data pedals[3];
-} pedal_protocol;
+profile pd;
 
-pedal_protocol pd = {{0}};
-pedal_data *curr_pedal = &pd.pedals[1]; // start at the second pedal
-
-// KEY and MOUSE types can be combined
-#define KEY_TYPE    1
-#define MOUSE_TYPE    2
-// STRING must be by itself
-#define STRING_TYPE    4
+pacing pace = {DEFAULT_GAP_US, DEFAULT_START_US};
 
 void usage() {
-    fprintf(stderr, "Usage: footswitch [-123] [-r] [-s <string>] [-S <raw_string>] [-ak <key>] [-m <modifier>] [-b <button>] [-xyw <XYW>]\n"
+    fprintf(stderr, "Usage: footswitch [-123] [-r] [-s <string>] [-S <raw_string>] [-ak <key>] [-m <modifier>] [-b <button>] [-c <combo>] [-xyw <XYW>]\n"
         "   -r          - read all pedals\n"
         "   -1          - program the first pedal\n"
         "   -2          - program the second pedal (default)\n"
@@ -65,139 +55,107 @@ void usage() {
         "   -k key      - write the specified key\n"
         "   -m modifier - (l_,r_)ctrl|shift|alt|win\n"
         "   -b button   - mouse_left|mouse_middle|mouse_right\n"
+        "   -c combo    - keys, modifiers and buttons joined with +, e.g. ctrl+shift+f5,\n"
+        "                 or a sequence of keys separated with commas\n"
         "   -x X        - move the mouse cursor horizontally by X pixels\n"
         "   -y Y        - move the mouse cursor vertically by Y pixels\n"
-        "   -w W        - move the mouse wheel by W\n\n"
-        "You cannot mix -sSa options with -kmbxyw options for one and the same pedal\n");
+        "   -w W        - move the mouse wheel by W\n"
+        "   --calibrate - find the fastest timing which the device supports and remember it\n"
+        DEVICE_USAGE "\n"
+        "You cannot mix -sSa options and -c sequences with -kmbxyw options and -c combos\n"
+        "for one and the same pedal\n");
     exit(1);
 }
 
-void init_pid(unsigned short vid, unsigned short pid) {
-    struct hid_device_info *info = NULL, *ptr = NULL;
+void init() {
+    static const unsigned short vid_pid[][2] = {
+        FOOTSWITCH_DEVICES(LAYOUT_VID_PID)
+    };
     hid_init();
     // Config protocol is on interface 1. Interface 0 is the keyboard, which
     // macOS won't open, so we can't just hid_open() by vid/pid here.
-    info = hid_enumerate(vid, pid);
-    ptr = info;
-    while (ptr != NULL) {
-        if (ptr->interface_number == 1) {
-            dev = hid_open_path(ptr->path);
-            break;
-        }
-        ptr = ptr->next;
-    }
-    hid_free_enumeration(info);
-#ifdef OSX
-    // Older hidapi (<0.14) doesn't report interface_number on macOS, so the
-    // loop finds nothing -- fall back to opening by vid/pid.
-    if (dev == NULL) {
-        dev = hid_open(vid, pid, NULL);
-    }
-#endif
-}
-
-void init() {
-    unsigned short vid_pid[][2] = {
-        {0x0c45, 0x7403},
-        {0x0c45, 0x7404},
-        {0x413d, 0x2107},
-        {0x1a86, 0xe026},
-        {0x3553, 0xb001},
-    };
-    int i = 0;
-    for (i = 0 ; i < sizeof(vid_pid) / sizeof(vid_pid[0]) ; i++) {
-        init_pid(vid_pid[i][0], vid_pid[i][1]);
-        if (dev != NULL) {
-            break;
-        }
-    }
+    device_id id;
+    dev = open_device(vid_pid, sizeof(vid_pid) / sizeof(vid_pid[0]), 1);
     if (dev == NULL) {
         fatal("Cannot find footswitch with one of the supported VID:PID.\nCheck that the device is connected and that you have the correct permissions to access it.");
     }
-}
-
-void init_pedal(pedal_data *p, int num) {
-    unsigned char default_header[8] = {0x01, 0x81, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00};
-    unsigned char default_data[8] = {0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
-
-    memcpy(p->header, default_header, 8);
-    p->header[3] = num + 1;
-
-    memset(p->data, 0, sizeof(p->data));
-    memcpy(p->data, default_data, 8);
-
-    p->data_len = 8;
-}
-
-void init_pedals() {
-    unsigned char start[8] = {0x01, 0x80, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00};
-
-    memcpy(pd.start, start, 8);
-    init_pedal(&pd.pedals[0], 0);
-    init_pedal(&pd.pedals[1], 1);
-    init_pedal(&pd.pedals[2], 2);
+    if (get_device_id(&id) && pacing_load(&id, &pace)) {
+        diag("Using calibrated timing: %u us between packets, %u us after start", pace.gap_us, pace.start_us);
+    }
 }
 
 void deinit() {
-    hid_close(dev);
+    close_device(dev);
     hid_exit();
 }
 
-void usb_write(unsigned char data[8]) {
-    int r = hid_write(dev, data, 8);
-    if (r < 0) {
-        fatal("error writing data (%ls)", hid_error(dev));
+bool usb_write(unsigned char data[8]) {
+    int r = xfer_write(dev, data, 8);
+    if (r == XFER_PERMANENT) {
+        fatal("error writing data (%ls)", xfer_error(dev));
     }
-    usleep(30 * 1000);
+    usleep(pace.gap_us);
+    return r >= 0;
 }
 
-void print_mouse(unsigned char data[]) {
-    int x = data[5], y = data[6], w = data[7];
-    switch (data[4]) {
+bool usb_read(unsigned char data[8]) {
+    int r = xfer_read(dev, data, 8);
+    if (r == XFER_PERMANENT) {
+        fatal("error reading data (%ls)", xfer_error(dev));
+    }
+    return r > 0;
+}
+
+// Long enough for a string of 38 keys with long names
+#define DESCRIPTION_SIZE 640
+
+/*
+ * The decoders append the configuration of a pedal, in the layout used both
+ * for programming and for reading back, to a buffer of DESCRIPTION_SIZE.
+ */
+void describe_mouse(const unsigned char data[], char *out) {
+    switch (data[FOOTSWITCH_BUTTON]) {
         case 1:
-            printf("mouse_left ");
+            strcat(out, "mouse_left ");
             break;
         case 2:
-            printf("mouse_right ");
+            strcat(out, "mouse_right ");
             break;
         case 4:
-            printf("mouse_middle ");
+            strcat(out, "mouse_middle ");
             break;
     }
-    x = x > 127 ? x - 256 : x;
-    y = y > 127 ? y - 256 : y;
-    w = w > 127 ? w - 256 : w;
-    printf("X=%d Y=%d W=%d", x, y, w);
+    layout_format(LAYOUT_FIELD(FOOTSWITCH, X), 3, data, out, DESCRIPTION_SIZE);
 }
 
-void print_key(unsigned char data[]) {
+void describe_key(const unsigned char data[], char *out) {
     char combo[128] = {0};
-    if ((data[2] & CTRL) != 0) {
+    if ((data[FOOTSWITCH_MOD] & CTRL) != 0) {
         strcat(combo, "l_ctrl+");
     }
-    if ((data[2] & SHIFT) != 0) {
+    if ((data[FOOTSWITCH_MOD] & SHIFT) != 0) {
         strcat(combo, "l_shift+");
     }
-    if ((data[2] & ALT) != 0) {
+    if ((data[FOOTSWITCH_MOD] & ALT) != 0) {
         strcat(combo, "l_alt+");
     }
-    if ((data[2] & WIN) != 0) {
+    if ((data[FOOTSWITCH_MOD] & WIN) != 0) {
         strcat(combo, "l_win+");
     }
-    if ((data[2] & R_CTRL) != 0) {
+    if ((data[FOOTSWITCH_MOD] & R_CTRL) != 0) {
         strcat(combo, "r_ctrl+");
     }
-    if ((data[2] & R_SHIFT) != 0) {
+    if ((data[FOOTSWITCH_MOD] & R_SHIFT) != 0) {
         strcat(combo, "r_shift+");
     }
-    if ((data[2] & R_ALT) != 0) {
+    if ((data[FOOTSWITCH_MOD] & R_ALT) != 0) {
         strcat(combo, "r_alt+");
     }
-    if ((data[2] & R_WIN) != 0) {
+    if ((data[FOOTSWITCH_MOD] & R_WIN) != 0) {
         strcat(combo, "r_win+");
     }
-    if (data[3] != 0) {
-        const char *key = decode_byte(data[3]);
+    if (data[FOOTSWITCH_KEY] != 0) {
+        const char *key = decode_byte(data[FOOTSWITCH_KEY]);
         strcat(combo, key);
     } else {
         size_t len = strlen(combo);
@@ -205,354 +163,376 @@ void print_key(unsigned char data[]) {
             combo[len - 1] = 0; // remove the last +
         }
     }
-    printf("%s", combo);
+    strcat(out, combo);
 }
 
-void print_string(unsigned char data[]) {
-    int r = 0, tr = 0, ind = 2;
-    int len = data[0] - 2;
+void describe_string(const unsigned char data[], char *out) {
+    int ind = 2;
+    int len = data[FOOTSWITCH_LEN] - 2;
     const char *str = NULL;
 
-    while (len > 0) {
-        if (ind == 8) {
-            r = hid_read(dev, data, 8);
-            if (r < 0) {
-                fatal("error reading data (%ls)", hid_error(dev));
-            }
-            if (tr != 8) {
-                fatal("expected 8 bytes, received: %d", tr);
-            }
-            ind = 0;
-        }
+    while (len > 0 && ind < 48) {
+        size_t used = strlen(out);
         str = decode_byte(data[ind]);
-        if (strlen(str) > 1) {
-            printf("<%s>", str);
-        } else {
-            printf("%s", str);
-        }
+        snprintf(out + used, DESCRIPTION_SIZE - used, strlen(str) > 1 ? "<%s>" : "%s", str);
         len--;
         ind++;
     }
 }
 
-void read_pedals() {
-    int r = 0, i = 0;
-    unsigned char query[8] = {0x01, 0x82, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00};
-    unsigned char response[8];
-
-    for (i = 0 ; i < 3 ; i++) {
-        query[3] = i + 1;
-        usb_write(query);
-        r = hid_read(dev, response, 8);
-        if (r < 0) {
-            fatal("error reading data (%ls)", hid_error(dev));
-        }
-        printf("[switch %d]: ", i + 1);
-        switch (response[1]) {
-            case 0:
-                printf("unconfigured");
-                break;
-            case 1:
-            case 0x81:
-                print_key(response);
-                break;
-            case 2:
-                print_mouse(response);
-                break;
-            case 3:
-                print_key(response);
-                printf(" ");
-                print_mouse(response);
-                break;
-            case 4:
-                print_string(response);
-                break;
-            default:
-                fprintf(stderr, "Unknown response:\n");
-                debug_arr(response, 8);
-                return;
-        }
-        printf("\n");
+// Returns false if the type of the pedal is unknown
+bool describe_pedal(const unsigned char data[], char out[DESCRIPTION_SIZE]) {
+    out[0] = 0;
+    switch (data[FOOTSWITCH_TYPE]) {
+        case 0:
+            strcat(out, "unconfigured");
+            break;
+        case 1:
+        case 0x81:
+            describe_key(data, out);
+            break;
+        case 2:
+            describe_mouse(data, out);
+            break;
+        case 3:
+            describe_key(data, out);
+            strcat(out, " ");
+            describe_mouse(data, out);
+            break;
+        case 4:
+            describe_string(data, out);
+            break;
+        default:
+            return false;
     }
+    return true;
 }
 
+typedef struct pedal_query
+{
+    int num;
+    unsigned char response[48];
+} pedal_query;
+
 /**
- * The following types are valid:
- *   KEY_TYPE,
- *   MOUSE_TYPE,
- *   KEY_TYPE | MOUSE_TYPE,
- *   STRING_TYPE
+ * Queries the configuration of one pedal. Strings don't fit in a single
+ * packet, so all packets of the response are collected in the buffer.
  */
-bool set_pedal_type(unsigned char new_type) {
-    unsigned char *curr_type = &curr_pedal->data[1];
-    // check if there is no type set (default)
-    if (*curr_type == 0) {
-        // set type and data_len
-        *curr_type = new_type;
-        if (new_type == STRING_TYPE) {
-            curr_pedal->data_len = 2;
+bool read_pedal(void *arg) {
+    pedal_query *q = arg;
+    unsigned char query[8] = {0x01, 0x82, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00};
+    int len = 8;
+
+    xfer_drain(dev);
+    query[3] = q->num + 1;
+    if (!usb_write(query) || !usb_read(q->response)) {
+        return false;
+    }
+    if (q->response[FOOTSWITCH_TYPE] == STRING_TYPE) {
+        len = q->response[FOOTSWITCH_LEN] < sizeof(q->response) ? q->response[FOOTSWITCH_LEN] : sizeof(q->response);
+    }
+    for (int ind = 8 ; ind < len ; ind += 8) {
+        if (!usb_read(&q->response[ind])) {
+            return false;
         }
-        return true;
-    }
-    // type is already set, check if we can add the new type
-    switch (new_type) {
-        case STRING_TYPE:
-            return *curr_type == STRING_TYPE;
-        case KEY_TYPE:
-        case MOUSE_TYPE:
-            if (*curr_type == STRING_TYPE) {
-                return false;
-            }
-            *curr_type |= new_type;
-            return true;
     }
-    return false;
+    return true;
 }
 
-void compile_string_data(unsigned char *data, size_t len) {
-    if (curr_pedal->data_len + len > 40) {
-        fprintf(stderr, "The size of the accumulated string must be <= 38\n");
-        exit(1);
+void read_pedals() {
+    int i = 0;
+    pedal_query q;
+    char text[DESCRIPTION_SIZE];
+
+    for (i = 0 ; i < 3 ; i++) {
+        q.num = i;
+        if (!xfer_sequence(read_pedal, &q)) {
+            fatal("error reading pedal %d (%ls)", i + 1, xfer_error(dev));
+        }
+        if (!describe_pedal(q.response, text)) {
+            fprintf(stderr, "Unknown response:\n");
+            debug_arr(q.response, 8);
+            return;
+        }
+        printf("[switch %d]: %s\n", i + 1, text);
     }
-    memcpy(&curr_pedal->data[curr_pedal->data_len], data, len);
-    curr_pedal->data_len += len;
-    curr_pedal->header[2] = curr_pedal->data_len;
-    curr_pedal->data[0] = curr_pedal->data_len;
 }
 
-void compile_string(const char *str) {
-    size_t len = strlen(str);
-    unsigned char arr[40] = {0};
+void compile_option(int opt, char *arg) {
+    enum profile_status status = profile_option(&pd, opt, arg);
 
-    if (!set_pedal_type(STRING_TYPE)) {
-        fprintf(stderr, "Invalid combination of options\n");
-        usage();
-    }
-    if (len > 38) {
-        fprintf(stderr, "The size of each string must be <= 38\n");
-        exit(1);
+    if (status == PROFILE_OK) {
+        return;
     }
-    if (!encode_string(str, arr)) {
-        fprintf(stderr, "Cannot encode string: '%s'\n", str);
-        exit(1);
+    fprintf(stderr, "%s\n", pd.error);
+    if (status == PROFILE_CONFLICT) {
+        usage();
     }
-    compile_string_data(arr, len);
+    exit(1);
 }
 
-void compile_string_key(const char *key) {
-    unsigned char b;
+void build_plan(plan *p) {
+    profile_plan(&pd, &pace, p);
+}
 
-    if (!set_pedal_type(STRING_TYPE)) {
-        fprintf(stderr, "Invalid combination of options\n");
-        usage();
+// The device answers with the same layout which is used for programming
+bool pedal_matches(pedal_data *pedal, unsigned char *response) {
+    if (pedal->data[FOOTSWITCH_TYPE] == STRING_TYPE) {
+        return memcmp(response, pedal->data, pedal->data_len) == 0;
     }
-    if (!encode_key(key, &b)) {
-        fprintf(stderr, "Cannot encode key '%s'\n", key);
-        exit(1);
-    }
-    compile_string_data(&b, 1);
+    return (response[FOOTSWITCH_TYPE] & 0x7f) == pedal->data[FOOTSWITCH_TYPE] &&
+        memcmp(&response[FOOTSWITCH_MOD], &pedal->data[FOOTSWITCH_MOD], FOOTSWITCH_SIZE - FOOTSWITCH_MOD) == 0;
 }
 
-void compile_raw_string(const char *str) {
-    unsigned char arr[40];
-    int ind = 0;
-    char *tok = NULL;
-
-    if (!set_pedal_type(STRING_TYPE)) {
-        fprintf(stderr, "Invalid combination of options\n");
-        usage();
-    }
-    tok = strtok((char *)str, " ,");
-    while (tok != NULL && ind < 38) {
-        int val;
-        if (sscanf(tok, "%x", &val) == 1) {
-            arr[ind++] = val;
-        } else {
-            fprintf(stderr, "'%s' is invalid hex number\n", tok);
-            exit(1);
+/**
+ * The pedals programmed by a plan, taken from its packets so that images
+ * can be verified as well. first[] is the packet which starts each pedal.
+ * Returns a mask of the pedals.
+ */
+int planned_pedals(const plan *p, pedal_data pedals[3], int first[3]) {
+    int mask = 0;
+
+    for (int i = 0 ; i < p->count ; i++) {
+        const uint8_t *header = p->packets[i].data;
+        int num = header[3] - 1, len = 0;
+        if (header[0] != 0x01 || header[1] != 0x81 || num < 0 || num > 2) {
+            continue;
         }
-        tok = strtok(NULL, " ,");
-    }
-    if (tok != NULL) {
-        fprintf(stderr, "The size of each string must be <= 38\n");
-        exit(1);
+        pedal_data *pedal = &pedals[num];
+        memset(pedal, 0, sizeof(*pedal));
+        memcpy(pedal->header, header, 8);
+        pedal->data_len = header[2] < sizeof(pedal->data) ? header[2] : sizeof(pedal->data);
+        first[num] = i;
+        while (!(p->packets[i].flags & PACKET_COMMIT) && ++i < p->count && len < sizeof(pedal->data)) {
+            memcpy(&pedal->data[len], p->packets[i].data, 8);
+            len += 8;
+        }
+        mask |= 1 << num;
     }
-    compile_string_data(arr, ind);
+    return mask;
 }
 
-void compile_key(const char *key) {
-    unsigned char b = 0;
+/**
+ * Reads back the pedals which a plan has programmed and sends only the
+ * ones which differ from it again, up to VERIFY_ATTEMPTS times.
+ */
+void verify_plan(const plan *p) {
+    pedal_data expected[3];
+    int first[3], resend[3];
+    int mask = planned_pedals(p, expected, first);
+    char want[DESCRIPTION_SIZE], got[DESCRIPTION_SIZE];
+    pedal_query q;
+
+    for (int attempt = 0 ; mask != 0 ; attempt++) {
+        uint64_t start = metrics_now();
+        plan retry = {0};
+        int count = 0;
+
+        for (q.num = 0 ; q.num < 3 ; q.num++) {
+            if ((mask & (1 << q.num)) == 0) {
+                continue;
+            }
+            if (!xfer_sequence(read_pedal, &q)) {
+                fatal("error reading pedal %d (%ls)", q.num + 1, xfer_error(dev));
+            }
+            if (pedal_matches(&expected[q.num], q.response)) {
+                mask &= ~(1 << q.num);
+                continue;
+            }
+            describe_pedal(expected[q.num].data, want);
+            if (!describe_pedal(q.response, got)) {
+                snprintf(got, sizeof(got), "type 0x%02x", q.response[FOOTSWITCH_TYPE]);
+            }
+            fprintf(stderr, "Pedal %d reads back as '%s' instead of '%s'\n", q.num + 1, got, want);
+            resend[count++] = first[q.num];
+        }
+        metrics_observe(METRIC_READBACK, start);
+        if (count == 0) {
+            break;
+        }
+        if (attempt == VERIFY_ATTEMPTS) {
+            fatal("%d pedal(s) don't verify after %d attempts", count, VERIFY_ATTEMPTS);
+        }
+        metrics_add(METRIC_MISMATCHES, count);
+        plan_add_units(&retry, p, resend, count);
+        if (!plan_run(dev, &retry)) {
+            fatal("error writing data (%ls)", xfer_error(dev));
+        }
+        plan_free(&retry);
+    }
+}
 
-    if (!set_pedal_type(KEY_TYPE)) {
-        fprintf(stderr, "Invalid combination of options\n");
-        usage();
+void run_plan(const plan *p) {
+    if (!plan_run(dev, p)) {
+        fatal("error writing data (%ls)", xfer_error(dev));
     }
-    if (!encode_key(key, &b)) {
-        fprintf(stderr, "Cannot encode key '%s'\n", key);
-        exit(1);
+    if (verify_after_write) {
+        verify_plan(p);
     }
-    curr_pedal->data[3] = b;
 }
 
-void compile_modifier(const char *mod_str) {
-    enum modifier mod;
+void write_pedals() {
+    plan p = {0};
 
-    if (!parse_modifier(mod_str, &mod)) {
-        fprintf(stderr, "Invalid modifier '%s'\n", mod_str);
-        exit(1);
-    }
-    if (!set_pedal_type(KEY_TYPE)) {
-        fprintf(stderr, "Invalid combination of options\n");
-        usage();
-    }
-    curr_pedal->data[2] |= mod;
+    build_plan(&p);
+    run_plan(&p);
+    plan_free(&p);
 }
 
-void compile_mouse_button(const char *btn_str) {
-    enum mouse_button btn;
+bool verify_pedals() {
+    pedal_query q;
 
-    if (!parse_mouse_button(btn_str, &btn)) {
-        fprintf(stderr, "Invalid mouse button '%s'\n", btn_str);
-        exit(1);
-    }
-    if (!set_pedal_type(MOUSE_TYPE)) {
-        fprintf(stderr, "Invalid combination of options\n");
-        usage();
+    for (q.num = 0 ; q.num < 3 ; q.num++) {
+        if (!read_pedal(&q) || !pedal_matches(&pd.pedals[q.num], q.response)) {
+            return false;
+        }
     }
-    curr_pedal->data[4] = btn;
+    return true;
 }
 
-void compile_mouse_xyw(const char *mx, const char *my, const char *mw) {
-    if (!set_pedal_type(MOUSE_TYPE)) {
-        fprintf(stderr, "Invalid combination of options\n");
-        usage();
-    }
-    if (mx) {
-        int x = atoi(mx);
-        if (x < -128 || x > 127) {
-            fprintf(stderr, "'x' must be in [-128, 127]\n");
-            exit(1);
-        }
-        x = x < 0 ? 256 + x : x;
-        curr_pedal->data[5] = x;
-    }
-    if (my) {
-        int y = atoi(my);
-        if (y < -128 || y > 127) {
-            fprintf(stderr, "'y' must be in [-128, 127]\n");
-            exit(1);
+// Loads the current configuration of the device, so it can be written back
+void load_pedals() {
+    pedal_query q;
+
+    for (q.num = 0 ; q.num < 3 ; q.num++) {
+        pedal_data *pedal = &pd.pedals[q.num];
+        if (!xfer_sequence(read_pedal, &q)) {
+            fatal("error reading pedal %d (%ls)", q.num + 1, xfer_error(dev));
         }
-        y = y < 0 ? 256 + y : y;
-        curr_pedal->data[6] = y;
-    }
-    if (mw) {
-        int w = atoi(mw);
-        if (w < -128 || w > 127) {
-            fprintf(stderr, "'w' must be in [-128, 127]\n");
-            exit(1);
+        if (q.response[FOOTSWITCH_TYPE] == STRING_TYPE) {
+            pedal->data_len = q.response[FOOTSWITCH_LEN] < 40 ? q.response[FOOTSWITCH_LEN] : 40;
+            memcpy(pedal->data, q.response, pedal->data_len);
+            pedal->header[2] = pedal->data_len;
+        } else if (q.response[FOOTSWITCH_TYPE] != 0) {
+            memcpy(&pedal->data[FOOTSWITCH_MOD], &q.response[FOOTSWITCH_MOD], FOOTSWITCH_SIZE - FOOTSWITCH_MOD);
+            pedal->data[FOOTSWITCH_TYPE] = q.response[FOOTSWITCH_TYPE] & 0x7f;
         }
-        w = w < 0 ? 256 + w : w;
-        curr_pedal->data[7] = w;
     }
 }
 
-void write_pedal(pedal_data *pedal) {
-    unsigned char data[8];
-    int arr_ind = 0, data_ind = 0;
-
-    usb_write(pedal->header);
-    memset(data, 0, 8);
-    while (arr_ind < pedal->data_len) {
-        if (data_ind == 8) {
-            usb_write(data);
-            memset(data, 0, 8);
-            data_ind = 0;
-        }
-        data[data_ind++] = pedal->data[arr_ind++];
-    }
-    usb_write(data);
+bool trial(const pacing *p) {
+    pacing saved = pace;
+    plan pl = {0};
+    bool ok;
+
+    pace = *p;
+    build_plan(&pl);
+    ok = plan_run(dev, &pl) && verify_pedals();
+    plan_free(&pl);
+    pace = saved;
+    diag("%u us between packets, %u us after start: %s", p->gap_us, p->start_us, ok ? "ok" : "failed");
+    return ok;
 }
 
-void write_pedals() {
-    /*
-    int i = 0;
-    printf("start: ");
-    debug_arr(pd.start, 8);
-    for (i = 0 ; i < 3 ; i++) {
-        printf("pedal %d header: ", i+1);
-        debug_arr(pd.pedals[i].header, 8);
-        printf("pedal %d data: ", i+1);
-        debug_arr(pd.pedals[i].data, pd.pedals[i].data_len);
-    }
-    */
-    usb_write(pd.start);
-    usleep(1000*1000);
-    write_pedal(&pd.pedals[0]);
-    write_pedal(&pd.pedals[1]);
-    write_pedal(&pd.pedals[2]);
+/**
+ * Programs the device over and over again, bisecting the pause after the
+ * start packet and then the pause between packets, and keeps the shortest
+ * ones which still verify by readback (plus 25% headroom).
+ */
+void calibrate() {
+    pacing p = {DEFAULT_GAP_US, DEFAULT_START_US};
+    unsigned int lo, hi;
+    device_id id;
+
+    if (!trial(&p)) {
+        fatal("Programming doesn't verify even with the default timing");
+    }
+    lo = 0;
+    hi = p.start_us;
+    while (hi - lo > 5000) {
+        p.start_us = (lo + hi) / 2;
+        if (trial(&p)) {
+            hi = p.start_us;
+        } else {
+            lo = p.start_us;
+        }
+    }
+    p.start_us = hi;
+    lo = 0;
+    hi = p.gap_us;
+    while (hi - lo > 500) {
+        p.gap_us = (lo + hi) / 2;
+        if (trial(&p)) {
+            hi = p.gap_us;
+        } else {
+            lo = p.gap_us;
+        }
+    }
+    p.gap_us = hi + hi / 4;
+    p.start_us += p.start_us / 4;
+    // this also leaves the device programmed
+    if (!trial(&p)) {
+        fatal("Programming doesn't verify with the calibrated timing, try again");
+    }
+    printf("%u us between packets, %u us after start\n", p.gap_us, p.start_us);
+    if (!get_device_id(&id)) {
+        fprintf(stderr, "Cannot identify the device, the timing is not saved\n");
+    } else if (!pacing_save(&id, &p)) {
+        fprintf(stderr, "Cannot save the timing\n");
+    }
 }
 
 int main(int argc, char *argv[]) {
+    enum {
+        OPT_CALIBRATE = OPT_DEVICE_END,
+    };
+    static const struct option long_options[] = {
+        DEVICE_LONG_OPTIONS,
+        {"calibrate", no_argument, NULL, OPT_CALIBRATE},
+        {NULL, 0, NULL, 0}
+    };
+    bool read = false, write = false, calib = false;
     int opt;
 
-    if (argc == 1) {
-        usage();
-    }
-    if (argc == 2 && strcmp(argv[1], "-r") == 0) {
-        init();
-        read_pedals();
-        deinit();
-        return 0;
-    }
-    init_pedals();
-    while ((opt = getopt(argc, argv, "123rs:S:a:k:m:b:x:y:w:")) != -1) {
+    profile_init(&pd);
+    while ((opt = getopt_long(argc, argv, "123rs:S:a:k:m:b:c:x:y:w:o:", long_options, NULL)) != -1) {
+        if (opt != 'r' && opt != OPT_CALIBRATE && !is_device_option(opt)) {
+            write = true;
+        }
+        if (profile_is_option(opt)) {
+            compile_option(opt, optarg);
+            continue;
+        }
         switch (opt) {
-            case '1':
-                curr_pedal = &pd.pedals[0];
-                break;
-            case '2':
-                curr_pedal = &pd.pedals[1];
-                break;
-            case '3':
-                curr_pedal = &pd.pedals[2];
-                break;
             case 'r':
-                fprintf(stderr, "Cannot use -r with other options\n");
-                return 1;
-            case 's':
-                compile_string(optarg);
-                break;
-            case 'S':
-                compile_raw_string(optarg);
-                break;
-            case 'a':
-                compile_string_key(optarg);
-                break;
-            case 'k':
-                compile_key(optarg);
-                break;
-            case 'm':
-                compile_modifier(optarg);
-                break;
-            case 'b':
-                compile_mouse_button(optarg);
-                break;
-            case 'x':
-                compile_mouse_xyw(optarg, NULL, NULL);
-                break;
-            case 'y':
-                compile_mouse_xyw(NULL, optarg, NULL);
+                read = true;
                 break;
-            case 'w':
-                compile_mouse_xyw(NULL, NULL, optarg);
+            case OPT_CALIBRATE:
+                calib = true;
                 break;
             default:
-                usage();
+                if (!parse_device_option(opt, optarg)) {
+                    usage();
+                }
                 break;
         }
     }
+    if (optind < argc || (!read && !write && !calib && !compile_only && !flash_path && !db_path) ||
+            !image_options_valid(write, read || calib)) {
+        usage();
+    }
+    if (read && (write || calib)) {
+        fprintf(stderr, "Cannot use -r with other options\n");
+        return 1;
+    }
+    const image_tool tool = {"footswitch", build_plan, init, run_plan, deinit};
+    if (run_image_options(&tool)) {
+        return 0;
+    }
     init();
-    write_pedals();
+    if (read) {
+        uint64_t start = metrics_now();
+        read_pedals();
+        metrics_observe(METRIC_READBACK, start);
+    } else if (calib) {
+        // without pedal options the current configuration is kept
+        if (!write) {
+            load_pedals();
+        }
+        calibrate();
+    } else {
+        write_pedals();
+    }
     deinit();
     return 0;
 }
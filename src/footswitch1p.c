@@ -27,118 +27,227 @@ THE SOFTWARE.
 #include <unistd.h>
 #include <hidapi.h>
 #include "common.h"
+#include "device.h"
+#include "layout.h"
+#include "metrics.h"
+#include "plan.h"
+#include "profiledb.h"
+#include "transfer.h"
 #include "debug.h"
 
 hid_device *dev = NULL;
 
+#define PEDAL_PINS 8
 #define PEDAL_PIN_3_P15 0x03
 
 enum pedal_report_ids {
     REPORT_DEVICE_ID   = 0x22,
     REPORT_SET_CODE    = 0x10,
+    // assumed from the set command, not confirmed on a real device yet
+    REPORT_GET_CODE    = 0x11,
+};
+
+enum pedal_commands {
+    COMMAND_MOUSE      = 0x02,
+    COMMAND_KEYBOARD   = 0x80,
 };
 
 typedef struct pedal_data {
-    union {
-        struct {
-            unsigned char report_id;
-            unsigned char pin;
-            unsigned char command;
-            unsigned char size;
-            unsigned char data[8];
-        };
-        unsigned char buffer[64];
-    };
+    unsigned char buffer[FOOTSWITCH1P_SIZE];
 } pedal_data_t;
 
-pedal_data_t pd = { 0 };
+pedal_data_t pd[PEDAL_PINS] = { 0 };
+// the pin which -kmbxyw apply to and the pins which are going to be written
+int curr_pin = PEDAL_PIN_3_P15;
+// the pins are read back with REPORT_GET_CODE only when asked for
+bool read_pins = false;
+unsigned int written_pins = 0;
 
 void usage() {
-    fprintf(stderr, "Usage: footswitch1p [-r] [-k <key>] [-m <modifier>] [-b <button>] [-xyw <XYW>]\n"
-        "   -r          - read all pedals\n"
+    fprintf(stderr, "Usage: footswitch1p [-r] [-p <pin>] [-k <key>] [-m <modifier>] [-b <button>] [-c <combo>] [-xyw <XYW>]\n"
+        "   -r          - read the device ID (and all pins with --read-pins)\n"
+        "   -p pin      - modify the specified pin (0-7), 3 (P1.5) by default\n"
         "   -k key      - write the specified key\n"
         "   -m modifier - (l_,r_)ctrl|shift|alt|win\n"
         "   -b button   - mouse_left|mouse_middle|mouse_right\n"
+        "   -c combo    - a key with modifiers or a button joined with +, e.g. ctrl+shift+f5\n"
         "   -x X        - move the mouse cursor horizontally by X pixels\n"
         "   -y Y        - move the mouse cursor vertically by Y pixels\n"
-        "   -w W        - move the mouse wheel by W\n\n"
-        "You cannot mix -km options with -bxyw options.\n");
+        "   -w W        - move the mouse wheel by W\n"
+        "   --read-pins - read the pins back with -r and --verify, which the firmware may not support\n"
+        DEVICE_USAGE "\n"
+        "You cannot mix -km options with -bxyw options for the same pin.\n");
     exit(1);
 }
 
-void init_pid(unsigned short vid, unsigned short pid) {
-#ifdef OSX
-    hid_init();
-    dev = hid_open(vid, pid, NULL);
-#else
-    struct hid_device_info *info = NULL, *ptr = NULL;
-    hid_init();
-    info = hid_enumerate(vid, pid);
-    ptr = info;
-    while (ptr != NULL) {
-        if (ptr->interface_number == 3) {
-            dev = hid_open_path(ptr->path);
-            break;
-        }
-        ptr = ptr->next;
-    }
-    hid_free_enumeration(info);
-#endif
-}
-
 void init() {
-    static unsigned short vid_pid[][2] = {
-        {0x5131, 0x2019},
+    static const unsigned short vid_pid[][2] = {
+        FOOTSWITCH1P_DEVICES(LAYOUT_VID_PID)
     };
 
-    for (size_t i = 0 ; i < sizeof(vid_pid) / sizeof(vid_pid[0]) ; i++) {
-        init_pid(vid_pid[i][0], vid_pid[i][1]);
-        if (dev != NULL) {
-            break;
-        }
-    }
+    hid_init();
+    dev = open_device(vid_pid, sizeof(vid_pid) / sizeof(vid_pid[0]), 3);
     if (dev == NULL) {
         fatal("Cannot find footswitch with one of the supported VID:PID.\nCheck that the device is connected and that you have the correct permissions to access it.");
     }
 }
 
-void init_pedal() {
-    pd.report_id = REPORT_SET_CODE;
-    pd.pin = PEDAL_PIN_3_P15;
+void init_pedals() {
+    for (int i = 0 ; i < PEDAL_PINS ; i++) {
+        pd[i].buffer[FOOTSWITCH1P_REPORT_ID] = REPORT_SET_CODE;
+        pd[i].buffer[FOOTSWITCH1P_PIN] = i;
+    }
+}
+
+void set_pin(const char *arg) {
+    char *end = NULL;
+    long pin = strtol(arg, &end, 10);
+
+    if (*arg == 0 || *end != 0 || pin < 0 || pin >= PEDAL_PINS) {
+        fprintf(stderr, "Invalid pin '%s'\n", arg);
+        exit(1);
+    }
+    curr_pin = pin;
 }
 
 void deinit() {
-    hid_close(dev);
+    close_device(dev);
     hid_exit();
 }
 
-void usb_write(pedal_data_t *pd) {
-    int r = hid_write(dev, pd->buffer, sizeof(pd->buffer));
-    if (r < 0) {
-        fatal("error writing data (%ls)", hid_error(dev));
+bool usb_write(pedal_data_t *pd) {
+    int r = xfer_write(dev, pd->buffer, sizeof(pd->buffer));
+    if (r == XFER_PERMANENT) {
+        fatal("error writing data (%ls)", xfer_error(dev));
     }
     usleep(30 * 1000);
+    return r >= 0;
+}
+
+bool query(pedal_data_t *request, pedal_data_t *response) {
+    xfer_drain(dev);
+    if (!usb_write(request)) {
+        return false;
+    }
+    int r = xfer_read(dev, response->buffer, sizeof(response->buffer));
+    if (r == XFER_PERMANENT) {
+        fatal("error reading data (%ls)", xfer_error(dev));
+    }
+    return r > 0;
+}
+
+bool query_device_id(void *arg) {
+    pedal_data_t request = { .buffer = { REPORT_DEVICE_ID, 0x00, 0x00, 0x22 } };
+
+    return query(&request, arg);
+}
+
+bool query_pin(int pin, pedal_data_t *response) {
+    pedal_data_t request = { .buffer = { REPORT_GET_CODE, pin } };
+
+    return query(&request, response) &&
+        response->buffer[FOOTSWITCH1P_REPORT_ID] == REPORT_GET_CODE &&
+        response->buffer[FOOTSWITCH1P_PIN] == pin;
+}
+
+// Fetches the configuration of all pins
+bool query_pins(pedal_data_t responses[PEDAL_PINS]) {
+    for (int i = 0 ; i < PEDAL_PINS ; i++) {
+        if (!query_pin(i, &responses[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+#define DESCRIPTION_SIZE 128
+
+// The decoders append a pin, in the layout used both for programming and for reading back, to out
+void describe_key(const unsigned char data[], char *out) {
+    static const char *names[] = {
+        "l_ctrl", "l_shift", "l_alt", "l_win", "r_ctrl", "r_shift", "r_alt", "r_win"
+    };
+    const char *sep = "";
+
+    for (int i = 0 ; i < 8 ; i++) {
+        if ((data[FOOTSWITCH1P_MOD] & (1 << i)) != 0) {
+            strcat(out, sep);
+            strcat(out, names[i]);
+            sep = "+";
+        }
+    }
+    if (data[FOOTSWITCH1P_KEY] != 0) {
+        strcat(out, sep);
+        strcat(out, decode_byte(data[FOOTSWITCH1P_KEY]));
+    }
+}
+
+void describe_mouse(const unsigned char data[], char *out) {
+    switch (data[FOOTSWITCH1P_BUTTON] & ~0x8) {
+        case MOUSE_LEFT:
+            strcat(out, "mouse_left ");
+            break;
+        case MOUSE_RIGHT:
+            strcat(out, "mouse_right ");
+            break;
+        case MOUSE_MIDDLE:
+            strcat(out, "mouse_middle ");
+            break;
+    }
+    layout_format(LAYOUT_FIELD(FOOTSWITCH1P, X), 3, data, out, DESCRIPTION_SIZE);
+}
+
+void describe_pin(const unsigned char data[], char out[DESCRIPTION_SIZE]) {
+    out[0] = 0;
+    switch (data[FOOTSWITCH1P_COMMAND]) {
+        case COMMAND_KEYBOARD:
+            describe_key(data, out);
+            break;
+        case COMMAND_MOUSE:
+            describe_mouse(data, out);
+            break;
+        case 0:
+            break;
+        default:
+            snprintf(out, DESCRIPTION_SIZE, "command=0x%02x size=%d", data[FOOTSWITCH1P_COMMAND], data[FOOTSWITCH1P_LENGTH]);
+            break;
+    }
+}
+
+void print_pin(const pedal_data_t *response) {
+    char text[DESCRIPTION_SIZE];
+
+    describe_pin(response->buffer, text);
+    printf("[pin %d]: %s\n", response->buffer[FOOTSWITCH1P_PIN], text);
 }
 
 void read_pedals() {
     pedal_data_t response = { .buffer = { 0 } };
+    pedal_data_t responses[PEDAL_PINS] = { 0 };
 
-    pd.report_id = REPORT_DEVICE_ID,
-    pd.pin = 0x00;
-    pd.command = 0x00;
-    pd.size = 0x22;
-
-    usb_write(&pd);
-    int r = hid_read(dev, response.buffer, sizeof(response.buffer));
-    if (r < 0) {
-        fatal("error reading data (%ls)", hid_error(dev));
+    if (!xfer_sequence(query_device_id, &response)) {
+        fatal("error reading data (%ls)", xfer_error(dev));
     }
 
-    if (response.report_id == REPORT_DEVICE_ID) {
-        printf("Device ID: %" PRIu64 "\n" , *(uint64_t*)&response.data);
+    if (response.buffer[FOOTSWITCH1P_REPORT_ID] == REPORT_DEVICE_ID) {
+        uint64_t id;
+        memcpy(&id, &response.buffer[FOOTSWITCH1P_DEVICE_ID], sizeof(id));
+        printf("Device ID: %" PRIu64 "\n" , id);
     } else {
         fprintf(stderr, "Unknown response:\n");
     }
+
+    if (!read_pins) {
+        return;
+    }
+    // a single attempt, firmware which doesn't know the query never answers it
+    if (!query_pins(responses)) {
+        fprintf(stderr, "Cannot read the pin configuration, the firmware may not support it\n");
+        return;
+    }
+    for (int i = 0 ; i < PEDAL_PINS ; i++) {
+        print_pin(&responses[i]);
+    }
 }
 
 void compile_key(const char *key) {
@@ -149,9 +258,9 @@ void compile_key(const char *key) {
         exit(1);
     }
 
-    pd.command = 0x80;
-    pd.size = 0x08;
-    pd.data[2] = b;
+    pd[curr_pin].buffer[FOOTSWITCH1P_COMMAND] = COMMAND_KEYBOARD;
+    pd[curr_pin].buffer[FOOTSWITCH1P_LENGTH] = 0x08;
+    pd[curr_pin].buffer[FOOTSWITCH1P_KEY] = b;
 }
 
 void compile_modifier(const char *mod_str) {
@@ -162,9 +271,9 @@ void compile_modifier(const char *mod_str) {
         exit(1);
     }
 
-    pd.command = 0x80;
-    pd.size = 0x08;
-    pd.data[0] |= mod;
+    pd[curr_pin].buffer[FOOTSWITCH1P_COMMAND] = COMMAND_KEYBOARD;
+    pd[curr_pin].buffer[FOOTSWITCH1P_LENGTH] = 0x08;
+    pd[curr_pin].buffer[FOOTSWITCH1P_MOD] |= mod;
 }
 
 void compile_mouse_button(const char *btn_str) {
@@ -175,81 +284,180 @@ void compile_mouse_button(const char *btn_str) {
         exit(1);
     }
 
-    pd.command = 0x02;
-    pd.size = 0x04;
-    pd.data[0] |= (btn | 0x8);
+    pd[curr_pin].buffer[FOOTSWITCH1P_COMMAND] = COMMAND_MOUSE;
+    pd[curr_pin].buffer[FOOTSWITCH1P_LENGTH] = 0x04;
+    pd[curr_pin].buffer[FOOTSWITCH1P_BUTTON] |= (btn | 0x8);
+}
+
+void compile_combo(const char *expr) {
+    combo c;
+    char err[128];
+
+    if (parse_combos(expr, &c, 1, err, sizeof(err)) < 0) {
+        fprintf(stderr, "%s\n", err);
+        exit(1);
+    }
+    if (c.key_count > 1 || (c.buttons != 0 && (c.key_count != 0 || c.modifiers != 0))) {
+        fprintf(stderr, "You cannot mix -km options with -bxyw options for the same pin.\n");
+        exit(1);
+    }
+    if (c.buttons != 0) {
+        pd[curr_pin].buffer[FOOTSWITCH1P_COMMAND] = COMMAND_MOUSE;
+        pd[curr_pin].buffer[FOOTSWITCH1P_LENGTH] = 0x04;
+        pd[curr_pin].buffer[FOOTSWITCH1P_BUTTON] |= (c.buttons | 0x8);
+        return;
+    }
+    pd[curr_pin].buffer[FOOTSWITCH1P_COMMAND] = COMMAND_KEYBOARD;
+    pd[curr_pin].buffer[FOOTSWITCH1P_LENGTH] = 0x08;
+    pd[curr_pin].buffer[FOOTSWITCH1P_MOD] |= c.modifiers;
+    if (c.key_count > 0) {
+        pd[curr_pin].buffer[FOOTSWITCH1P_KEY] = c.keys[0];
+    }
+}
+
+void compile_mouse_field(const char *arg, int opt, const layout_field *f) {
+    if (!layout_encode(f, pd[curr_pin].buffer, atoi(arg))) {
+        fprintf(stderr, "'%c' must be in [%d, %d]\n", opt, f->min, f->max);
+        exit(1);
+    }
 }
 
 void compile_mouse_xyw(const char *mx, const char *my, const char *mw) {
 
-    pd.command = 0x02;
-    pd.size = 0x04;
-    pd.data[0] |= 0x8;
+    pd[curr_pin].buffer[FOOTSWITCH1P_COMMAND] = COMMAND_MOUSE;
+    pd[curr_pin].buffer[FOOTSWITCH1P_LENGTH] = 0x04;
+    pd[curr_pin].buffer[FOOTSWITCH1P_BUTTON] |= 0x8;
 
     if (mx) {
-        int x = atoi(mx);
-        if (x < -128 || x > 127) {
-            fprintf(stderr, "'x' must be in [-128, 127]\n");
-            exit(1);
-        }
-
-        pd.data[1] = -x;
+        compile_mouse_field(mx, 'x', LAYOUT_FIELD(FOOTSWITCH1P, X));
     }
     if (my) {
-        int y = atoi(my);
-        if (y < -128 || y > 127) {
-            fprintf(stderr, "'y' must be in [-128, 127]\n");
-            exit(1);
+        compile_mouse_field(my, 'y', LAYOUT_FIELD(FOOTSWITCH1P, Y));
+    }
+    if (mw) {
+        compile_mouse_field(mw, 'w', LAYOUT_FIELD(FOOTSWITCH1P, W));
+    }
+}
+
+void build_plan(plan *p) {
+    for (int i = 0 ; i < PEDAL_PINS ; i++) {
+        if ((written_pins & (1u << i)) != 0) {
+            plan_add(p, PACKET_OUTPUT, pd[i].buffer, sizeof(pd[i].buffer), 30 * 1000, PACKET_COMMIT);
         }
+    }
+}
 
-        pd.data[2] = -y;
+// The response carries the pin as it has been programmed, after the report ID
+bool pin_matches(const unsigned char data[], const unsigned char response[]) {
+    int len = FOOTSWITCH1P_LENGTH + 1 + data[FOOTSWITCH1P_LENGTH];
+
+    if (len > FOOTSWITCH1P_SIZE) {
+        len = FOOTSWITCH1P_SIZE;
     }
-    if (mw) {
-        int w = atoi(mw);
-        if (w < -128 || w > 127) {
-            fprintf(stderr, "'w' must be in [-128, 127]\n");
-            exit(1);
+    return memcmp(&response[FOOTSWITCH1P_PIN], &data[FOOTSWITCH1P_PIN], len - FOOTSWITCH1P_PIN) == 0;
+}
+
+/**
+ * Reads back only the pins which a plan has programmed (each packet is one
+ * pin) and sends the ones which differ from it again, up to VERIFY_ATTEMPTS
+ * times.
+ */
+void verify_plan(const plan *p) {
+    char want[DESCRIPTION_SIZE], got[DESCRIPTION_SIZE];
+    int *resend = calloc(p->count, sizeof(int));
+    bool *verified = calloc(p->count, sizeof(bool));
+    pedal_data_t response;
+    int pin;
+
+    if (resend == NULL || verified == NULL) {
+        fatal("Not enough memory");
+    }
+    for (int attempt = 0 ; ; attempt++) {
+        uint64_t start = metrics_now();
+        plan retry = {0};
+        int count = 0;
+
+        for (int i = 0 ; i < p->count ; i++) {
+            const unsigned char *data = p->packets[i].data;
+            if (verified[i] || data[FOOTSWITCH1P_REPORT_ID] != REPORT_SET_CODE) {
+                continue;
+            }
+            pin = data[FOOTSWITCH1P_PIN];
+            if (!query_pin(pin, &response)) {
+                fatal("Cannot read pin %d back, the firmware may not support it", pin);
+            }
+            if (pin_matches(data, response.buffer)) {
+                verified[i] = true;
+                continue;
+            }
+            describe_pin(data, want);
+            describe_pin(response.buffer, got);
+            fprintf(stderr, "Pin %d reads back as '%s' instead of '%s'\n", pin, got, want);
+            resend[count++] = i;
+        }
+        metrics_observe(METRIC_READBACK, start);
+        if (count == 0) {
+            break;
         }
-        w = w < 0 ? 256 + w : w;
-        pd.data[3] = w;
+        if (attempt == VERIFY_ATTEMPTS) {
+            fatal("%d pin(s) don't verify after %d attempts", count, VERIFY_ATTEMPTS);
+        }
+        metrics_add(METRIC_MISMATCHES, count);
+        plan_add_units(&retry, p, resend, count);
+        if (!plan_run(dev, &retry)) {
+            fatal("error writing data (%ls)", xfer_error(dev));
+        }
+        plan_free(&retry);
+    }
+    free(resend);
+    free(verified);
+}
+
+void run_plan(const plan *p) {
+    if (!plan_run(dev, p)) {
+        fatal("error writing data (%ls)", xfer_error(dev));
+    }
+    if (verify_after_write) {
+        verify_plan(p);
     }
 }
 
 void write_pedals() {
-    /*
-    printf("start: \n");
-    printf("pedal header: \n");
-    printf("report id: %02x\n", pd.report_id);
-    printf("pin: %02x\n", pd.pin);
-    printf("command: %02x\n", pd.command);
-    printf("data size: %02x\n", pd.size);
-    printf("pedal data: ");
-    debug_arr(pd.data, pd.size);
-    */
-
-    usb_write(&pd);
+    plan p = {0};
+
+    build_plan(&p);
+    run_plan(&p);
+    plan_free(&p);
 }
 
 int main(int argc, char *argv[]) {
+    enum {
+        OPT_READ_PINS = OPT_DEVICE_END,
+    };
+    static const struct option long_options[] = {
+        DEVICE_LONG_OPTIONS,
+        {"read-pins", no_argument, NULL, OPT_READ_PINS},
+        {NULL, 0, NULL, 0}
+    };
+    bool read = false, write = false;
     int opt;
 
-    if (argc == 1) {
-        usage();
-    }
-
-    if (argc == 2 && strcmp(argv[1], "-r") == 0) {
-        init();
-        read_pedals();
-        deinit();
-        return 0;
-    }
-
-    init_pedal();
-    while ((opt = getopt(argc, argv, "rk:m:b:x:y:w:")) != -1) {
+    init_pedals();
+    while ((opt = getopt_long(argc, argv, "rp:k:m:b:c:x:y:w:o:", long_options, NULL)) != -1) {
+        if (opt != 'r' && opt != 'p' && opt != OPT_READ_PINS && !is_device_option(opt)) {
+            write = true;
+            written_pins |= 1u << curr_pin;
+        }
         switch (opt) {
             case 'r':
-                fprintf(stderr, "Cannot use -r with other options\n");
-                return 1;
+                read = true;
+                break;
+            case 'p':
+                set_pin(optarg);
+                break;
+            case OPT_READ_PINS:
+                read_pins = true;
+                break;
             case 'k':
                 compile_key(optarg);
                 break;
@@ -259,6 +467,9 @@ int main(int argc, char *argv[]) {
             case 'b':
                 compile_mouse_button(optarg);
                 break;
+            case 'c':
+                compile_combo(optarg);
+                break;
             case 'x':
                 compile_mouse_xyw(optarg, NULL, NULL);
                 break;
@@ -269,13 +480,37 @@ int main(int argc, char *argv[]) {
                 compile_mouse_xyw(NULL, NULL, optarg);
                 break;
             default:
-                usage();
+                if (!parse_device_option(opt, optarg)) {
+                    usage();
+                }
                 break;
         }
     }
+    if (optind < argc || (!read && !write && !compile_only && !flash_path && !db_path) ||
+            !image_options_valid(write, read)) {
+        usage();
+    }
+    if (read && write) {
+        fprintf(stderr, "Cannot use -r with other options\n");
+        return 1;
+    }
+    if (verify_after_write && !read_pins) {
+        fprintf(stderr, "--verify needs --read-pins, the pin readback isn't confirmed to work on real devices\n");
+        return 1;
+    }
+    const image_tool tool = {"footswitch1p", build_plan, init, run_plan, deinit};
+    if (run_image_options(&tool)) {
+        return 0;
+    }
 
     init();
-    write_pedals();
+    if (read) {
+        uint64_t start = metrics_now();
+        read_pedals();
+        metrics_observe(METRIC_READBACK, start);
+    } else {
+        write_pedals();
+    }
     deinit();
 
     return 0;
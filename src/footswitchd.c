@@ -0,0 +1,564 @@
+/*
+Copyright (c) 2012 Radoslav Gerganov <rgerganov@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <libgen.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/inotify.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <linux/netlink.h>
+#include "hidraw.h"
+#include "layout.h"
+#include "metrics.h"
+#include "transfer.h"
+
+/**
+ * Applies the profiles stored in a database (see footswitch-db) to the
+ * devices which are plugged in. The hidraw devices are announced by udev
+ * on netlink; without udev (e.g. in containers) /dev is watched with
+ * inotify instead. Each device is programmed by running its tool with
+ * --db, pinned to the device with --port, and the time from plug-in (the
+ * add event of the USB device) to the end of programming is logged.
+ *
+ * Every tool runs with a watchdog on its transfers and under a deadline of
+ * its own. A tool whose device stops responding is killed, the device is
+ * reset on its USB port (by a child, so that the other devices are not held
+ * up) and programmed again once it is back.
+ */
+
+#define UDEV_GROUP 2
+#define UDEV_MAGIC 0xfeedcafe
+// A device is handled once per plug-in even if it has several interfaces
+#define DEDUPE_US (3 * 1000000ULL)
+#define MAX_PORTS 64
+// A tool which takes longer than this is killed, even if its watchdog hasn't fired
+#define DEADLINE_US (60 * 1000000ULL)
+// How long a reset device may take to come back before it is programmed anyway
+#define RECOVERY_WAIT_US (3 * 1000000ULL)
+// Recoveries of one plug-in before giving up on the device
+#define MAX_RECOVERIES 3
+
+typedef struct model
+{
+    const char *name;
+    int interface;          // the interface which the tool opens, -1 for any
+    bool reset;             // the device applies a configuration only after a replug
+    const unsigned short (*ids)[2];
+    size_t count;
+} model;
+
+// A USB port which has seen a device being plugged in or programmed
+typedef struct port
+{
+    char name[32];
+    uint64_t plugged_us;
+    uint64_t handled_us;
+    pid_t pid;              // the tool which is programming the device, or resetting it
+    const model *model;
+    uint64_t deadline_us;   // when the tool is killed as hung
+    bool killed;            // by the deadline
+    bool resetting;         // pid is resetting the device
+    uint64_t hung_us;       // when the current recovery has started, 0 if none
+    uint64_t retry_us;      // when the device is programmed again if it hasn't come back by then
+    int recoveries;         // of the current plug-in
+} port;
+
+static const unsigned short footswitch_ids[][2] = { FOOTSWITCH_DEVICES(LAYOUT_VID_PID) };
+static const unsigned short scythe_ids[][2] = { SCYTHE_DEVICES(LAYOUT_VID_PID) };
+static const unsigned short scythe2_ids[][2] = { SCYTHE2_DEVICES(LAYOUT_VID_PID) };
+static const unsigned short footswitch1p_ids[][2] = { FOOTSWITCH1P_DEVICES(LAYOUT_VID_PID) };
+
+#define MODEL(name, interface, reset) {#name, interface, reset, name##_ids, sizeof(name##_ids) / sizeof(name##_ids[0])}
+
+static const model models[] = {
+    MODEL(footswitch, 1, false),
+    MODEL(scythe, -1, true),
+    MODEL(scythe2, -1, true),
+    MODEL(footswitch1p, 3, false),
+};
+
+static port ports[MAX_PORTS];
+static const char *db = NULL;
+static char bindir[PATH_MAX];
+static bool verbose = false;
+static int watchdog_ms = 5000;
+
+void usage() {
+    fprintf(stderr, "Usage: footswitchd -d db [-b dir] [-m socket] [-w ms] [-i] [-n] [-v]\n"
+        "   -d db     - the profile database built with footswitch-db\n"
+        "   -b dir    - where the tools are (default: the directory of footswitchd)\n"
+        "   -m socket - serve metrics in the Prometheus text format on this Unix socket\n"
+        "   -w ms     - recover a device whose transfer hangs for ms milliseconds (default 5000)\n"
+        "   -i        - watch /dev with inotify instead of using udev events\n"
+        "   -n        - don't program the devices which are already plugged in\n"
+        "   -v        - log every event\n");
+    exit(1);
+}
+
+static const model *find_model(unsigned short vid, unsigned short pid) {
+    for (size_t i = 0 ; i < sizeof(models) / sizeof(models[0]) ; i++) {
+        for (size_t j = 0 ; j < models[i].count ; j++) {
+            if (models[i].ids[j][0] == vid && models[i].ids[j][1] == pid) {
+                return &models[i];
+            }
+        }
+    }
+    return NULL;
+}
+
+// Finds the port, or reuses the least recently used one
+static port *get_port(const char *name) {
+    port *lru = &ports[0];
+
+    for (int i = 0 ; i < MAX_PORTS ; i++) {
+        if (strcmp(ports[i].name, name) == 0) {
+            return &ports[i];
+        }
+        if (ports[i].pid == 0 && ports[i].retry_us == 0 && ports[i].plugged_us < lru->plugged_us) {
+            lru = &ports[i];
+        }
+    }
+    memset(lru, 0, sizeof(*lru));
+    snprintf(lru->name, sizeof(lru->name), "%s", name);
+    return lru;
+}
+
+static void usb_added(const char *devpath, uint64_t now) {
+    const char *name = strrchr(devpath, '/');
+
+    port *p = NULL;
+
+    if (name == NULL) {
+        return;
+    }
+    p = get_port(name + 1);
+    // a tool which resets its device with --reset is not a new plug-in
+    if (p->pid != 0 && !p->resetting) {
+        return;
+    }
+    p->plugged_us = now;
+    if (verbose) {
+        printf("%s: plugged in\n", name + 1);
+    }
+}
+
+static void program(port *p, const model *m) {
+    char tool[PATH_MAX + 16], watchdog[16];
+    pid_t pid = 0;
+
+    snprintf(tool, sizeof(tool), "%s/%s", bindir, m->name);
+    snprintf(watchdog, sizeof(watchdog), "%d", watchdog_ms);
+    pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return;
+    }
+    if (pid == 0) {
+        char *argv[14] = {tool, "--backend", "hidraw", "--port", p->name, "--db", (char *) db,
+                          "--lock-timeout", "10000"};
+        int argc = 9;
+        sigset_t mask;
+        sigemptyset(&mask);
+        sigprocmask(SIG_SETMASK, &mask, NULL);
+        if (watchdog_ms > 0) {
+            argv[argc++] = "--watchdog";
+            argv[argc++] = watchdog;
+        }
+        // otherwise the profile would stay inactive until the next replug
+        if (m->reset) {
+            argv[argc++] = "--reset";
+        }
+        execv(tool, argv);
+        perror(tool);
+        _exit(127);
+    }
+    p->pid = pid;
+    p->model = m;
+    p->deadline_us = metrics_now() + DEADLINE_US;
+    p->killed = false;
+}
+
+// Resets the device in a child, a reset can take a while
+static void reset_port(port *p) {
+    pid_t pid = fork();
+
+    if (pid < 0) {
+        perror("fork");
+        return;
+    }
+    if (pid == 0) {
+        _exit(hidraw_reset_port(p->name) ? 0 : 1);
+    }
+    p->pid = pid;
+    p->resetting = true;
+}
+
+static void recover(port *p, uint64_t now) {
+    if (p->recoveries == MAX_RECOVERIES) {
+        metrics_add(METRIC_FAILURES, 1);
+        fprintf(stderr, "%s: %s still doesn't respond after %d recoveries, giving up\n",
+                p->name, p->model->name, MAX_RECOVERIES);
+        p->hung_us = 0;
+        return;
+    }
+    if (p->hung_us == 0) {
+        p->hung_us = now;
+    }
+    p->recoveries++;
+    metrics_add(METRIC_RECOVERIES, 1);
+    fprintf(stderr, "%s: %s has stopped responding, resetting it\n", p->name, p->model->name);
+    reset_port(p);
+}
+
+static void hidraw_added(const char *path, uint64_t now) {
+    struct hid_device_info *info = hidraw_enumerate(0, 0), *ptr = NULL;
+    char location[64];
+    const model *m = NULL;
+    port *p = NULL;
+
+    for (ptr = info ; ptr != NULL ; ptr = ptr->next) {
+        if (strcmp(ptr->path, path) == 0) {
+            break;
+        }
+    }
+    if (ptr == NULL || (m = find_model(ptr->vendor_id, ptr->product_id)) == NULL ||
+            (m->interface >= 0 && ptr->interface_number != m->interface) ||
+            !hidraw_location(path, location, sizeof(location))) {
+        hidraw_free_enumeration(info);
+        return;
+    }
+    location[strcspn(location, ":")] = 0;
+    p = get_port(location);
+    if (verbose) {
+        printf("%s: %s %04x:%04x at %s\n", p->name, m->name, ptr->vendor_id, ptr->product_id, path);
+    }
+    hidraw_free_enumeration(info);
+    metrics_add(METRIC_EVENTS, 1);
+    if (p->pid != 0) {
+        return;
+    }
+    if (p->retry_us != 0) {
+        // back after a reset
+        p->retry_us = 0;
+        program(p, m);
+        return;
+    }
+    if (p->handled_us != 0 && now - p->handled_us < DEDUPE_US) {
+        return;
+    }
+    p->recoveries = 0;
+    p->hung_us = 0;
+    if (p->plugged_us == 0 || now - p->plugged_us > DEDUPE_US) {
+        // missed the USB event (inotify or already plugged in)
+        p->plugged_us = now;
+    }
+    p->handled_us = now;
+    program(p, m);
+}
+
+static void reap(uint64_t now) {
+    int status = 0;
+    pid_t pid = 0;
+
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+        for (int i = 0 ; i < MAX_PORTS ; i++) {
+            port *p = &ports[i];
+            if (p->pid != pid) {
+                continue;
+            }
+            p->pid = 0;
+            p->handled_us = now;
+            if (p->resetting) {
+                // the device is programmed when it comes back, or when it hasn't in a while
+                p->resetting = false;
+                p->retry_us = now + RECOVERY_WAIT_US;
+            } else if (p->killed || (WIFEXITED(status) && WEXITSTATUS(status) == XFER_HUNG_EXIT)) {
+                recover(p, now);
+            } else if (WIFEXITED(status) && WEXITSTATUS(status) == 0 && p->hung_us != 0) {
+                metrics_observe(METRIC_RECOVERY, p->hung_us);
+                printf("%s: %s recovered after %.1f ms and %d reset(s)\n", p->name, p->model->name,
+                       (now - p->hung_us) / 1000.0, p->recoveries);
+                p->hung_us = 0;
+            } else if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+                metrics_observe(METRIC_PLUG_TO_READY, p->plugged_us);
+                printf("%s: %s ready %.1f ms after plug-in\n", p->name, p->model->name, (now - p->plugged_us) / 1000.0);
+            } else {
+                metrics_add(METRIC_FAILURES, 1);
+                fprintf(stderr, "%s: %s failed with status %d\n", p->name, p->model->name,
+                        WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status));
+            }
+            fflush(stdout);
+        }
+    }
+}
+
+// udev messages have a header which points to the properties, kernel
+// messages start with "<action>@<devpath>"
+static void handle_uevent(int fd) {
+    char buf[8192], *props = NULL, *end = NULL;
+    const char *action = "", *subsystem = "", *devtype = "", *devname = "", *devpath = "";
+    ssize_t len = recv(fd, buf, sizeof(buf) - 1, 0);
+    uint64_t now = metrics_now();
+
+    if (len <= 0) {
+        return;
+    }
+    buf[len] = 0;
+    end = buf + len;
+    if (len >= 40 && strcmp(buf, "libudev") == 0) {
+        uint32_t magic, off;
+        memcpy(&magic, buf + 8, 4);
+        memcpy(&off, buf + 16, 4);
+        if (ntohl(magic) != UDEV_MAGIC || off >= len) {
+            return;
+        }
+        props = buf + off;
+    } else {
+        props = buf + strlen(buf) + 1;
+    }
+    for (char *p = props ; p < end ; p += strlen(p) + 1) {
+        if (strncmp(p, "ACTION=", 7) == 0) {
+            action = p + 7;
+        } else if (strncmp(p, "SUBSYSTEM=", 10) == 0) {
+            subsystem = p + 10;
+        } else if (strncmp(p, "DEVTYPE=", 8) == 0) {
+            devtype = p + 8;
+        } else if (strncmp(p, "DEVNAME=", 8) == 0) {
+            devname = p + 8;
+        } else if (strncmp(p, "DEVPATH=", 8) == 0) {
+            devpath = p + 8;
+        }
+    }
+    if (strcmp(action, "add") != 0) {
+        return;
+    }
+    if (strcmp(subsystem, "usb") == 0 && strcmp(devtype, "usb_device") == 0) {
+        usb_added(devpath, now);
+    } else if (strcmp(subsystem, "hidraw") == 0 && *devname) {
+        char path[PATH_MAX];
+        // the kernel sends the name without /dev
+        snprintf(path, sizeof(path), "%s%s", devname[0] == '/' ? "" : "/dev/", devname);
+        hidraw_added(path, now);
+    }
+}
+
+static void handle_inotify(int fd) {
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t len = read(fd, buf, sizeof(buf));
+    uint64_t now = metrics_now();
+
+    for (char *p = buf ; len > 0 && p < buf + len ; ) {
+        struct inotify_event *ev = (struct inotify_event *) p;
+        if (ev->len > 0 && strncmp(ev->name, "hidraw", 6) == 0) {
+            char path[PATH_MAX];
+            snprintf(path, sizeof(path), "/dev/%s", ev->name);
+            // udev may still be setting up the permissions of the node
+            usleep(50000);
+            hidraw_added(path, now);
+        }
+        p += sizeof(struct inotify_event) + ev->len;
+    }
+}
+
+static int open_netlink() {
+    struct sockaddr_nl addr = {.nl_family = AF_NETLINK, .nl_groups = UDEV_GROUP};
+    int fd = -1;
+
+    // without udevd nobody sends to the udev group
+    if (access("/run/udev/control", F_OK) < 0) {
+        return -1;
+    }
+    fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT);
+    if (fd < 0) {
+        return -1;
+    }
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int open_inotify() {
+    int fd = inotify_init1(IN_CLOEXEC);
+
+    if (fd < 0 || inotify_add_watch(fd, "/dev", IN_CREATE) < 0) {
+        perror("inotify");
+        exit(1);
+    }
+    return fd;
+}
+
+// Kills the tools which are past their deadline and programs the devices
+// which haven't come back after a reset. Returns the poll timeout.
+static int check_deadlines(uint64_t now) {
+    uint64_t next = UINT64_MAX;
+
+    for (int i = 0 ; i < MAX_PORTS ; i++) {
+        port *p = &ports[i];
+        if (p->pid != 0 && !p->resetting && !p->killed) {
+            if (now >= p->deadline_us) {
+                fprintf(stderr, "%s: %s is past its deadline, killing it\n", p->name, p->model->name);
+                kill(p->pid, SIGKILL);
+                p->killed = true;
+            } else if (p->deadline_us < next) {
+                next = p->deadline_us;
+            }
+        }
+        if (p->pid == 0 && p->retry_us != 0) {
+            if (now >= p->retry_us) {
+                p->retry_us = 0;
+                program(p, p->model);
+                if (p->deadline_us < next) {
+                    next = p->deadline_us;
+                }
+            } else if (p->retry_us < next) {
+                next = p->retry_us;
+            }
+        }
+    }
+    return next == UINT64_MAX ? -1 : (int) ((next - now) / 1000 + 1);
+}
+
+static void coldplug() {
+    struct hid_device_info *info = hidraw_enumerate(0, 0);
+
+    for (struct hid_device_info *ptr = info ; ptr != NULL ; ptr = ptr->next) {
+        hidraw_added(ptr->path, metrics_now());
+    }
+    hidraw_free_enumeration(info);
+}
+
+int main(int argc, char *argv[]) {
+    const char *metrics_socket = NULL;
+    bool use_inotify = false, scan = true, netlink = false;
+    int events = -1, signals = -1, metrics = -1, opt;
+    char self[PATH_MAX];
+    ssize_t len = 0;
+    sigset_t mask;
+
+    while ((opt = getopt(argc, argv, "d:b:m:w:inv")) != -1) {
+        switch (opt) {
+            case 'd':
+                db = optarg;
+                break;
+            case 'b':
+                snprintf(bindir, sizeof(bindir), "%s", optarg);
+                break;
+            case 'm':
+                metrics_socket = optarg;
+                break;
+            case 'w':
+                watchdog_ms = atoi(optarg);
+                break;
+            case 'i':
+                use_inotify = true;
+                break;
+            case 'n':
+                scan = false;
+                break;
+            case 'v':
+                verbose = true;
+                break;
+            default:
+                usage();
+        }
+    }
+    if (optind < argc || db == NULL || watchdog_ms < 0) {
+        usage();
+    }
+    if (bindir[0] == 0) {
+        if ((len = readlink("/proc/self/exe", self, sizeof(self) - 1)) < 0) {
+            perror("/proc/self/exe");
+            return 1;
+        }
+        self[len] = 0;
+        snprintf(bindir, sizeof(bindir), "%s", dirname(self));
+    }
+    if (metrics_socket != NULL && (metrics = metrics_listen(metrics_socket)) < 0) {
+        perror(metrics_socket);
+        return 1;
+    }
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    sigprocmask(SIG_BLOCK, &mask, NULL);
+    signals = signalfd(-1, &mask, SFD_CLOEXEC);
+    if (!use_inotify) {
+        events = open_netlink();
+        netlink = events >= 0;
+    }
+    if (events < 0) {
+        events = open_inotify();
+    }
+    printf("Watching for devices with %s\n", netlink ? "udev events" : "inotify");
+    fflush(stdout);
+    if (scan) {
+        coldplug();
+    }
+    for (;;) {
+        struct pollfd fds[3] = {
+            {events, POLLIN, 0},
+            {signals, POLLIN, 0},
+            {metrics, POLLIN, 0},
+        };
+        if (poll(fds, metrics >= 0 ? 3 : 2, check_deadlines(metrics_now())) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("poll");
+            break;
+        }
+        if (fds[0].revents & POLLIN) {
+            if (netlink) {
+                handle_uevent(events);
+            } else {
+                handle_inotify(events);
+            }
+        }
+        if (fds[1].revents & POLLIN) {
+            struct signalfd_siginfo si;
+            if (read(signals, &si, sizeof(si)) == sizeof(si) && si.ssi_signo != SIGCHLD) {
+                break;
+            }
+            reap(metrics_now());
+        }
+        if (metrics >= 0 && (fds[2].revents & POLLIN)) {
+            metrics_serve(metrics);
+        }
+    }
+    if (metrics_socket != NULL) {
+        unlink(metrics_socket);
+    }
+    return 0;
+}
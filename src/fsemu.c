@@ -0,0 +1,448 @@
+/*
+Copyright (c) 2012 Radoslav Gerganov <rgerganov@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+#include <linux/uhid.h>
+#include "layout.h"
+#include "vdev.h"
+
+/**
+ * Emulates the supported devices with /dev/uhid, so the tools (built with
+ * the hidraw backend of hidapi) can be run and timed without hardware.
+ * Each model gets a configuration device, which implements the programming
+ * protocol, and a keyboard device which injects pedal presses.
+ */
+
+typedef struct model
+{
+    const char *name;
+    unsigned short vid, pid;
+    const uint8_t *rdesc;
+    size_t rdesc_size;
+    void (*output)(const uint8_t *data, size_t len);
+    void (*set_report)(const uint8_t *data, size_t len);
+    size_t (*get_report)(uint8_t rnum, uint8_t *data);
+} model;
+
+static vdev config = {-1}, keyboard = {-1};
+static bool verbose = false;
+static volatile sig_atomic_t stop = 0;
+static unsigned long received = 0, sent = 0, presses = 0;
+static uint8_t press_mod = 0, press_key = 0x04;    // 'a'
+
+// vendor defined 8 byte input and output reports, no report IDs
+static const uint8_t footswitch_rdesc[] = {
+    0x06, 0x00, 0xff, 0x09, 0x01, 0xa1, 0x01, 0x15, 0x00, 0x26, 0xff, 0x00, 0x75, 0x08,
+    0x95, 0x08, 0x09, 0x01, 0x81, 0x02,
+    0x95, 0x08, 0x09, 0x01, 0x91, 0x02,
+    0xc0,
+};
+
+// vendor defined feature report 6 with 7 bytes
+static const uint8_t scythe_rdesc[] = {
+    0x06, 0x00, 0xff, 0x09, 0x01, 0xa1, 0x01, 0x15, 0x00, 0x26, 0xff, 0x00, 0x75, 0x08,
+    0x85, 0x06, 0x95, 0x07, 0x09, 0x01, 0xb1, 0x02,
+    0xc0,
+};
+
+// vendor defined feature report 5 with 0x47 bytes
+static const uint8_t scythe2_rdesc[] = {
+    0x06, 0x00, 0xff, 0x09, 0x01, 0xa1, 0x01, 0x15, 0x00, 0x26, 0xff, 0x00, 0x75, 0x08,
+    0x85, 0x05, 0x95, 0x47, 0x09, 0x01, 0xb1, 0x02,
+    0xc0,
+};
+
+// vendor defined output report 0x10 and input/output report 0x22, 63 bytes each
+static const uint8_t footswitch1p_rdesc[] = {
+    0x06, 0x00, 0xff, 0x09, 0x01, 0xa1, 0x01, 0x15, 0x00, 0x26, 0xff, 0x00, 0x75, 0x08,
+    0x85, 0x10, 0x95, 0x3f, 0x09, 0x01, 0x91, 0x02,
+    0x85, 0x22, 0x95, 0x3f, 0x09, 0x01, 0x81, 0x02, 0x09, 0x01, 0x91, 0x02,
+    0xc0,
+};
+
+static bool send_input(vdev *d, const uint8_t *data, size_t len) {
+    if (!vdev_input(d, data, len)) {
+        return false;
+    }
+    sent++;
+    return true;
+}
+
+static void dump(const char *what, const uint8_t *data, size_t len) {
+    if (!verbose) {
+        return;
+    }
+    printf("%s:", what);
+    for (size_t i = 0 ; i < len ; i++) {
+        printf(" %02x", data[i]);
+    }
+    printf("\n");
+}
+
+/*
+ * footswitch: 01 80 starts programming, 01 81 <len> <pedal> is followed by
+ * the pedal data in 8 byte packets, 01 82 08 <pedal> queries a pedal.
+ */
+static uint8_t fs_pedals[3][48];
+static int fs_curr = -1, fs_expect = 0, fs_got = 0;
+
+static void fs_init() {
+    for (int i = 0 ; i < 3 ; i++) {
+        fs_pedals[i][FOOTSWITCH_LEN] = 8;
+    }
+}
+
+static void fs_output(const uint8_t *data, size_t len) {
+    if (len < 8) {
+        return;
+    }
+    if (fs_curr >= 0) {
+        memcpy(&fs_pedals[fs_curr][fs_got * 8], data, 8);
+        if (++fs_got == fs_expect) {
+            fs_curr = -1;
+        }
+    } else if (data[0] == 0x01 && data[1] == 0x81 && data[3] >= 1 && data[3] <= 3 && data[2] <= 40) {
+        fs_curr = data[3] - 1;
+        fs_expect = (data[2] + 7) / 8;
+        fs_got = 0;
+        memset(fs_pedals[fs_curr], 0, sizeof(fs_pedals[fs_curr]));
+    } else if (data[0] == 0x01 && data[1] == 0x82 && data[3] >= 1 && data[3] <= 3) {
+        uint8_t *pedal = fs_pedals[data[3] - 1];
+        int count = pedal[FOOTSWITCH_TYPE] == 4 ? (pedal[FOOTSWITCH_LEN] + 7) / 8 : 1;
+        for (int i = 0 ; i < count ; i++) {
+            send_input(&config, &pedal[i * 8], 8);
+        }
+    }
+    // the first pedal is pressed
+    if (fs_pedals[0][FOOTSWITCH_TYPE] & 1) {
+        press_mod = fs_pedals[0][FOOTSWITCH_MOD];
+        press_key = fs_pedals[0][FOOTSWITCH_KEY];
+    }
+}
+
+/*
+ * scythe: a pedal is programmed with two feature reports, 06 bb <pedal>
+ * selects the pedal which is returned by the next get feature report.
+ */
+static uint8_t sc_responses[3][SCYTHE_RESPONSE_SIZE];
+static uint8_t sc_first[8];
+static int sc_query = 0, sc_pending = -1;
+
+static void sc_init() {
+    for (int i = 0 ; i < 3 ; i++) {
+        sc_responses[i][SCYTHE_RESPONSE_REPORT_ID] = 0x06;
+        sc_responses[i][SCYTHE_RESPONSE_MOD] = 0xff;
+    }
+}
+
+static void sc_set_report(const uint8_t *data, size_t len) {
+    if (len < 8) {
+        return;
+    }
+    if (sc_pending >= 0) {
+        uint8_t pedal[SCYTHE_SIZE] = {0};
+        uint8_t *resp = sc_responses[sc_pending];
+        memcpy(pedal, sc_first, 8);
+        memcpy(&pedal[8], data, 8);
+        memset(resp, 0, SCYTHE_RESPONSE_SIZE);
+        resp[SCYTHE_RESPONSE_REPORT_ID] = 0x06;
+        resp[SCYTHE_RESPONSE_MOD] = pedal[SCYTHE_MOD];
+        for (int i = 0 ; i < 5 ; i++) {
+            resp[SCYTHE_RESPONSE_fields[SCYTHE_RESPONSE_FIELD_KEY1 + i].offset] =
+                pedal[SCYTHE_fields[SCYTHE_FIELD_KEY1 + i].offset];
+        }
+        sc_pending = -1;
+    } else if (data[1] == 0xbb && data[2] >= 1 && data[2] <= 3) {
+        sc_query = data[2] - 1;
+    } else if (data[1] >= 1 && data[1] <= 3 && data[2] == 0x08) {
+        memcpy(sc_first, data, 8);
+        sc_pending = data[1] - 1;
+    }
+}
+
+static size_t sc_get_report(uint8_t rnum, uint8_t *data) {
+    memcpy(data, sc_responses[sc_query], SCYTHE_RESPONSE_SIZE);
+    return SCYTHE_RESPONSE_SIZE;
+}
+
+/*
+ * scythe2: the settings are written in chunks (command 0x26) and the first
+ * SCYTHE2_SIZE bytes are returned after command 0x5a.
+ */
+static uint8_t s2_settings[1024] = {
+    26, 0,
+    1, 0x10, 0xf0, 0x04, 1, 0x10, 0xf0, 0x04, 1, 0x10, 0xf0, 0x04,
+    1, 0x10, 0xf0, 0x04, 1, 0x10, 0xf0, 0x04, 1, 0x10, 0xf0, 0x04,
+};
+
+static void s2_set_report(const uint8_t *data, size_t len) {
+    if (len < SCYTHE2_SIZE || data[SCYTHE2_COMMAND] != 0x26) {
+        return;
+    }
+    int offset = data[SCYTHE2_OFFSET_HI] << 8 | data[SCYTHE2_OFFSET_LO];
+    int count = data[SCYTHE2_COUNT];
+    if (count <= SCYTHE2_SIZE - SCYTHE2_PAYLOAD && offset + count <= sizeof(s2_settings)) {
+        memcpy(&s2_settings[offset], &data[SCYTHE2_PAYLOAD], count);
+    }
+}
+
+static size_t s2_get_report(uint8_t rnum, uint8_t *data) {
+    memcpy(data, s2_settings, SCYTHE2_SIZE);
+    data[SCYTHE2_REPORT_ID] = 0x05;
+    return SCYTHE2_SIZE;
+}
+
+/*
+ * footswitch1p: report 0x10 sets the code of a pin, report 0x11 reads it
+ * back and report 0x22 queries the device ID. 0x11 is what footswitch1p
+ * --read-pins assumes, the real firmware may not answer it.
+ */
+#define FS1P_PINS 8
+
+static uint8_t fs1p_pins[FS1P_PINS][FOOTSWITCH1P_SIZE];
+
+static void fs1p_output(const uint8_t *data, size_t len) {
+    uint8_t resp[FOOTSWITCH1P_SIZE] = {0};
+    uint8_t pin = len > FOOTSWITCH1P_PIN ? data[FOOTSWITCH1P_PIN] : FS1P_PINS;
+
+    if (len > FOOTSWITCH1P_DEVICE_ID && data[FOOTSWITCH1P_REPORT_ID] == 0x22) {
+        uint64_t id = 0x2019;
+        resp[FOOTSWITCH1P_REPORT_ID] = 0x22;
+        memcpy(&resp[FOOTSWITCH1P_DEVICE_ID], &id, sizeof(id));
+        send_input(&config, resp, sizeof(resp));
+    } else if (pin < FS1P_PINS && data[FOOTSWITCH1P_REPORT_ID] == 0x10) {
+        memset(fs1p_pins[pin], 0, FOOTSWITCH1P_SIZE);
+        memcpy(fs1p_pins[pin], data, len < FOOTSWITCH1P_SIZE ? len : FOOTSWITCH1P_SIZE);
+    } else if (pin < FS1P_PINS && data[FOOTSWITCH1P_REPORT_ID] == 0x11) {
+        // pins which have never been written read back empty
+        memcpy(resp, fs1p_pins[pin], sizeof(resp));
+        resp[FOOTSWITCH1P_REPORT_ID] = 0x11;
+        resp[FOOTSWITCH1P_PIN] = pin;
+        send_input(&config, resp, sizeof(resp));
+    }
+}
+
+static const model models[] = {
+    {"footswitch", 0, 0, footswitch_rdesc, sizeof(footswitch_rdesc), fs_output, NULL, NULL},
+    {"scythe", 0, 0, scythe_rdesc, sizeof(scythe_rdesc), NULL, sc_set_report, sc_get_report},
+    {"scythe2", 0, 0, scythe2_rdesc, sizeof(scythe2_rdesc), NULL, s2_set_report, s2_get_report},
+    {"footswitch1p", 0, 0, footswitch1p_rdesc, sizeof(footswitch1p_rdesc), fs1p_output, NULL, NULL},
+};
+
+// The first VID:PID of each model
+static void default_ids(model *m) {
+    static const unsigned short footswitch[][2] = { FOOTSWITCH_DEVICES(LAYOUT_VID_PID) };
+    static const unsigned short scythe[][2] = { SCYTHE_DEVICES(LAYOUT_VID_PID) };
+    static const unsigned short scythe2[][2] = { SCYTHE2_DEVICES(LAYOUT_VID_PID) };
+    static const unsigned short footswitch1p[][2] = { FOOTSWITCH1P_DEVICES(LAYOUT_VID_PID) };
+    const unsigned short *ids = footswitch[0];
+
+    if (strcmp(m->name, "scythe") == 0) {
+        ids = scythe[0];
+    } else if (strcmp(m->name, "scythe2") == 0) {
+        ids = scythe2[0];
+    } else if (strcmp(m->name, "footswitch1p") == 0) {
+        ids = footswitch1p[0];
+    }
+    m->vid = ids[0];
+    m->pid = ids[1];
+}
+
+static void handle_event(vdev *d, const model *m) {
+    struct uhid_event ev, reply;
+    ssize_t r = read(d->fd, &ev, sizeof(ev));
+
+    if (r <= 0) {
+        return;
+    }
+    memset(&reply, 0, sizeof(reply));
+    switch (ev.type) {
+        case UHID_OUTPUT:
+            received++;
+            dump("output", ev.u.output.data, ev.u.output.size);
+            if (d == &config && m->output) {
+                m->output(ev.u.output.data, ev.u.output.size);
+            }
+            break;
+        case UHID_SET_REPORT:
+            received++;
+            dump("set feature", ev.u.set_report.data, ev.u.set_report.size);
+            if (d == &config && m->set_report) {
+                m->set_report(ev.u.set_report.data, ev.u.set_report.size);
+            }
+            reply.type = UHID_SET_REPORT_REPLY;
+            reply.u.set_report_reply.id = ev.u.set_report.id;
+            reply.u.set_report_reply.err = d == &config && m->set_report ? 0 : EIO;
+            if (write(d->fd, &reply, sizeof(reply)) < 0) {
+                perror("uhid");
+            }
+            break;
+        case UHID_GET_REPORT:
+            reply.type = UHID_GET_REPORT_REPLY;
+            reply.u.get_report_reply.id = ev.u.get_report.id;
+            if (d == &config && m->get_report) {
+                reply.u.get_report_reply.size = m->get_report(ev.u.get_report.rnum, reply.u.get_report_reply.data);
+                dump("get feature", reply.u.get_report_reply.data, reply.u.get_report_reply.size);
+                sent++;
+            } else {
+                reply.u.get_report_reply.err = EIO;
+            }
+            if (write(d->fd, &reply, sizeof(reply)) < 0) {
+                perror("uhid");
+            }
+            break;
+    }
+}
+
+static void on_signal(int sig) {
+    stop = 1;
+}
+
+void usage() {
+    fprintf(stderr, "Usage: fsemu [-m model] [-d vid:pid] [-r rate] [-v]\n"
+        "   -m model   - footswitch|scythe|scythe2|footswitch1p (default footswitch)\n"
+        "   -d vid:pid - use this VID:PID instead of the first one of the model\n"
+        "   -r rate    - press and release the first pedal rate times per second\n"
+        "   -v         - print the reports which are received\n");
+    exit(1);
+}
+
+int main(int argc, char *argv[]) {
+    model m = models[0];
+    unsigned int vid = 0, pid = 0;
+    double rate = 0;
+    int timer = -1, opt;
+    bool pressed = false;
+
+    while ((opt = getopt(argc, argv, "m:d:r:v")) != -1) {
+        switch (opt) {
+            case 'm': {
+                size_t i;
+                for (i = 0 ; i < sizeof(models) / sizeof(models[0]) ; i++) {
+                    if (strcmp(optarg, models[i].name) == 0) {
+                        break;
+                    }
+                }
+                if (i == sizeof(models) / sizeof(models[0])) {
+                    usage();
+                }
+                m = models[i];
+                break;
+            }
+            case 'd':
+                if (sscanf(optarg, "%x:%x", &vid, &pid) != 2) {
+                    usage();
+                }
+                break;
+            case 'r':
+                rate = atof(optarg);
+                break;
+            case 'v':
+                verbose = true;
+                break;
+            default:
+                usage();
+        }
+    }
+    if (optind < argc || rate < 0) {
+        usage();
+    }
+    default_ids(&m);
+    if (vid != 0) {
+        m.vid = vid;
+        m.pid = pid;
+    }
+    fs_init();
+    sc_init();
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    if (!vdev_create(&config, m.name, "config", m.vid, m.pid, m.rdesc, m.rdesc_size) ||
+            !vdev_create(&keyboard, m.name, "keyboard", m.vid, m.pid, vdev_keyboard_rdesc, vdev_keyboard_rdesc_size)) {
+        vdev_destroy(&config);
+        return 1;
+    }
+    if (rate > 0) {
+        // a press and a release per period
+        long period_ns = 1e9 / rate / 2;
+        struct itimerspec its = {{period_ns / 1000000000, period_ns % 1000000000},
+                                 {period_ns / 1000000000, period_ns % 1000000000}};
+        timer = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+        if (timer < 0 || timerfd_settime(timer, 0, &its, NULL) < 0) {
+            perror("timerfd");
+            stop = 1;
+        }
+    }
+    while (!stop) {
+        struct pollfd fds[3] = {
+            {config.fd, POLLIN, 0},
+            {keyboard.fd, POLLIN, 0},
+            {timer, POLLIN, 0},
+        };
+        if (poll(fds, timer >= 0 ? 3 : 2, config.path[0] && keyboard.path[0] ? -1 : 50) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("poll");
+            break;
+        }
+        if (fds[0].revents & POLLIN) {
+            handle_event(&config, &m);
+        }
+        if (fds[1].revents & POLLIN) {
+            handle_event(&keyboard, &m);
+        }
+        if (timer >= 0 && (fds[2].revents & POLLIN)) {
+            uint64_t expirations;
+            uint8_t report[8] = {0};
+            if (read(timer, &expirations, sizeof(expirations)) == sizeof(expirations)) {
+                pressed = !pressed;
+                if (pressed) {
+                    report[0] = press_mod;
+                    report[2] = press_key;
+                    presses++;
+                }
+                send_input(&keyboard, report, sizeof(report));
+            }
+        }
+        // the hidraw nodes appear once the kernel has started the devices
+        if (!config.path[0] && vdev_find_hidraw(&config)) {
+            printf("%s %04x:%04x config %s\n", m.name, m.vid, m.pid, config.path);
+            fflush(stdout);
+        }
+        if (!keyboard.path[0] && vdev_find_hidraw(&keyboard)) {
+            printf("%s %04x:%04x keyboard %s\n", m.name, m.vid, m.pid, keyboard.path);
+            fflush(stdout);
+        }
+    }
+    vdev_destroy(&keyboard);
+    vdev_destroy(&config);
+    fprintf(stderr, "%lu reports received, %lu sent, %lu presses\n", received, sent, presses);
+    return 0;
+}
@@ -0,0 +1,166 @@
+#!/usr/bin/env python3
+# Generates include/keymaps.h, the keyboard layouts used by encode_text(),
+# from XKB symbol files and keysymdef.h:
+#
+#   python3 src/gen-keymaps.py [xkb_dir] [keysymdef.h] > include/keymaps.h
+#
+# Each layout maps Unicode code points of the BMP to a HID usage plus the
+# modifiers of the XKB shift level, through 256-entry pages.
+import re
+import sys
+
+LAYOUTS = ['us', 'gb', 'de', 'ch', 'fr', 'be', 'es', 'it', 'pt', 'se', 'no', 'dk', 'pl', 'cz', 'bg', 'ru', 'ua']
+
+# enum modifier in common.h, level 3 is AltGr
+SHIFT, R_ALT = 2, 64
+LEVEL_MODIFIERS = [0, SHIFT, R_ALT, R_ALT | SHIFT]
+
+# evdev key names of the alphanumeric block and their HID usages
+USAGES = {'TLDE': 0x35, 'AE11': 0x2d, 'AE12': 0x2e, 'AD11': 0x2f, 'AD12': 0x30,
+          'AC10': 0x33, 'AC11': 0x34, 'BKSL': 0x31, 'AB08': 0x36, 'AB09': 0x37,
+          'AB10': 0x38, 'LSGT': 0x64, 'SPCE': 0x2c}
+USAGES.update({'AE%02d' % (i + 1): 0x1e + i for i in range(10)})
+USAGES.update({'AD%02d' % (i + 1): u for i, u in enumerate([0x14, 0x1a, 0x08, 0x15, 0x17, 0x1c, 0x18, 0x0c, 0x12, 0x13])})
+USAGES.update({'AC%02d' % (i + 1): u for i, u in enumerate([0x04, 0x16, 0x07, 0x09, 0x0a, 0x0b, 0x0d, 0x0e, 0x0f])})
+USAGES.update({'AB%02d' % (i + 1): u for i, u in enumerate([0x1d, 0x1b, 0x06, 0x19, 0x05, 0x11, 0x10])})
+KEY_ORDER = list(USAGES)
+
+
+def load_keysyms(path):
+    keysyms = {}
+    define = re.compile(r'#define XK_(\w+)\s+0x([0-9a-fA-F]+)\s*(?:/\*\s*\(?U\+([0-9A-Fa-f]+))?')
+    for line in open(path):
+        m = define.match(line)
+        if m is None:
+            continue
+        value = int(m.group(2), 16)
+        if m.group(3):
+            keysyms[m.group(1)] = int(m.group(3), 16)
+        elif 0x20 <= value <= 0x7e or 0xa0 <= value <= 0xff:
+            keysyms[m.group(1)] = value
+    return keysyms
+
+
+def code_point(name, keysyms):
+    if re.fullmatch(r'U[0-9A-Fa-f]{4,6}', name):
+        return int(name[1:], 16)
+    if re.fullmatch(r'0x100[0-9A-Fa-f]{4,6}', name):
+        return int(name, 16) - 0x1000000
+    return keysyms.get(name)
+
+
+class Symbols:
+    def __init__(self, xkb_dir):
+        self.xkb_dir = xkb_dir
+        self.files = {}
+
+    def sections(self, name):
+        if name not in self.files:
+            text = open('%s/symbols/%s' % (self.xkb_dir, name), encoding='utf-8').read()
+            text = re.sub(r'//[^\n]*', '', text)
+            sections, first, default = {}, None, None
+            for m in re.finditer(r'((?:\w+\s+)*)xkb_symbols\s+"([^"]+)"\s*\{', text):
+                sections[m.group(2)] = self.body(text, m.end())
+                first = first or m.group(2)
+                if default is None and 'default' in m.group(1).split():
+                    default = m.group(2)
+            self.files[name] = (sections, default or first)
+        return self.files[name]
+
+    @staticmethod
+    def body(text, start):
+        depth = 1
+        for i in range(start, len(text)):
+            if text[i] == '{':
+                depth += 1
+            elif text[i] == '}':
+                depth -= 1
+                if depth == 0:
+                    return text[start:i]
+        return text[start:]
+
+    def resolve(self, spec, keys):
+        m = re.fullmatch(r'(\w+)(?:\((\w+)\))?', spec.strip())
+        if m is None:
+            return
+        sections, default = self.sections(m.group(1))
+        body = sections.get(m.group(2) or default)
+        if body is None:
+            return
+        statement = re.compile(r'(?:include|augment|replace|override)\s+"([^"]+)"|'
+                               r'(?:(?:replace|override|augment)\s+)?key\s+<(\w+)>\s*\{([^}]*)\}|'
+                               r'name\[Group1\]\s*=\s*"([^"]*)"')
+        for s in statement.finditer(body):
+            if s.group(4):
+                keys['name'] = s.group(4)
+            elif s.group(1):
+                for part in re.split(r'[+|]', s.group(1)):
+                    if part:
+                        self.resolve(part, keys)
+            elif s.group(2) in USAGES:
+                levels = self.levels(s.group(3))
+                if levels is None:
+                    continue
+                old = keys.get(s.group(2), [])
+                keys[s.group(2)] = [l if l != 'NoSymbol' or i >= len(old) else old[i]
+                                    for i, l in enumerate(levels)]
+
+    @staticmethod
+    def levels(body):
+        m = re.search(r'symbols\[Group1\]\s*=\s*\[([^\]]*)\]', body)
+        if m is None:
+            m = re.search(r'(?<![=\w\]])\s*\[([^\]]*)\]', re.sub(r'\w+\[Group\d\]\s*=\s*"[^"]*"', '', body))
+        if m is None:
+            return None
+        return [l.strip() for l in m.group(1).split(',')]
+
+
+def layout_table(keys, keysyms):
+    table = {}
+    for level in range(len(LEVEL_MODIFIERS)):
+        for key in KEY_ORDER:
+            levels = keys.get(key, [])
+            if level >= len(levels):
+                continue
+            cp = code_point(levels[level], keysyms)
+            if cp is None or cp >= 0x10000 or cp in table:
+                continue
+            table[cp] = USAGES[key] | LEVEL_MODIFIERS[level] << 8
+    table[0x20] = USAGES['SPCE']
+    return table
+
+
+def main():
+    xkb_dir = sys.argv[1] if len(sys.argv) > 1 else '/usr/share/X11/xkb'
+    keysymdef = sys.argv[2] if len(sys.argv) > 2 else '/usr/include/X11/keysymdef.h'
+    keysyms = load_keysyms(keysymdef)
+    symbols = Symbols(xkb_dir)
+    out = sys.stdout
+
+    out.write('// Generated by src/gen-keymaps.py from %s, do not edit\n' % xkb_dir)
+    out.write('#ifndef __KEYMAPS_H__\n#define __KEYMAPS_H__\n#include <stdint.h>\n#include "common.h"\n\n')
+    names = []
+    for layout in LAYOUTS:
+        keys = {}
+        symbols.resolve(layout, keys)
+        table = layout_table(keys, keysyms)
+        pages = sorted({cp >> 8 for cp in table})
+        for page in pages:
+            out.write('static const uint16_t keymap_%s_%02x[256] = {\n' % (layout, page))
+            for row in range(0, 256, 12):
+                cells = ['0x%04x' % table.get(page << 8 | i, 0) for i in range(row, min(row + 12, 256))]
+                out.write('    %s,\n' % ', '.join(cells))
+            out.write('};\n')
+        out.write('static const uint16_t *const keymap_%s[256] = {\n' % layout)
+        for page in pages:
+            out.write('    [0x%02x] = keymap_%s_%02x,\n' % (page, layout, page))
+        out.write('};\n\n')
+        names.append((layout, keys.get('name', layout)))
+    out.write('static const keyboard_layout keyboard_layouts[] = {\n')
+    for layout, title in names:
+        out.write('    {"%s", "%s", keymap_%s},\n' % (layout, title, layout))
+    out.write('};\n\n#endif\n')
+
+
+if __name__ == '__main__':
+    main()
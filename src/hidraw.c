@@ -0,0 +1,397 @@
+/*
+Copyright (c) 2012 Radoslav Gerganov <rgerganov@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <wchar.h>
+#include "hidraw.h"
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <glob.h>
+#include <limits.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/hidraw.h>
+#include <linux/usbdevice_fs.h>
+
+typedef struct hidraw_device
+{
+    int fd;
+    wchar_t error[128];
+} hidraw_device;
+
+// Reads the first line of a sysfs attribute
+static bool read_attr(const char *dir, const char *name, char *buf, size_t size) {
+    char path[PATH_MAX];
+    FILE *f = NULL;
+
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    if ((f = fopen(path, "r")) == NULL) {
+        return false;
+    }
+    if (fgets(buf, size, f) == NULL) {
+        fclose(f);
+        return false;
+    }
+    fclose(f);
+    buf[strcspn(buf, "\n")] = 0;
+    return true;
+}
+
+// The sysfs directory of the USB interface of /sys/class/hidraw/<node>
+static bool interface_dir(const char *node, char *dir, size_t size) {
+    char path[PATH_MAX], real[PATH_MAX];
+    char *slash = NULL;
+
+    snprintf(path, sizeof(path), "/sys/class/hidraw/%s/device", node);
+    if (realpath(path, real) == NULL || (slash = strrchr(real, '/')) == NULL) {
+        return false;
+    }
+    *slash = 0;
+    // devices which are not on USB (e.g. uhid) have no interface
+    if (strchr(strrchr(real, '/'), ':') == NULL) {
+        return false;
+    }
+    snprintf(dir, size, "%s", real);
+    return true;
+}
+
+static const char *node_of(const char *path) {
+    return strncmp(path, "/dev/", 5) == 0 ? path + 5 : NULL;
+}
+
+bool hidraw_location(const char *path, char *location, size_t size) {
+    char dir[PATH_MAX];
+    const char *node = node_of(path);
+
+    if (node == NULL || strncmp(node, "hidraw", 6) != 0 || !interface_dir(node, dir, sizeof(dir))) {
+        return false;
+    }
+    snprintf(location, size, "%s", strrchr(dir, '/') + 1);
+    return true;
+}
+
+// hidapi-libusb before 0.10 used "<bus>:<address>:<interface>" in hex
+static bool legacy_location(const char *path, char *location, size_t size) {
+    unsigned int bus = 0, addr = 0, iface = 0;
+    char attr[32];
+    int n = 0;
+    bool found = false;
+    glob_t g;
+
+    if (sscanf(path, "%4x:%4x:%2x%n", &bus, &addr, &iface, &n) != 3 || path[n] != 0 ||
+            glob("/sys/bus/usb/devices/*", 0, NULL, &g) != 0) {
+        return false;
+    }
+    for (size_t i = 0 ; i < g.gl_pathc && !found ; i++) {
+        const char *dir = g.gl_pathv[i], *name = strrchr(dir, '/') + 1;
+        // interfaces have a colon in their name, only devices have numbers
+        if (strchr(name, ':') != NULL || !read_attr(dir, "busnum", attr, sizeof(attr)) ||
+                strtoul(attr, NULL, 10) != bus || !read_attr(dir, "devnum", attr, sizeof(attr)) ||
+                strtoul(attr, NULL, 10) != addr || !read_attr(dir, "bConfigurationValue", attr, sizeof(attr))) {
+            continue;
+        }
+        snprintf(location, size, "%s:%s.%u", name, attr, iface);
+        found = true;
+    }
+    globfree(&g);
+    return found;
+}
+
+static struct hid_device_info *device_info(const char *node) {
+    char dir[PATH_MAX], line[256], uevent[PATH_MAX + 16], iface_dir[PATH_MAX], attr[32];
+    unsigned int bus = 0, vid = 0, pid = 0;
+    char serial[sizeof(line)] = {0};
+    struct hid_device_info *info = NULL;
+    FILE *f = NULL;
+
+    snprintf(dir, sizeof(dir), "/sys/class/hidraw/%s/device", node);
+    snprintf(uevent, sizeof(uevent), "%s/uevent", dir);
+    if ((f = fopen(uevent, "r")) == NULL) {
+        return NULL;
+    }
+    while (fgets(line, sizeof(line), f) != NULL) {
+        line[strcspn(line, "\n")] = 0;
+        if (strncmp(line, "HID_ID=", 7) == 0) {
+            sscanf(line + 7, "%x:%x:%x", &bus, &vid, &pid);
+        } else if (strncmp(line, "HID_UNIQ=", 9) == 0) {
+            snprintf(serial, sizeof(serial), "%s", line + 9);
+        }
+    }
+    fclose(f);
+    if ((info = calloc(1, sizeof(*info))) == NULL) {
+        return NULL;
+    }
+    snprintf(line, sizeof(line), "/dev/%s", node);
+    info->path = strdup(line);
+    info->vendor_id = vid;
+    info->product_id = pid;
+    info->interface_number = -1;
+    info->serial_number = calloc(strlen(serial) + 1, sizeof(wchar_t));
+    if (info->serial_number != NULL) {
+        mbstowcs(info->serial_number, serial, strlen(serial) + 1);
+    }
+    if (interface_dir(node, iface_dir, sizeof(iface_dir))) {
+        if (read_attr(iface_dir, "bInterfaceNumber", attr, sizeof(attr))) {
+            info->interface_number = strtol(attr, NULL, 16);
+        }
+        if (read_attr(iface_dir, "../bcdDevice", attr, sizeof(attr))) {
+            info->release_number = strtol(attr, NULL, 16);
+        }
+    }
+    return info;
+}
+
+struct hid_device_info *hidraw_enumerate(unsigned short vid, unsigned short pid) {
+    struct hid_device_info *head = NULL, **tail = &head;
+    glob_t g;
+
+    if (glob("/sys/class/hidraw/hidraw*", 0, NULL, &g) != 0) {
+        return NULL;
+    }
+    for (size_t i = 0 ; i < g.gl_pathc ; i++) {
+        struct hid_device_info *info = device_info(strrchr(g.gl_pathv[i], '/') + 1);
+        if (info == NULL) {
+            continue;
+        }
+        if ((vid != 0 && info->vendor_id != vid) || (pid != 0 && info->product_id != pid)) {
+            hidraw_free_enumeration(info);
+            continue;
+        }
+        *tail = info;
+        tail = &info->next;
+    }
+    globfree(&g);
+    return head;
+}
+
+void hidraw_free_enumeration(struct hid_device_info *info) {
+    while (info != NULL) {
+        struct hid_device_info *next = info->next;
+        free(info->path);
+        free(info->serial_number);
+        free(info);
+        info = next;
+    }
+}
+
+hid_device *hidraw_open_path(const char *path) {
+    hidraw_device *dev = calloc(1, sizeof(hidraw_device));
+
+    if (dev == NULL) {
+        return NULL;
+    }
+    dev->fd = open(path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (dev->fd < 0) {
+        free(dev);
+        return NULL;
+    }
+    return (hid_device *) dev;
+}
+
+void hidraw_close(hid_device *dev) {
+    hidraw_device *d = (hidraw_device *) dev;
+
+    close(d->fd);
+    free(d);
+}
+
+static int result(hid_device *dev, int r) {
+    hidraw_device *d = (hidraw_device *) dev;
+
+    if (r < 0) {
+        swprintf(d->error, sizeof(d->error) / sizeof(wchar_t), L"%s", strerror(errno));
+    }
+    return r;
+}
+
+int hidraw_write(hid_device *dev, const unsigned char *data, size_t len) {
+    return result(dev, write(((hidraw_device *) dev)->fd, data, len));
+}
+
+int hidraw_read_timeout(hid_device *dev, unsigned char *data, size_t len, int timeout_ms) {
+    struct pollfd pfd = {((hidraw_device *) dev)->fd, POLLIN, 0};
+    int r = poll(&pfd, 1, timeout_ms);
+
+    if (r <= 0) {
+        return result(dev, r);
+    }
+    if (pfd.revents & (POLLERR | POLLHUP | POLLNVAL)) {
+        errno = ENODEV;
+        return result(dev, -1);
+    }
+    r = read(pfd.fd, data, len);
+    if (r < 0 && (errno == EAGAIN || errno == EINPROGRESS)) {
+        return 0;
+    }
+    return result(dev, r);
+}
+
+int hidraw_send_feature(hid_device *dev, const unsigned char *data, size_t len) {
+    return result(dev, ioctl(((hidraw_device *) dev)->fd, HIDIOCSFEATURE(len), data));
+}
+
+int hidraw_get_feature(hid_device *dev, unsigned char *data, size_t len) {
+    return result(dev, ioctl(((hidraw_device *) dev)->fd, HIDIOCGFEATURE(len), data));
+}
+
+const wchar_t *hidraw_error(hid_device *dev) {
+    return dev != NULL ? ((hidraw_device *) dev)->error : L"";
+}
+
+int hidraw_fileno(hid_device *dev) {
+    return ((hidraw_device *) dev)->fd;
+}
+
+// Issues a USB port reset, which the device sees like a replug
+bool hidraw_reset_port(const char *port) {
+    char path[PATH_MAX];
+    int bus = 0, addr = 0, fd = -1;
+    bool ok = false;
+    FILE *f = NULL;
+
+    snprintf(path, sizeof(path), "/sys/bus/usb/devices/%s/busnum", port);
+    if ((f = fopen(path, "r")) == NULL || fscanf(f, "%d", &bus) != 1) {
+        if (f != NULL) {
+            fclose(f);
+        }
+        return false;
+    }
+    fclose(f);
+    snprintf(path, sizeof(path), "/sys/bus/usb/devices/%s/devnum", port);
+    if ((f = fopen(path, "r")) == NULL || fscanf(f, "%d", &addr) != 1) {
+        if (f != NULL) {
+            fclose(f);
+        }
+        return false;
+    }
+    fclose(f);
+    snprintf(path, sizeof(path), "/dev/bus/usb/%03d/%03d", bus, addr);
+    if ((fd = open(path, O_WRONLY | O_CLOEXEC)) < 0) {
+        perror(path);
+        return false;
+    }
+    ok = ioctl(fd, USBDEVFS_RESET, 0) == 0;
+    if (!ok) {
+        perror(path);
+    }
+    close(fd);
+    return ok;
+}
+
+#else
+
+struct hid_device_info *hidraw_enumerate(unsigned short vid, unsigned short pid) {
+    return NULL;
+}
+
+void hidraw_free_enumeration(struct hid_device_info *info) {
+}
+
+hid_device *hidraw_open_path(const char *path) {
+    errno = ENOSYS;
+    return NULL;
+}
+
+void hidraw_close(hid_device *dev) {
+}
+
+int hidraw_write(hid_device *dev, const unsigned char *data, size_t len) {
+    errno = ENOSYS;
+    return -1;
+}
+
+int hidraw_read_timeout(hid_device *dev, unsigned char *data, size_t len, int timeout_ms) {
+    errno = ENOSYS;
+    return -1;
+}
+
+int hidraw_send_feature(hid_device *dev, const unsigned char *data, size_t len) {
+    errno = ENOSYS;
+    return -1;
+}
+
+int hidraw_get_feature(hid_device *dev, unsigned char *data, size_t len) {
+    errno = ENOSYS;
+    return -1;
+}
+
+const wchar_t *hidraw_error(hid_device *dev) {
+    return L"hidraw is only available on Linux";
+}
+
+int hidraw_fileno(hid_device *dev) {
+    return -1;
+}
+
+bool hidraw_location(const char *path, char *location, size_t size) {
+    return false;
+}
+
+static bool legacy_location(const char *path, char *location, size_t size) {
+    return false;
+}
+
+bool hidraw_reset_port(const char *port) {
+    fprintf(stderr, "Resetting devices is only supported on Linux\n");
+    return false;
+}
+
+#endif
+
+bool hidraw_find_keyboard(const unsigned short vid_pid[][2], size_t count, char *path, size_t size) {
+    struct hid_device_info *info = hidraw_enumerate(0, 0);
+    bool found = false;
+
+    for (struct hid_device_info *i = info ; i != NULL && !found ; i = i->next) {
+        if (i->interface_number > 0) {
+            continue;
+        }
+        for (size_t j = 0 ; j < count ; j++) {
+            if (vid_pid[j][0] == i->vendor_id && vid_pid[j][1] == i->product_id) {
+                snprintf(path, size, "%s", i->path);
+                found = true;
+                break;
+            }
+        }
+    }
+    hidraw_free_enumeration(info);
+    return found;
+}
+
+bool hidraw_usb_location(const char *path, char *location, size_t size) {
+    const char *colon = strchr(path, ':');
+
+    if (hidraw_location(path, location, size) || legacy_location(path, location, size)) {
+        return true;
+    }
+    // hidapi-libusb paths are already locations
+    if (path[0] >= '0' && path[0] <= '9' && strchr(path, '-') != NULL && colon != NULL &&
+            strchr(path, '/') == NULL && strchr(colon, '.') != NULL) {
+        snprintf(location, size, "%s", path);
+        return true;
+    }
+    return false;
+}
@@ -0,0 +1,462 @@
+/*
+Copyright (c) 2012 Radoslav Gerganov <rgerganov@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <spawn.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/input.h>
+#include <linux/uhid.h>
+#include <hidapi.h>
+#include "common.h"
+#include "layout.h"
+#include "vdev.h"
+
+/**
+ * Measures how long a pedal press takes to arrive through one input path
+ * (evdev, hidraw, or libusb through hidapi) and to be dispatched to its
+ * handler. Every report is timestamped with CLOCK_MONOTONIC when it is read.
+ * With -e the pedal is emulated with /dev/uhid (or a pipe, as the baseline)
+ * and the press is timestamped when it is injected as well.
+ */
+
+enum input_path {
+    PATH_EVDEV,
+    PATH_HIDRAW,
+    PATH_LIBUSB,
+    PATH_PIPE,      // the emulated pedal writes to a pipe, i.e. no kernel HID path at all
+};
+
+static const char *path_names[] = {"evdev", "hidraw", "libusb", "pipe"};
+
+typedef struct press
+{
+    atomic_uint_least64_t injected;     // by the emulated pedal, 0 on hardware
+    uint64_t arrived;
+    uint64_t dispatched;
+} press;
+
+extern char **environ;
+
+static enum input_path input = PATH_HIDRAW;
+static press *presses = NULL;
+static int count = 1000;
+static double rate = 50;
+static bool emulate = false, verbose = false;
+static unsigned char press_key = 0x73;      // F24, which nothing should be bound to
+static const char *command = NULL;
+static volatile sig_atomic_t stop = 0;
+
+static vdev pedal = {-1};
+static int pipe_fds[2] = {-1, -1};
+static int fd = -1;
+static hid_device *dev = NULL;
+
+static uint64_t now_ns() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void sleep_until(struct timespec *t, long ns) {
+    t->tv_nsec += ns;
+    t->tv_sec += t->tv_nsec / 1000000000;
+    t->tv_nsec %= 1000000000;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, t, NULL) == EINTR && !stop) {
+    }
+}
+
+static void inject(const uint8_t report[8]) {
+    if (input == PATH_PIPE) {
+        if (write(pipe_fds[1], report, 8) != 8) {
+            perror("pipe");
+        }
+        return;
+    }
+    vdev_input(&pedal, report, 8);
+}
+
+// The kernel queues open/close and LED events, which nobody else reads
+static void drain_uhid() {
+    struct uhid_event ev;
+
+    while (pedal.fd >= 0 && read(pedal.fd, &ev, sizeof(ev)) > 0) {
+    }
+}
+
+// Presses and releases the emulated pedal count times at the given rate
+static void *generate(void *arg) {
+    long half_period = 1e9 / rate / 2;
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    for (int i = 0 ; i < count && !stop ; i++) {
+        uint8_t report[8] = {0};
+
+        sleep_until(&t, half_period);
+        report[2] = press_key;
+        atomic_store_explicit(&presses[i].injected, now_ns(), memory_order_release);
+        inject(report);
+        sleep_until(&t, half_period);
+        report[2] = 0;
+        inject(report);
+        drain_uhid();
+    }
+    return NULL;
+}
+
+// Opens the emulated pedal, the nodes appear once the kernel has started it
+static bool open_emulated() {
+    static const unsigned short vid_pid[][2] = { FOOTSWITCH_DEVICES(LAYOUT_VID_PID) };
+    char event[64];
+
+    if (input == PATH_PIPE) {
+        if (pipe(pipe_fds) < 0) {
+            perror("pipe");
+            return false;
+        }
+        fd = pipe_fds[0];
+        return true;
+    }
+    if (input == PATH_LIBUSB) {
+        fprintf(stderr, "Emulated pedals are not USB devices, libusb cannot be measured with -e\n");
+        return false;
+    }
+    if (!vdev_create(&pedal, "latency", "pedal", vid_pid[0][0], vid_pid[0][1],
+                     vdev_keyboard_rdesc, vdev_keyboard_rdesc_size)) {
+        return false;
+    }
+    fcntl(pedal.fd, F_SETFL, O_NONBLOCK);
+    for (int i = 0 ; i < 100 ; i++, usleep(20 * 1000)) {
+        drain_uhid();
+        if (!vdev_find_hidraw(&pedal)) {
+            continue;
+        }
+        if (input == PATH_HIDRAW) {
+            fd = open(pedal.path, O_RDONLY | O_CLOEXEC);
+        } else if (vdev_find_event(&pedal, event, sizeof(event))) {
+            fd = open(event, O_RDONLY | O_CLOEXEC);
+        } else {
+            continue;
+        }
+        if (fd < 0) {
+            // udev may not have set the permissions yet
+            continue;
+        }
+        return true;
+    }
+    fprintf(stderr, "The emulated pedal hasn't appeared on the %s path\n", path_names[input]);
+    return false;
+}
+
+static bool open_device(const char *arg) {
+    unsigned int vid = 0, pid = 0;
+
+    if (input != PATH_LIBUSB) {
+        if (arg == NULL) {
+            fprintf(stderr, "The %s path needs a device node\n", path_names[input]);
+            return false;
+        }
+        if ((fd = open(arg, O_RDONLY | O_CLOEXEC)) < 0) {
+            perror(arg);
+            return false;
+        }
+        return true;
+    }
+    if (arg == NULL) {
+        static const unsigned short vid_pid[][2] = { FOOTSWITCH_DEVICES(LAYOUT_VID_PID) };
+        vid = vid_pid[0][0];
+        pid = vid_pid[0][1];
+    } else if (sscanf(arg, "%x:%x", &vid, &pid) != 2) {
+        fprintf(stderr, "Invalid VID:PID '%s'\n", arg);
+        return false;
+    }
+    hid_init();
+    // the keyboard interface of the pedals is the first one
+    struct hid_device_info *info = hid_enumerate(vid, pid), *i = NULL;
+    for (i = info ; i != NULL && i->interface_number > 0 ; i = i->next) {
+    }
+    if (i == NULL) {
+        i = info;
+    }
+    if (i != NULL) {
+        dev = hid_open_path(i->path);
+    }
+    hid_free_enumeration(info);
+    if (dev == NULL) {
+        fprintf(stderr, "Cannot open %04x:%04x with libusb\n", vid, pid);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Waits for the next press, returns 1 and its key (a HID usage, or a Linux
+ * key code on the evdev path), 0 on timeout and -1 on errors.
+ */
+static int read_press(int timeout_ms, unsigned int *key) {
+    static uint8_t last = 0;
+    uint8_t report[8] = {0};
+    int r = 0;
+
+    for (;;) {
+        if (input == PATH_LIBUSB) {
+            r = hid_read_timeout(dev, report, sizeof(report), timeout_ms);
+        } else {
+            struct pollfd pfd = {fd, POLLIN, 0};
+            if ((r = poll(&pfd, 1, timeout_ms)) <= 0) {
+                return r < 0 && errno == EINTR ? 0 : r;
+            }
+            if (input == PATH_EVDEV) {
+                struct input_event ev;
+                if (read(fd, &ev, sizeof(ev)) != sizeof(ev)) {
+                    return -1;
+                }
+                if (ev.type == EV_KEY && ev.value == 1) {
+                    *key = ev.code;
+                    return 1;
+                }
+                continue;
+            }
+            r = read(fd, report, sizeof(report));
+        }
+        if (r <= 0) {
+            return r;
+        }
+        // a press is the first report with a key after an empty one
+        if (report[2] != 0 && last == 0) {
+            last = report[2];
+            *key = report[2];
+            return 1;
+        }
+        last = report[2];
+    }
+}
+
+// The host-side action of a press
+static void dispatch(int num, unsigned int key) {
+    if (command != NULL) {
+        char *argv[] = {"sh", "-c", (char *) command, NULL};
+        pid_t pid;
+        if (posix_spawn(&pid, "/bin/sh", NULL, NULL, argv, environ) != 0) {
+            perror("posix_spawn");
+        }
+    }
+    if (verbose) {
+        if (input == PATH_EVDEV) {
+            printf("press %d: key code %u\n", num + 1, key);
+        } else {
+            printf("press %d: %s\n", num + 1, decode_byte(key));
+        }
+    }
+}
+
+static int compare(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+
+    return x < y ? -1 : x > y;
+}
+
+// Percentiles, jitter (the standard deviation) and a log2 histogram in microseconds
+static void print_stats(const char *title, uint64_t *ns, int n) {
+    int buckets[40] = {0}, first = 40, last = 0, most = 0;
+    double mean = 0, var = 0;
+
+    if (n == 0) {
+        return;
+    }
+    qsort(ns, n, sizeof(ns[0]), compare);
+    for (int i = 0 ; i < n ; i++) {
+        mean += ns[i] / 1e3;
+    }
+    mean /= n;
+    for (int i = 0 ; i < n ; i++) {
+        var += (ns[i] / 1e3 - mean) * (ns[i] / 1e3 - mean);
+        int b = 0;
+        for (uint64_t us = ns[i] / 1000 ; us > 1 && b < 39 ; us >>= 1) {
+            b++;
+        }
+        buckets[b]++;
+        first = b < first ? b : first;
+        last = b > last ? b : last;
+        most = buckets[b] > most ? buckets[b] : most;
+    }
+    printf("%s (%d presses)\n", title, n);
+    printf("  p50 %.1f us, p99 %.1f us, max %.1f us, mean %.1f us, jitter %.1f us\n",
+           ns[(n - 1) * 50 / 100] / 1e3, ns[(n - 1) * 99 / 100] / 1e3, ns[n - 1] / 1e3, mean, sqrt(var / n));
+    for (int b = first ; b <= last ; b++) {
+        int width = buckets[b] * 40 / most;
+        printf("  < %8llu us |%-40.*s| %d\n", 1ULL << (b + 1), width,
+               "########################################", buckets[b]);
+    }
+}
+
+static void on_signal(int sig) {
+    stop = 1;
+}
+
+void usage() {
+    fprintf(stderr, "Usage: latency [-p path] [-n presses] [-e [-r rate] [-k key]] [-x command] [-v] [device]\n"
+        "   -p path     - evdev|hidraw|libusb|pipe (default hidraw)\n"
+        "   -n presses  - stop after this many presses (default 1000)\n"
+        "   -e          - emulate the pedal with /dev/uhid (or a pipe) and time from the injection\n"
+        "   -r rate     - presses per second of the emulated pedal (default 50)\n"
+        "   -k key      - the key pressed by the emulated pedal (default f24)\n"
+        "   -x command  - run command with /bin/sh on each press, as the host-side action\n"
+        "   -v          - print each press\n"
+        "   device      - /dev/input/eventN or /dev/hidrawN of the pedal, or its VID:PID for libusb\n");
+    exit(1);
+}
+
+int main(int argc, char *argv[]) {
+    uint64_t *arrival = NULL, *dispatch_ns = NULL, *total = NULL;
+    pthread_t generator;
+    int opt, received = 0;
+
+    while ((opt = getopt(argc, argv, "p:n:er:k:x:v")) != -1) {
+        switch (opt) {
+            case 'p': {
+                size_t i;
+                for (i = 0 ; i < sizeof(path_names) / sizeof(path_names[0]) ; i++) {
+                    if (strcmp(optarg, path_names[i]) == 0) {
+                        break;
+                    }
+                }
+                if (i == sizeof(path_names) / sizeof(path_names[0])) {
+                    usage();
+                }
+                input = i;
+                break;
+            }
+            case 'n':
+                count = atoi(optarg);
+                break;
+            case 'e':
+                emulate = true;
+                break;
+            case 'r':
+                rate = atof(optarg);
+                break;
+            case 'k':
+                if (!encode_key(optarg, &press_key) || press_key == 0) {
+                    fprintf(stderr, "Cannot encode key '%s'\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'x':
+                command = optarg;
+                break;
+            case 'v':
+                verbose = true;
+                break;
+            default:
+                usage();
+        }
+    }
+    if (optind + 1 < argc || count <= 0 || rate <= 0 || (input == PATH_PIPE && !emulate)) {
+        usage();
+    }
+    if ((presses = calloc(count, sizeof(press))) == NULL) {
+        perror("calloc");
+        return 1;
+    }
+    if (!(emulate ? open_emulated() : open_device(optind < argc ? argv[optind] : NULL))) {
+        vdev_destroy(&pedal);
+        return 1;
+    }
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    signal(SIGCHLD, SIG_IGN);
+    if (emulate && pthread_create(&generator, NULL, generate, NULL) != 0) {
+        perror("pthread_create");
+        return 1;
+    }
+    if (!emulate) {
+        fprintf(stderr, "Press the pedal %d times, or Ctrl+C to stop\n", count);
+    }
+    while (received < count && !stop) {
+        unsigned int key = 0;
+        // a lost press ends an emulated run
+        int r = read_press(emulate ? 1000 + 1000 / rate : -1, &key);
+        uint64_t arrived = now_ns();
+        if (r < 0 && errno != EINTR) {
+            perror("read");
+            break;
+        }
+        if (r == 0 && emulate) {
+            fprintf(stderr, "Press %d hasn't arrived\n", received + 1);
+            break;
+        }
+        if (r <= 0) {
+            continue;
+        }
+        presses[received].arrived = arrived;
+        dispatch(received, key);
+        presses[received].dispatched = now_ns();
+        received++;
+    }
+    stop = 1;
+    if (emulate) {
+        pthread_join(generator, NULL);
+    }
+
+    arrival = calloc(received + 1, sizeof(uint64_t));
+    dispatch_ns = calloc(received + 1, sizeof(uint64_t));
+    total = calloc(received + 1, sizeof(uint64_t));
+    for (int i = 0 ; i < received ; i++) {
+        uint64_t injected = atomic_load_explicit(&presses[i].injected, memory_order_acquire);
+        arrival[i] = presses[i].arrived - injected;
+        dispatch_ns[i] = presses[i].dispatched - presses[i].arrived;
+        total[i] = presses[i].dispatched - injected;
+    }
+    printf("%s path%s\n", path_names[input], emulate ? ", emulated pedal" : "");
+    if (emulate) {
+        print_stats("press to arrival", arrival, received);
+    }
+    print_stats("arrival to dispatch", dispatch_ns, received);
+    if (emulate) {
+        print_stats("press to dispatch", total, received);
+    }
+
+    free(arrival);
+    free(dispatch_ns);
+    free(total);
+    free(presses);
+    if (dev != NULL) {
+        hid_close(dev);
+        hid_exit();
+    }
+    vdev_destroy(&pedal);
+    return received == count ? 0 : 1;
+}
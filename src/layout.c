@@ -0,0 +1,55 @@
+/*
+Copyright (c) 2012 Radoslav Gerganov <rgerganov@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+#include <stdio.h>
+#include <string.h>
+#include "layout.h"
+
+const layout_field FOOTSWITCH_fields[] = { FOOTSWITCH_FIELDS(LAYOUT_DESCRIPTOR) };
+const layout_field SCYTHE_fields[] = { SCYTHE_FIELDS(LAYOUT_DESCRIPTOR) };
+const layout_field SCYTHE_RESPONSE_fields[] = { SCYTHE_RESPONSE_FIELDS(LAYOUT_DESCRIPTOR) };
+const layout_field SCYTHE2_fields[] = { SCYTHE2_FIELDS(LAYOUT_DESCRIPTOR) };
+const layout_field SCYTHE2_PEDAL_fields[] = { SCYTHE2_PEDAL_FIELDS(LAYOUT_DESCRIPTOR) };
+const layout_field FOOTSWITCH1P_fields[] = { FOOTSWITCH1P_FIELDS(LAYOUT_DESCRIPTOR) };
+
+bool layout_encode(const layout_field *f, uint8_t *report, int value) {
+    if (value < f->min || value > f->max) {
+        return false;
+    }
+    report[f->offset] = (uint8_t) (value * f->sign);
+    return true;
+}
+
+int layout_decode(const layout_field *f, const uint8_t *report) {
+    int value = report[f->offset];
+
+    if (f->min < 0 && value > 127) {
+        value -= 256;
+    }
+    return value * f->sign;
+}
+
+void layout_format(const layout_field *f, int count, const uint8_t *report, char *out, size_t size) {
+    for (int i = 0 ; i < count ; i++) {
+        size_t len = strlen(out);
+        snprintf(out + len, size - len, "%s%s=%d", i > 0 ? " " : "", f[i].name, layout_decode(&f[i], report));
+    }
+}
@@ -0,0 +1,243 @@
+/*
+Copyright (c) 2012 Radoslav Gerganov <rgerganov@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <limits.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include "hidraw.h"
+#include "lock.h"
+
+// followed by the user ID, root (footswitchd) uses ROOT_LOCK_DIR
+#define DEFAULT_LOCK_DIR "/tmp/footswitch-locks-"
+#define ROOT_LOCK_DIR "/run/footswitch"
+#define POLL_INTERVAL_US (5 * 1000)
+
+/*
+ * Every process which wants a device takes the next ticket number from
+ * <key>.seq and creates <key>.<ticket> which stays flock()-ed for as long
+ * as the process uses the device. The device belongs to the process whose
+ * ticket is the lowest one still alive. A ticket file which can be locked
+ * by somebody else has been left by a process which died and is removed.
+ */
+
+int lock_timeout_ms = -1;
+
+static char ticket_path[PATH_MAX];
+static int ticket_fd = -1;
+static long waited_us = 0;
+
+static long now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
+
+static const char *lock_dir() {
+    static char dir[64];
+    const char *env = getenv("FOOTSWITCH_LOCK_DIR");
+
+    if (env != NULL) {
+        return env;
+    }
+    if (geteuid() == 0) {
+        return ROOT_LOCK_DIR;
+    }
+    snprintf(dir, sizeof(dir), "%s%u", DEFAULT_LOCK_DIR, (unsigned) geteuid());
+    return dir;
+}
+
+// Creates the directory or checks that the existing one is not a symlink
+// and belongs to us, /tmp is shared with everybody
+static void make_lock_dir(const char *dir) {
+    struct stat st;
+
+    if (mkdir(dir, 0700) < 0 && errno != EEXIST) {
+        perror(dir);
+        exit(1);
+    }
+    if (getenv("FOOTSWITCH_LOCK_DIR") != NULL) {
+        return;
+    }
+    if (lstat(dir, &st) < 0 || !S_ISDIR(st.st_mode) || st.st_uid != geteuid()) {
+        fprintf(stderr, "%s: not a lock directory of this user\n", dir);
+        exit(1);
+    }
+}
+
+static void make_key(const char *path, char *key, size_t size) {
+    char real[PATH_MAX];
+
+    // the backends name the same device differently, so the key is its USB
+    // location when it has one; otherwise it may be given through a symlink
+    if (hidraw_usb_location(path, real, sizeof(real)) || realpath(path, real) != NULL) {
+        path = real;
+    }
+    snprintf(key, size, "%s", path);
+    for (char *c = key ; *c ; c++) {
+        if (*c == '/' || *c == ':' || *c == '.') {
+            *c = '_';
+        }
+    }
+}
+
+/*
+ * Lock files are never followed through symlinks and only files created by
+ * the same user are used, anything else could have been planted (e.g. in a
+ * directory given with $FOOTSWITCH_LOCK_DIR) to make us write elsewhere.
+ */
+static int open_lock_file(const char *path, int flags) {
+    struct stat st;
+    int fd = open(path, flags | O_NOFOLLOW | O_CLOEXEC, 0600);
+
+    if (fd < 0) {
+        return -1;
+    }
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_nlink != 1 || st.st_uid != geteuid()) {
+        fprintf(stderr, "%s: not a lock file of this user\n", path);
+        close(fd);
+        exit(1);
+    }
+    return fd;
+}
+
+static unsigned long take_ticket(const char *dir, const char *key) {
+    char path[PATH_MAX];
+    char buf[32] = {0};
+    unsigned long ticket = 0;
+    int fd;
+
+    if (snprintf(path, sizeof(path), "%s/%s.seq", dir, key) >= (int) sizeof(path)) {
+        fprintf(stderr, "%s: the lock path is too long\n", dir);
+        exit(1);
+    }
+    fd = open_lock_file(path, O_RDWR | O_CREAT);
+    if (fd < 0 || flock(fd, LOCK_EX) < 0) {
+        perror(path);
+        exit(1);
+    }
+    if (pread(fd, buf, sizeof(buf) - 1, 0) > 0) {
+        ticket = strtoul(buf, NULL, 10);
+    }
+    snprintf(buf, sizeof(buf), "%lu\n", ticket + 1);
+    if (pwrite(fd, buf, strlen(buf), 0) < 0) {
+        perror(path);
+        exit(1);
+    }
+    // the ticket file must be locked before the next ticket can be taken,
+    // otherwise a waiter may consider it stale
+    if (snprintf(ticket_path, sizeof(ticket_path), "%s/%s.%lu", dir, key, ticket) >= (int) sizeof(ticket_path)) {
+        fprintf(stderr, "%s: the lock path is too long\n", dir);
+        exit(1);
+    }
+    ticket_fd = open_lock_file(ticket_path, O_RDWR | O_CREAT);
+    if (ticket_fd < 0 || flock(ticket_fd, LOCK_EX) < 0) {
+        perror(ticket_path);
+        exit(1);
+    }
+    close(fd);
+    return ticket;
+}
+
+// Returns true if a live process holds a ticket lower than ours
+static bool ahead_of_us(const char *dir, const char *key, unsigned long ticket) {
+    size_t key_len = strlen(key);
+    bool found = false;
+    struct dirent *ent;
+    DIR *d = opendir(dir);
+
+    if (d == NULL) {
+        perror(dir);
+        exit(1);
+    }
+    while ((ent = readdir(d)) != NULL) {
+        char path[PATH_MAX], *end = NULL;
+        unsigned long other;
+        int fd;
+
+        if (strncmp(ent->d_name, key, key_len) != 0 || ent->d_name[key_len] != '.') {
+            continue;
+        }
+        other = strtoul(ent->d_name + key_len + 1, &end, 10);
+        if (*end != 0 || end == ent->d_name + key_len + 1 || other >= ticket) {
+            continue;
+        }
+        snprintf(path, sizeof(path), "%s/%s", dir, ent->d_name);
+        fd = open(path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+        if (fd < 0) {
+            continue;
+        }
+        if (flock(fd, LOCK_EX | LOCK_NB) == 0) {
+            unlink(path);
+        } else if (errno == EWOULDBLOCK) {
+            found = true;
+        }
+        close(fd);
+        if (found) {
+            break;
+        }
+    }
+    closedir(d);
+    return found;
+}
+
+bool lock_device(const char *path) {
+    char key[PATH_MAX];
+    const char *dir = lock_dir();
+    long start = now_us();
+    unsigned long ticket;
+
+    // a ticket left from an earlier device would be waited for forever
+    unlock_device();
+    make_lock_dir(dir);
+    make_key(path, key, sizeof(key));
+    ticket = take_ticket(dir, key);
+    while (ahead_of_us(dir, key, ticket)) {
+        if (lock_timeout_ms >= 0 && now_us() - start > lock_timeout_ms * 1000L) {
+            unlock_device();
+            waited_us = now_us() - start;
+            return false;
+        }
+        usleep(POLL_INTERVAL_US);
+    }
+    waited_us = now_us() - start;
+    return true;
+}
+
+void unlock_device() {
+    if (ticket_fd < 0) {
+        return;
+    }
+    unlink(ticket_path);
+    close(ticket_fd);
+    ticket_fd = -1;
+}
+
+long lock_wait_us() {
+    return waited_us;
+}
@@ -0,0 +1,276 @@
+/*
+Copyright (c) 2012 Radoslav Gerganov <rgerganov@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "metrics.h"
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+// Upper bounds of the histogram buckets in microseconds, +Inf is implicit
+static const uint64_t bounds[] = {
+    100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000, 1000000, 2500000, 5000000,
+};
+
+#define BUCKETS (sizeof(bounds) / sizeof(bounds[0]) + 1)
+
+typedef struct histogram
+{
+    _Atomic uint64_t buckets[BUCKETS];
+    _Atomic uint64_t count;
+    _Atomic uint64_t sum_us;
+} histogram;
+
+typedef struct shard
+{
+    _Atomic uint64_t counters[METRIC_COUNTERS];
+    histogram histograms[METRIC_HISTOGRAMS];
+    struct shard *next;
+} shard;
+
+static const struct {
+    const char *name;
+    const char *help;
+} counter_info[METRIC_COUNTERS] = {
+    [METRIC_TRANSFERS] = {"footswitch_transfers_total", "Reports sent to or received from devices"},
+    [METRIC_BYTES] = {"footswitch_transfer_bytes_total", "Bytes sent to or received from devices"},
+    [METRIC_RETRIES] = {"footswitch_retries_total", "Transfers and packet sequences which have been repeated"},
+    [METRIC_FAILURES] = {"footswitch_failures_total", "Fatal errors"},
+    [METRIC_EVENTS] = {"footswitch_events_total", "Pedal and hotplug events which have been handled"},
+    [METRIC_MISMATCHES] = {"footswitch_verify_mismatches_total", "Pedals which have been sent again because they didn't verify"},
+    [METRIC_RECOVERIES] = {"footswitch_recoveries_total", "Devices which have been recovered after they have stopped responding or failed"},
+};
+
+static const char *phase_names[] = {
+    [METRIC_DISCOVERY] = "discovery",
+    [METRIC_START_WAIT] = "start",
+    [METRIC_PEDAL_WRITE] = "write",
+    [METRIC_READBACK] = "readback",
+};
+
+const char *metrics_path = NULL;
+
+// Shards are never freed, so the counts of threads which have exited remain
+static _Atomic(shard *) shards = NULL;
+static _Thread_local shard *local = NULL;
+
+static shard *get_shard() {
+    if (local == NULL) {
+        shard *s = calloc(1, sizeof(shard));
+        if (s == NULL) {
+            return NULL;
+        }
+        s->next = atomic_load(&shards);
+        while (!atomic_compare_exchange_weak(&shards, &s->next, s)) {
+        }
+        local = s;
+    }
+    return local;
+}
+
+// Only the owning thread writes to a shard, so no read-modify-write is needed
+static void bump(_Atomic uint64_t *v, uint64_t n) {
+    atomic_store_explicit(v, atomic_load_explicit(v, memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+void metrics_add(enum metric_counter c, uint64_t n) {
+    shard *s = get_shard();
+
+    if (s != NULL) {
+        bump(&s->counters[c], n);
+    }
+}
+
+uint64_t metrics_now() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+void metrics_observe(enum metric_histogram h, uint64_t start) {
+    uint64_t us = metrics_now() - start;
+    shard *s = get_shard();
+    size_t b = 0;
+
+    if (s == NULL) {
+        return;
+    }
+    while (b < BUCKETS - 1 && us > bounds[b]) {
+        b++;
+    }
+    bump(&s->histograms[h].buckets[b], 1);
+    bump(&s->histograms[h].count, 1);
+    bump(&s->histograms[h].sum_us, us);
+}
+
+static uint64_t load(_Atomic uint64_t *v) {
+    return atomic_load_explicit(v, memory_order_relaxed);
+}
+
+static void sum_histogram(enum metric_histogram h, uint64_t buckets[BUCKETS], uint64_t *count, uint64_t *sum_us) {
+    memset(buckets, 0, BUCKETS * sizeof(uint64_t));
+    *count = *sum_us = 0;
+    for (shard *s = atomic_load(&shards) ; s != NULL ; s = s->next) {
+        for (size_t b = 0 ; b < BUCKETS ; b++) {
+            buckets[b] += load(&s->histograms[h].buckets[b]);
+        }
+        *count += load(&s->histograms[h].count);
+        *sum_us += load(&s->histograms[h].sum_us);
+    }
+}
+
+static void write_histogram(FILE *out, const char *name, const char *label, enum metric_histogram h) {
+    uint64_t buckets[BUCKETS], count = 0, sum_us = 0, cumulative = 0;
+
+    sum_histogram(h, buckets, &count, &sum_us);
+    for (size_t b = 0 ; b < BUCKETS ; b++) {
+        cumulative += buckets[b];
+        fprintf(out, "%s_bucket{%s%s", name, label, *label ? "," : "");
+        if (b < BUCKETS - 1) {
+            fprintf(out, "le=\"%g\"} %llu\n", bounds[b] / 1e6, (unsigned long long) cumulative);
+        } else {
+            fprintf(out, "le=\"+Inf\"} %llu\n", (unsigned long long) cumulative);
+        }
+    }
+    if (*label) {
+        fprintf(out, "%s_sum{%s} %.6f\n", name, label, sum_us / 1e6);
+        fprintf(out, "%s_count{%s} %llu\n", name, label, (unsigned long long) count);
+    } else {
+        fprintf(out, "%s_sum %.6f\n", name, sum_us / 1e6);
+        fprintf(out, "%s_count %llu\n", name, (unsigned long long) count);
+    }
+}
+
+void metrics_write(FILE *out) {
+    char label[32];
+
+    for (int c = 0 ; c < METRIC_COUNTERS ; c++) {
+        uint64_t total = 0;
+        for (shard *s = atomic_load(&shards) ; s != NULL ; s = s->next) {
+            total += load(&s->counters[c]);
+        }
+        fprintf(out, "# HELP %s %s\n", counter_info[c].name, counter_info[c].help);
+        fprintf(out, "# TYPE %s counter\n", counter_info[c].name);
+        fprintf(out, "%s %llu\n", counter_info[c].name, (unsigned long long) total);
+    }
+    fprintf(out, "# HELP footswitch_phase_seconds Duration of the phases of programming\n");
+    fprintf(out, "# TYPE footswitch_phase_seconds histogram\n");
+    for (int h = METRIC_DISCOVERY ; h <= METRIC_READBACK ; h++) {
+        snprintf(label, sizeof(label), "phase=\"%s\"", phase_names[h]);
+        write_histogram(out, "footswitch_phase_seconds", label, h);
+    }
+    fprintf(out, "# HELP footswitch_event_dispatch_seconds Latency from a pedal event to its handler\n");
+    fprintf(out, "# TYPE footswitch_event_dispatch_seconds histogram\n");
+    write_histogram(out, "footswitch_event_dispatch_seconds", "", METRIC_EVENT_DISPATCH);
+    fprintf(out, "# HELP footswitch_plug_to_ready_seconds Time from plugging a device in to its profile being applied\n");
+    fprintf(out, "# TYPE footswitch_plug_to_ready_seconds histogram\n");
+    write_histogram(out, "footswitch_plug_to_ready_seconds", "", METRIC_PLUG_TO_READY);
+    fprintf(out, "# HELP footswitch_recovery_seconds Time from a device hanging or failing to it working again\n");
+    fprintf(out, "# TYPE footswitch_recovery_seconds histogram\n");
+    write_histogram(out, "footswitch_recovery_seconds", "", METRIC_RECOVERY);
+}
+
+bool metrics_write_textfile(const char *path) {
+    char tmp[4096];
+    FILE *out = NULL;
+
+    snprintf(tmp, sizeof(tmp), "%s.%d.tmp", path, getpid());
+    if ((out = fopen(tmp, "w")) == NULL) {
+        return false;
+    }
+    metrics_write(out);
+    if (fclose(out) != 0 || rename(tmp, path) < 0) {
+        unlink(tmp);
+        return false;
+    }
+    return true;
+}
+
+static void export_at_exit() {
+    if (!metrics_write_textfile(metrics_path)) {
+        perror(metrics_path);
+    }
+}
+
+void metrics_export_at_exit() {
+    static bool registered = false;
+
+    if (!registered) {
+        atexit(export_at_exit);
+        registered = true;
+    }
+}
+
+int metrics_listen(const char *path) {
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    int fd = -1;
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    unlink(path);
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 || listen(fd, 8) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+void metrics_serve(int fd) {
+    int client = -1;
+    char *text = NULL;
+    size_t len = 0;
+    FILE *out = NULL;
+
+    while ((client = accept(fd, NULL, NULL)) >= 0) {
+        if ((out = open_memstream(&text, &len)) != NULL) {
+            metrics_write(out);
+            fclose(out);
+            // a client which goes away must not kill us with SIGPIPE
+            for (size_t sent = 0 ; sent < len ; ) {
+                ssize_t r = send(client, text + sent, len - sent, MSG_NOSIGNAL);
+                if (r <= 0) {
+                    break;
+                }
+                sent += r;
+            }
+            free(text);
+        }
+        close(client);
+    }
+}
@@ -0,0 +1,104 @@
+/*
+Copyright (c) 2012 Radoslav Gerganov <rgerganov@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "pacing.h"
+
+static bool cache_path(char *path, size_t size, bool create) {
+    const char *cache = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+
+    if (cache != NULL && *cache != 0) {
+        snprintf(path, size, "%s/footswitch", cache);
+    } else if (home != NULL) {
+        snprintf(path, size, "%s/.cache", home);
+        if (create) {
+            mkdir(path, 0755);
+        }
+        snprintf(path, size, "%s/.cache/footswitch", home);
+    } else {
+        return false;
+    }
+    if (create) {
+        mkdir(path, 0755);
+    }
+    strncat(path, "/timing", size - strlen(path) - 1);
+    return true;
+}
+
+static void format_key(const device_id *id, char *key, size_t size) {
+    snprintf(key, size, "%04x:%04x:%04x", id->vid, id->pid, id->release);
+}
+
+bool pacing_load(const device_id *id, pacing *p) {
+    char path[PATH_MAX], key[16], line[128], name[32];
+    unsigned int gap_us, start_us;
+    bool found = false;
+    FILE *f;
+
+    if (!cache_path(path, sizeof(path), false) || (f = fopen(path, "r")) == NULL) {
+        return false;
+    }
+    format_key(id, key, sizeof(key));
+    while (!found && fgets(line, sizeof(line), f) != NULL) {
+        if (sscanf(line, "%31s %u %u", name, &gap_us, &start_us) == 3 && strcmp(name, key) == 0) {
+            p->gap_us = gap_us;
+            p->start_us = start_us;
+            found = true;
+        }
+    }
+    fclose(f);
+    return found;
+}
+
+bool pacing_save(const device_id *id, const pacing *p) {
+    char path[PATH_MAX], tmp[PATH_MAX + 16], key[16], line[128];
+    FILE *in, *out;
+
+    if (!cache_path(path, sizeof(path), true)) {
+        return false;
+    }
+    snprintf(tmp, sizeof(tmp), "%s.%d", path, getpid());
+    if ((out = fopen(tmp, "w")) == NULL) {
+        return false;
+    }
+    format_key(id, key, sizeof(key));
+    // keep the entries of the other models
+    if ((in = fopen(path, "r")) != NULL) {
+        while (fgets(line, sizeof(line), in) != NULL) {
+            if (strncmp(line, key, strlen(key)) != 0) {
+                fputs(line, out);
+            }
+        }
+        fclose(in);
+    }
+    fprintf(out, "%s %u %u\n", key, p->gap_us, p->start_us);
+    if (fclose(out) != 0 || rename(tmp, path) != 0) {
+        unlink(tmp);
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,82 @@
+/*
+Copyright (c) 2012 Radoslav Gerganov <rgerganov@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+#include <poll.h>
+#include <string.h>
+#include <time.h>
+#include "hidraw.h"
+#include "layout.h"
+#include "metrics.h"
+#include "pedal.h"
+
+static const unsigned short pedal_ids[][2] = {
+    FOOTSWITCH_DEVICES(LAYOUT_VID_PID)
+    SCYTHE_DEVICES(LAYOUT_VID_PID)
+    SCYTHE2_DEVICES(LAYOUT_VID_PID)
+    FOOTSWITCH1P_DEVICES(LAYOUT_VID_PID)
+};
+
+volatile sig_atomic_t pedal_stop = 0;
+
+static void on_signal(int sig) {
+    pedal_stop = 1;
+}
+
+void pedal_catch_signals() {
+    struct sigaction sa;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+}
+
+uint64_t pedal_now_ns() {
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+bool pedal_find(char *path, size_t size) {
+    return hidraw_find_keyboard(pedal_ids, sizeof(pedal_ids) / sizeof(pedal_ids[0]), path, size);
+}
+
+bool pedal_wait(int fd, int metrics) {
+    struct pollfd fds[2] = {{fd, POLLIN, 0}, {metrics, POLLIN, 0}};
+
+    if (metrics < 0) {
+        return true;
+    }
+    do {
+        if (poll(fds, 2, -1) < 0) {
+            return false;
+        }
+        if (fds[1].revents & POLLIN) {
+            metrics_serve(metrics);
+        }
+    } while (fds[0].revents == 0);
+    return true;
+}
+
+const uint8_t *pedal_keys(const uint8_t *report, int len) {
+    return len >= 8 ? report + len - 8 : NULL;
+}
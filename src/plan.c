@@ -0,0 +1,376 @@
+/*
+Copyright (c) 2012 Radoslav Gerganov <rgerganov@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "metrics.h"
+#include "plan.h"
+#include "profiledb.h"
+#include "transfer.h"
+
+#define JOURNAL_MAGIC "FSJ1"
+#define IMAGE_MAGIC "FSI2"
+
+typedef struct journal_header
+{
+    char magic[4];
+    uint32_t count;
+    uint32_t acked;         // number of packets acknowledged up to the last commit point
+    uint32_t reserved;
+} journal_header;
+
+const char *journal_path = NULL;
+bool compile_only = false;
+const char *output_path = NULL;
+const char *flash_path = NULL;
+bool dry_run = false;
+
+void plan_add(plan *p, enum packet_type type, const uint8_t *data, int len, unsigned int delay_us, int flags) {
+    packet *pkt = NULL;
+
+    if (len > PACKET_SIZE) {
+        fprintf(stderr, "Packet too long: %d\n", len);
+        exit(1);
+    }
+    if (p->count == p->capacity) {
+        p->capacity = p->capacity ? p->capacity * 2 : 16;
+        p->packets = realloc(p->packets, p->capacity * sizeof(packet));
+        if (!p->packets) {
+            fprintf(stderr, "Not enough memory\n");
+            exit(1);
+        }
+    }
+    pkt = &p->packets[p->count++];
+    memset(pkt, 0, sizeof(packet));
+    pkt->type = type;
+    pkt->flags = flags;
+    pkt->len = len;
+    pkt->delay_us = delay_us;
+    memcpy(pkt->data, data, len);
+}
+
+static void copy_packet(plan *dst, const packet *pkt) {
+    plan_add(dst, pkt->type, pkt->data, pkt->len, pkt->delay_us, pkt->flags);
+}
+
+void plan_add_units(plan *dst, const plan *src, const int *first, int count) {
+    for (int i = 0 ; i < src->count ; i++) {
+        if (src->packets[i].flags & PACKET_PREAMBLE) {
+            copy_packet(dst, &src->packets[i]);
+        }
+    }
+    for (int u = 0 ; u < count ; u++) {
+        for (int i = first[u] ; i < src->count ; i++) {
+            copy_packet(dst, &src->packets[i]);
+            if (src->packets[i].flags & PACKET_COMMIT) {
+                break;
+            }
+        }
+    }
+}
+
+void plan_free(plan *p) {
+    if (p->mapped) {
+        munmap((uint8_t *) p->packets - sizeof(image_header), p->mapped);
+    } else if (p->capacity) {
+        free(p->packets);
+    }
+    p->packets = NULL;
+    p->count = p->capacity = 0;
+    p->mapped = 0;
+}
+
+bool plan_save(const plan *p, const char *model, const char *path) {
+    image_header hdr = {{0}};
+    size_t len = strlen(model);
+    FILE *f = NULL;
+
+    if (len >= sizeof(hdr.model) || (f = fopen(path, "wb")) == NULL) {
+        return false;
+    }
+    memcpy(hdr.magic, IMAGE_MAGIC, 4);
+    memcpy(hdr.model, model, len + 1);
+    hdr.count = p->count;
+    if (fwrite(&hdr, sizeof(hdr), 1, f) != 1 ||
+            fwrite(p->packets, sizeof(packet), p->count, f) != p->count) {
+        fclose(f);
+        return false;
+    }
+    return fclose(f) == 0;
+}
+
+// Images come from files, so every packet is checked before it is sent
+static bool packet_valid(const packet *pkt) {
+    return pkt->len <= PACKET_SIZE &&
+        (pkt->type == PACKET_OUTPUT || pkt->type == PACKET_FEATURE) &&
+        (pkt->flags & ~(PACKET_COMMIT | PACKET_PREAMBLE)) == 0;
+}
+
+bool plan_view(plan *p, const char *model, const void *image, size_t size) {
+    const image_header *hdr = image;
+    const packet *packets = (const packet *) (hdr + 1);
+
+    if (size < sizeof(image_header) ||
+            memcmp(hdr->magic, IMAGE_MAGIC, 4) != 0 ||
+            memchr(hdr->model, 0, sizeof(hdr->model)) == NULL ||
+            (model != NULL && strcmp(hdr->model, model) != 0) ||
+            size != sizeof(image_header) + (size_t) hdr->count * sizeof(packet)) {
+        return false;
+    }
+    for (uint32_t i = 0 ; i < hdr->count ; i++) {
+        if (!packet_valid(&packets[i])) {
+            return false;
+        }
+    }
+    p->packets = (packet *) (hdr + 1);
+    p->count = hdr->count;
+    p->capacity = 0;
+    p->mapped = 0;
+    return true;
+}
+
+bool plan_map(plan *p, const char *model, const char *path) {
+    struct stat st;
+    void *addr = NULL;
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0) {
+        return false;
+    }
+    if (fstat(fd, &st) < 0 || st.st_size < sizeof(image_header)) {
+        close(fd);
+        return false;
+    }
+    addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        return false;
+    }
+    if (!plan_view(p, model, addr, st.st_size)) {
+        munmap(addr, st.st_size);
+        return false;
+    }
+    p->capacity = p->count;
+    p->mapped = st.st_size;
+    return true;
+}
+
+bool image_options_valid(bool write, bool other) {
+    if (dry_run && (compile_only || other || db_path != NULL)) {
+        return false;
+    }
+    if (db_path != NULL && (compile_only || flash_path != NULL || write || other)) {
+        return false;
+    }
+    if (compile_only) {
+        return output_path != NULL && flash_path == NULL && !other;
+    }
+    if (output_path != NULL) {
+        return false;
+    }
+    return flash_path == NULL || (!write && !other);
+}
+
+void save_image(const plan *p, const char *model) {
+    if (!plan_save(p, model, output_path)) {
+        perror(output_path);
+        exit(1);
+    }
+}
+
+void load_image(plan *p, const char *model) {
+    if (!plan_map(p, model, flash_path)) {
+        fprintf(stderr, "'%s' is not a valid %s image\n", flash_path, model);
+        exit(1);
+    }
+}
+
+bool run_image_options(const image_tool *tool) {
+    plan p = {0};
+
+    if (flash_path || db_path) {
+        if (flash_path) {
+            load_image(&p, tool->model);
+        }
+        if (dry_run) {
+            plan_print(&p);
+        } else {
+            tool->init();
+            if (db_path) {
+                db_load_image(&p, tool->model);
+            }
+            tool->run(&p);
+            tool->deinit();
+        }
+    } else if (compile_only || dry_run) {
+        tool->build(&p);
+        if (dry_run) {
+            plan_print(&p);
+        } else {
+            save_image(&p, tool->model);
+        }
+    } else {
+        return false;
+    }
+    plan_free(&p);
+    return true;
+}
+
+void plan_print(const plan *p) {
+    unsigned long long total_us = 0;
+
+    for (int i = 0 ; i < p->count ; i++) {
+        const packet *pkt = &p->packets[i];
+
+        printf("%3d %-7s %8u us ", i, pkt->type == PACKET_FEATURE ? "feature" : "output", pkt->delay_us);
+        for (int j = 0 ; j < pkt->len ; j++) {
+            if (j > 0 && j % 16 == 0) {
+                printf("\n%24s", "");
+            }
+            printf(" %02x", pkt->data[j]);
+        }
+        if (pkt->flags & PACKET_COMMIT) {
+            printf("  [commit%s]", pkt->flags & PACKET_PREAMBLE ? ", preamble" : "");
+        }
+        printf("\n");
+        total_us += pkt->delay_us + PACKET_XFER_US;
+    }
+    printf("%d packets, predicted time %.3f s\n", p->count, total_us / 1e6);
+}
+
+/**
+ * Opens the journal and returns the index of the first packet which has to
+ * be sent. An existing journal is only used if it records the same plan,
+ * otherwise it is overwritten.
+ */
+static int journal_open(int *fd, const plan *p) {
+    journal_header hdr;
+    size_t size = p->count * sizeof(packet);
+    packet *recorded = NULL;
+
+    *fd = open(journal_path, O_RDWR | O_CREAT, 0644);
+    if (*fd < 0) {
+        perror(journal_path);
+        exit(1);
+    }
+    if (pread(*fd, &hdr, sizeof(hdr), 0) == sizeof(hdr) &&
+            memcmp(hdr.magic, JOURNAL_MAGIC, 4) == 0 &&
+            hdr.count == p->count && hdr.acked <= hdr.count) {
+        recorded = malloc(size);
+        if (recorded && pread(*fd, recorded, size, sizeof(hdr)) == (ssize_t) size &&
+                memcmp(recorded, p->packets, size) == 0) {
+            free(recorded);
+            return hdr.acked;
+        }
+        free(recorded);
+    }
+    memcpy(hdr.magic, JOURNAL_MAGIC, 4);
+    hdr.count = p->count;
+    hdr.acked = 0;
+    hdr.reserved = 0;
+    if (ftruncate(*fd, 0) < 0 ||
+            pwrite(*fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+            pwrite(*fd, p->packets, size, sizeof(hdr)) != (ssize_t) size ||
+            fsync(*fd) < 0) {
+        perror(journal_path);
+        exit(1);
+    }
+    return 0;
+}
+
+static void journal_ack(int fd, uint32_t acked) {
+    if (pwrite(fd, &acked, sizeof(acked), offsetof(journal_header, acked)) != sizeof(acked) ||
+            fdatasync(fd) < 0) {
+        perror(journal_path);
+        exit(1);
+    }
+}
+
+static int send_packet(hid_device *dev, const packet *pkt) {
+    uint64_t start = metrics_now();
+    int r = 0;
+
+    if (pkt->type == PACKET_FEATURE) {
+        r = xfer_send_feature(dev, pkt->data, pkt->len);
+    } else {
+        r = xfer_write(dev, pkt->data, pkt->len);
+    }
+    usleep(pkt->delay_us);
+    metrics_observe(pkt->flags & PACKET_PREAMBLE ? METRIC_START_WAIT : METRIC_PEDAL_WRITE, start);
+    return r;
+}
+
+bool plan_run(hid_device *dev, const plan *p) {
+    int fd = -1, start = 0, first = 0, attempt = 0, r = 0;
+
+    if (journal_path != NULL) {
+        start = journal_open(&fd, p);
+    }
+    if (start == p->count && start > 0) {
+        // interrupted after the last acknowledgement, nothing left to send
+        close(fd);
+        unlink(journal_path);
+        return true;
+    }
+    if (start > 0) {
+        fprintf(stderr, "Resuming an interrupted run at packet %d of %d\n", start + 1, p->count);
+    }
+    // a resumed run sends the preamble packets before start again first
+    first = start;
+    for (int i = 0 ; i < p->count ; ) {
+        if (i < start && !(p->packets[i].flags & PACKET_PREAMBLE)) {
+            i++;
+            continue;
+        }
+        r = send_packet(dev, &p->packets[i]);
+        if (r < 0) {
+            if (r == XFER_PERMANENT || attempt >= xfer_policy.retries) {
+                if (fd >= 0) {
+                    close(fd);
+                }
+                return false;
+            }
+            metrics_add(METRIC_RETRIES, 1);
+            xfer_backoff(attempt++);
+            i = i < start ? 0 : first;
+            continue;
+        }
+        i++;
+        if (i > start && ((p->packets[i - 1].flags & PACKET_COMMIT) || i == p->count)) {
+            first = i;
+            attempt = 0;
+            if (fd >= 0) {
+                journal_ack(fd, i);
+            }
+        }
+    }
+    if (fd >= 0) {
+        close(fd);
+        unlink(journal_path);
+    }
+    return true;
+}
@@ -0,0 +1,326 @@
+/*
+Copyright (c) 2012 Radoslav Gerganov <rgerganov@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include "common.h"
+#include "layout.h"
+#include "profile.h"
+
+static void init_pedal(pedal_data *p, int num) {
+    unsigned char default_header[8] = {0x01, 0x81, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00};
+    unsigned char default_data[8] = {0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
+
+    memcpy(p->header, default_header, 8);
+    p->header[3] = num + 1;
+
+    memset(p->data, 0, sizeof(p->data));
+    memcpy(p->data, default_data, 8);
+
+    p->data_len = 8;
+}
+
+void profile_init(profile *pr) {
+    unsigned char start[8] = {0x01, 0x80, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00};
+
+    memcpy(pr->start, start, 8);
+    init_pedal(&pr->pedals[0], 0);
+    init_pedal(&pr->pedals[1], 1);
+    init_pedal(&pr->pedals[2], 2);
+    pr->curr = &pr->pedals[1]; // start at the second pedal
+    pr->error[0] = 0;
+}
+
+static enum profile_status fail(profile *pr, enum profile_status status, const char *fmt, ...) {
+    va_list ap;
+
+    va_start(ap, fmt);
+    vsnprintf(pr->error, sizeof(pr->error), fmt, ap);
+    va_end(ap);
+    return status;
+}
+
+#define CONFLICT(pr) fail(pr, PROFILE_CONFLICT, "Invalid combination of options")
+
+/**
+ * The following types are valid:
+ *   KEY_TYPE,
+ *   MOUSE_TYPE,
+ *   KEY_TYPE | MOUSE_TYPE,
+ *   STRING_TYPE
+ */
+static bool set_pedal_type(pedal_data *pedal, unsigned char new_type) {
+    unsigned char *curr_type = &pedal->data[FOOTSWITCH_TYPE];
+    // check if there is no type set (default)
+    if (*curr_type == 0) {
+        // set type and data_len
+        *curr_type = new_type;
+        if (new_type == STRING_TYPE) {
+            pedal->data_len = 2;
+        }
+        return true;
+    }
+    // type is already set, check if we can add the new type
+    switch (new_type) {
+        case STRING_TYPE:
+            return *curr_type == STRING_TYPE;
+        case KEY_TYPE:
+        case MOUSE_TYPE:
+            if (*curr_type == STRING_TYPE) {
+                return false;
+            }
+            *curr_type |= new_type;
+            return true;
+    }
+    return false;
+}
+
+static enum profile_status compile_string_data(profile *pr, unsigned char *data, size_t len) {
+    pedal_data *pedal = pr->curr;
+
+    if (pedal->data_len + len > 40) {
+        return fail(pr, PROFILE_INVALID, "The size of the accumulated string must be <= 38");
+    }
+    memcpy(&pedal->data[pedal->data_len], data, len);
+    pedal->data_len += len;
+    pedal->header[2] = pedal->data_len;
+    pedal->data[FOOTSWITCH_LEN] = pedal->data_len;
+    return PROFILE_OK;
+}
+
+static enum profile_status compile_string(profile *pr, const char *str) {
+    keystroke keys[38];
+    unsigned char arr[40] = {0};
+    int len = 0;
+
+    if (!set_pedal_type(pr->curr, STRING_TYPE)) {
+        return CONFLICT(pr);
+    }
+    if ((len = encode_text(str, keys, 38)) == -2) {
+        return fail(pr, PROFILE_INVALID, "The size of each string must be <= 38");
+    }
+    if (len < 0) {
+        return fail(pr, PROFILE_INVALID, "Cannot encode string: '%s'", str);
+    }
+    // strings mark shifted keys with bit 7 and have no other modifiers
+    for (int i = 0 ; i < len ; i++) {
+        if ((keys[i].modifiers & ~SHIFT) != 0) {
+            return fail(pr, PROFILE_INVALID, "Cannot type '%s' without AltGr", str);
+        }
+        arr[i] = keys[i].code | (keys[i].modifiers != 0 ? 0x80 : 0);
+    }
+    return compile_string_data(pr, arr, len);
+}
+
+static enum profile_status compile_string_key(profile *pr, const char *key) {
+    unsigned char b;
+
+    if (!set_pedal_type(pr->curr, STRING_TYPE)) {
+        return CONFLICT(pr);
+    }
+    if (!encode_key(key, &b)) {
+        return fail(pr, PROFILE_INVALID, "Cannot encode key '%s'", key);
+    }
+    return compile_string_data(pr, &b, 1);
+}
+
+static enum profile_status compile_raw_string(profile *pr, char *str) {
+    unsigned char arr[40];
+    int ind = 0;
+    char *tok = NULL, *save = NULL;
+
+    if (!set_pedal_type(pr->curr, STRING_TYPE)) {
+        return CONFLICT(pr);
+    }
+    tok = strtok_r(str, " ,", &save);
+    while (tok != NULL && ind < 38) {
+        int val;
+        if (sscanf(tok, "%x", &val) == 1) {
+            arr[ind++] = val;
+        } else {
+            return fail(pr, PROFILE_INVALID, "'%s' is invalid hex number", tok);
+        }
+        tok = strtok_r(NULL, " ,", &save);
+    }
+    if (tok != NULL) {
+        return fail(pr, PROFILE_INVALID, "The size of each string must be <= 38");
+    }
+    return compile_string_data(pr, arr, ind);
+}
+
+static enum profile_status compile_key(profile *pr, const char *key) {
+    unsigned char b = 0;
+
+    if (!set_pedal_type(pr->curr, KEY_TYPE)) {
+        return CONFLICT(pr);
+    }
+    if (!encode_key(key, &b)) {
+        return fail(pr, PROFILE_INVALID, "Cannot encode key '%s'", key);
+    }
+    pr->curr->data[FOOTSWITCH_KEY] = b;
+    return PROFILE_OK;
+}
+
+static enum profile_status compile_modifier(profile *pr, const char *mod_str) {
+    enum modifier mod;
+
+    if (!parse_modifier(mod_str, &mod)) {
+        return fail(pr, PROFILE_INVALID, "Invalid modifier '%s'", mod_str);
+    }
+    if (!set_pedal_type(pr->curr, KEY_TYPE)) {
+        return CONFLICT(pr);
+    }
+    pr->curr->data[FOOTSWITCH_MOD] |= mod;
+    return PROFILE_OK;
+}
+
+static enum profile_status compile_mouse_button(profile *pr, const char *btn_str) {
+    enum mouse_button btn;
+
+    if (!parse_mouse_button(btn_str, &btn)) {
+        return fail(pr, PROFILE_INVALID, "Invalid mouse button '%s'", btn_str);
+    }
+    if (!set_pedal_type(pr->curr, MOUSE_TYPE)) {
+        return CONFLICT(pr);
+    }
+    pr->curr->data[FOOTSWITCH_BUTTON] = btn;
+    return PROFILE_OK;
+}
+
+static enum profile_status compile_combo(profile *pr, const char *expr) {
+    combo combos[38];
+    unsigned char arr[38];
+    int count = parse_combos(expr, combos, 38, pr->error, sizeof(pr->error));
+
+    if (count < 0) {
+        return PROFILE_INVALID;
+    }
+    // a sequence is typed as a string, which has no modifiers
+    if (count > 1) {
+        for (int i = 0 ; i < count ; i++) {
+            if (combos[i].key_count != 1 || combos[i].modifiers != 0 || combos[i].buttons != 0) {
+                return fail(pr, PROFILE_INVALID, "A sequence can only have single keys: '%s'", expr);
+            }
+            arr[i] = combos[i].keys[0];
+        }
+        if (!set_pedal_type(pr->curr, STRING_TYPE)) {
+            return CONFLICT(pr);
+        }
+        return compile_string_data(pr, arr, count);
+    }
+    if (combos[0].key_count > 1) {
+        return fail(pr, PROFILE_INVALID, "A pedal can press only one key: '%s'", expr);
+    }
+    if (combos[0].key_count > 0 || combos[0].modifiers != 0) {
+        if (!set_pedal_type(pr->curr, KEY_TYPE)) {
+            return CONFLICT(pr);
+        }
+        pr->curr->data[FOOTSWITCH_MOD] |= combos[0].modifiers;
+        if (combos[0].key_count > 0) {
+            pr->curr->data[FOOTSWITCH_KEY] = combos[0].keys[0];
+        }
+    }
+    if (combos[0].buttons != 0) {
+        if (!set_pedal_type(pr->curr, MOUSE_TYPE)) {
+            return CONFLICT(pr);
+        }
+        pr->curr->data[FOOTSWITCH_BUTTON] = combos[0].buttons;
+    }
+    return PROFILE_OK;
+}
+
+static enum profile_status compile_mouse_xyw(profile *pr, int opt, const char *arg, const layout_field *f) {
+    int val = atoi(arg);
+
+    if (!set_pedal_type(pr->curr, MOUSE_TYPE)) {
+        return CONFLICT(pr);
+    }
+    if (!layout_encode(f, pr->curr->data, val)) {
+        return fail(pr, PROFILE_INVALID, "'%c' must be in [%d, %d]", opt, f->min, f->max);
+    }
+    return PROFILE_OK;
+}
+
+enum profile_status profile_option(profile *pr, int opt, char *arg) {
+    switch (opt) {
+        case '1':
+        case '2':
+        case '3':
+            pr->curr = &pr->pedals[opt - '1'];
+            return PROFILE_OK;
+        case 's':
+            return compile_string(pr, arg);
+        case 'S':
+            return compile_raw_string(pr, arg);
+        case 'a':
+            return compile_string_key(pr, arg);
+        case 'k':
+            return compile_key(pr, arg);
+        case 'm':
+            return compile_modifier(pr, arg);
+        case 'b':
+            return compile_mouse_button(pr, arg);
+        case 'c':
+            return compile_combo(pr, arg);
+        case 'x':
+            return compile_mouse_xyw(pr, opt, arg, LAYOUT_FIELD(FOOTSWITCH, X));
+        case 'y':
+            return compile_mouse_xyw(pr, opt, arg, LAYOUT_FIELD(FOOTSWITCH, Y));
+        case 'w':
+            return compile_mouse_xyw(pr, opt, arg, LAYOUT_FIELD(FOOTSWITCH, W));
+    }
+    return fail(pr, PROFILE_INVALID, "Invalid option '-%c'", opt);
+}
+
+bool profile_is_option(int opt) {
+    return opt > 0 && opt < 0x100 && strchr("123sSakmbcxyw", opt) != NULL;
+}
+
+bool profile_option_has_arg(int opt) {
+    return profile_is_option(opt) && (opt < '1' || opt > '3');
+}
+
+// Each pedal is a self-contained header + data sequence which ends with a commit point
+static void plan_pedal(plan *p, const pedal_data *pedal, const pacing *pace) {
+    unsigned char data[8];
+    int arr_ind = 0, data_ind = 0;
+
+    plan_add(p, PACKET_OUTPUT, pedal->header, 8, pace->gap_us, 0);
+    memset(data, 0, 8);
+    while (arr_ind < pedal->data_len) {
+        if (data_ind == 8) {
+            plan_add(p, PACKET_OUTPUT, data, 8, pace->gap_us, 0);
+            memset(data, 0, 8);
+            data_ind = 0;
+        }
+        data[data_ind++] = pedal->data[arr_ind++];
+    }
+    plan_add(p, PACKET_OUTPUT, data, 8, pace->gap_us, PACKET_COMMIT);
+}
+
+void profile_plan(const profile *pr, const pacing *pace, plan *p) {
+    plan_add(p, PACKET_OUTPUT, pr->start, 8, pace->gap_us + pace->start_us, PACKET_COMMIT | PACKET_PREAMBLE);
+    plan_pedal(p, &pr->pedals[0], pace);
+    plan_pedal(p, &pr->pedals[1], pace);
+    plan_pedal(p, &pr->pedals[2], pace);
+}
@@ -0,0 +1,292 @@
+/*
+Copyright (c) 2012 Radoslav Gerganov <rgerganov@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "device.h"
+#include "profiledb.h"
+#include "debug.h"
+
+#define ALIGN(x) (((x) + 7) & ~(size_t) 7)
+
+const char *db_path = NULL;
+
+// FNV-1a
+static uint32_t hash_key(const char *key) {
+    uint32_t h = 2166136261u;
+
+    while (*key) {
+        h = (h ^ (uint8_t) *key++) * 16777619u;
+    }
+    return h;
+}
+
+static const profiledb_slot *slots(const profiledb *db) {
+    return (const profiledb_slot *) (db->base + sizeof(profiledb_header));
+}
+
+// The key of a slot, or NULL if the slot points outside of the file
+static const char *slot_key(const profiledb *db, const profiledb_slot *s) {
+    if (s->key_offset >= db->size || memchr(db->base + s->key_offset, 0, db->size - s->key_offset) == NULL) {
+        return NULL;
+    }
+    return (const char *) db->base + s->key_offset;
+}
+
+// The image of a slot, aligned as profiledb_build() writes it, with valid packets
+static bool slot_image(const profiledb *db, const profiledb_slot *s, const char *model, plan *p) {
+    if (s->image_offset > db->size || s->image_size > db->size - s->image_offset || s->image_offset % 8 != 0) {
+        return false;
+    }
+    return plan_view(p, model, db->base + s->image_offset, s->image_size);
+}
+
+bool profiledb_open(profiledb *db, const char *path) {
+    const profiledb_header *hdr = NULL;
+    struct stat st;
+    void *addr = NULL;
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0) {
+        return false;
+    }
+    if (fstat(fd, &st) < 0 || st.st_size < sizeof(profiledb_header)) {
+        close(fd);
+        return false;
+    }
+    addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        return false;
+    }
+    hdr = addr;
+    if (memcmp(hdr->magic, PROFILEDB_MAGIC, 4) != 0 || hdr->slots == 0 || (hdr->slots & (hdr->slots - 1)) != 0 ||
+            hdr->count >= hdr->slots || sizeof(profiledb_header) + (size_t) hdr->slots * sizeof(profiledb_slot) > st.st_size) {
+        munmap(addr, st.st_size);
+        return false;
+    }
+    db->base = addr;
+    db->size = st.st_size;
+    return true;
+}
+
+void profiledb_close(profiledb *db) {
+    if (db->base != NULL) {
+        munmap((void *) db->base, db->size);
+    }
+    db->base = NULL;
+    db->size = 0;
+}
+
+bool profiledb_lookup(const profiledb *db, const char *key, const char *model, plan *p) {
+    const profiledb_header *hdr = (const profiledb_header *) db->base;
+    uint32_t h = hash_key(key), mask = hdr->slots - 1;
+
+    for (uint32_t i = 0 ; i < hdr->slots ; i++) {
+        const profiledb_slot *s = &slots(db)[(h + i) & mask];
+        const char *k = NULL;
+        if (s->key_offset == 0) {
+            return false;
+        }
+        if (s->hash != h || (k = slot_key(db, s)) == NULL || strcmp(k, key) != 0) {
+            continue;
+        }
+        return slot_image(db, s, model, p);
+    }
+    return false;
+}
+
+// A pass over the whole file, so it is left out of profiledb_open()
+bool profiledb_check(const profiledb *db) {
+    const profiledb_header *hdr = (const profiledb_header *) db->base;
+    uint32_t count = 0;
+    plan p;
+
+    for (uint32_t i = 0 ; i < hdr->slots ; i++) {
+        const profiledb_slot *s = &slots(db)[i];
+        if (s->key_offset == 0) {
+            continue;
+        }
+        if (slot_key(db, s) == NULL || !slot_image(db, s, NULL, &p)) {
+            return false;
+        }
+        count++;
+    }
+    return count == hdr->count;
+}
+
+void profiledb_foreach(const profiledb *db, void (*fn)(const char *key, const image_header *hdr)) {
+    const profiledb_header *hdr = (const profiledb_header *) db->base;
+
+    for (uint32_t i = 0 ; i < hdr->slots ; i++) {
+        const profiledb_slot *s = &slots(db)[i];
+        const char *key = slot_key(db, s);
+        plan p;
+        if (s->key_offset == 0 || key == NULL || !slot_image(db, s, NULL, &p)) {
+            continue;
+        }
+        fn(key, (const image_header *) (db->base + s->image_offset));
+    }
+}
+
+static void *read_file(const char *path, size_t *size) {
+    struct stat st;
+    void *data = NULL;
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0) {
+        return NULL;
+    }
+    if (fstat(fd, &st) == 0 && (data = malloc(st.st_size + 1)) != NULL) {
+        if (read(fd, data, st.st_size) != st.st_size) {
+            free(data);
+            data = NULL;
+        }
+        *size = st.st_size;
+    }
+    close(fd);
+    return data;
+}
+
+static bool write_padding(FILE *f, size_t to) {
+    while (ftell(f) < (long) to) {
+        if (fputc(0, f) == EOF) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool profiledb_build(const char *path, char *const keys[], char *const images[], int count) {
+    profiledb_header hdr = {PROFILEDB_MAGIC};
+    profiledb_slot *table = NULL;
+    int *index = NULL;
+    void **data = calloc(count + 1, sizeof(void *));
+    size_t *sizes = calloc(count + 1, sizeof(size_t));
+    size_t offset = 0;
+    char tmp[4096];
+    FILE *f = NULL;
+    bool ok = false;
+    plan p;
+
+    hdr.slots = 1;
+    while (hdr.slots < 2 * (uint32_t) count) {
+        hdr.slots *= 2;
+    }
+    hdr.count = count;
+    table = calloc(hdr.slots, sizeof(profiledb_slot));
+    index = calloc(hdr.slots, sizeof(int));
+    if (data == NULL || sizes == NULL || table == NULL || index == NULL) {
+        goto out;
+    }
+    // the keys follow the table in the order of the arguments, then the
+    // images in the order of the slots, 8-byte aligned
+    offset = sizeof(hdr) + hdr.slots * sizeof(profiledb_slot);
+    for (int i = 0 ; i < count ; i++) {
+        uint32_t h = hash_key(keys[i]), j = h & (hdr.slots - 1);
+        if ((data[i] = read_file(images[i], &sizes[i])) == NULL || !plan_view(&p, NULL, data[i], sizes[i])) {
+            fprintf(stderr, "'%s' is not a valid image\n", images[i]);
+            goto out;
+        }
+        while (table[j].key_offset != 0) {
+            if (table[j].hash == h && strcmp(keys[index[j]], keys[i]) == 0) {
+                fprintf(stderr, "Duplicate key '%s'\n", keys[i]);
+                goto out;
+            }
+            j = (j + 1) & (hdr.slots - 1);
+        }
+        table[j].hash = h;
+        table[j].key_offset = offset;
+        index[j] = i;
+        offset += strlen(keys[i]) + 1;
+    }
+    for (uint32_t j = 0 ; j < hdr.slots ; j++) {
+        if (table[j].key_offset != 0) {
+            offset = ALIGN(offset);
+            table[j].image_offset = offset;
+            table[j].image_size = sizes[index[j]];
+            offset += sizes[index[j]];
+        }
+    }
+    if (offset > UINT32_MAX) {
+        fprintf(stderr, "The database is too large\n");
+        goto out;
+    }
+    snprintf(tmp, sizeof(tmp), "%s.%d.tmp", path, getpid());
+    if ((f = fopen(tmp, "wb")) == NULL) {
+        perror(tmp);
+        goto out;
+    }
+    ok = fwrite(&hdr, sizeof(hdr), 1, f) == 1 && fwrite(table, sizeof(profiledb_slot), hdr.slots, f) == hdr.slots;
+    for (int i = 0 ; i < count && ok ; i++) {
+        ok = fwrite(keys[i], strlen(keys[i]) + 1, 1, f) == 1;
+    }
+    for (uint32_t j = 0 ; j < hdr.slots && ok ; j++) {
+        if (table[j].key_offset != 0) {
+            ok = write_padding(f, table[j].image_offset) && fwrite(data[index[j]], sizes[index[j]], 1, f) == 1;
+        }
+    }
+    // the new database replaces the old one only once it is complete
+    ok = fflush(f) == 0 && fsync(fileno(f)) == 0 && ok;
+    if (fclose(f) != 0 || !ok || rename(tmp, path) < 0) {
+        perror(path);
+        unlink(tmp);
+        ok = false;
+    }
+out:
+    for (int i = 0 ; i < count && data != NULL ; i++) {
+        free(data[i]);
+    }
+    free(data);
+    free(sizes);
+    free(table);
+    free(index);
+    return ok;
+}
+
+void db_load_image(plan *p, const char *model) {
+    static profiledb db;
+    char key[128];
+    device_id id;
+
+    if (db.base == NULL && !profiledb_open(&db, db_path)) {
+        fprintf(stderr, "'%s' is not a valid profile database\n", db_path);
+        exit(1);
+    }
+    if (get_device_serial(key, sizeof(key)) && profiledb_lookup(&db, key, model, p)) {
+        diag("Using the image of serial number '%s'", key);
+        return;
+    }
+    if (get_device_id(&id)) {
+        snprintf(key, sizeof(key), "%04x:%04x", id.vid, id.pid);
+        if (profiledb_lookup(&db, key, model, p)) {
+            diag("Using the image of %s", key);
+            return;
+        }
+    }
+    fprintf(stderr, "No %s image for the device in '%s'\n", model, db_path);
+    exit(1);
+}
@@ -26,8 +26,17 @@ THE SOFTWARE.
 #include <unistd.h>
 #include <hidapi.h>
 #include "common.h"
+#include "device.h"
+#include "layout.h"
+#include "metrics.h"
+#include "plan.h"
+#include "profiledb.h"
+#include "transfer.h"
 #include "debug.h"
 
+// How long the device may take to come back after --reset
+#define RESET_TIMEOUT_MS 5000
+
 hid_device *dev = NULL;
 
 const unsigned char KEY_DATA[13] = {0x06, 0x00, 0x08, 0x01, 0x00, 0x00, 0x00, 0x00,
@@ -37,7 +46,7 @@ const unsigned char MOUSE_DATA[12] = {0x06, 0x00, 0x08, 0x04, 0x00, 0x00, 0x00,
 
 typedef struct pedal_data
 {
-    unsigned char data[16];
+    unsigned char data[SCYTHE_SIZE];
     int data_len;
 } pedal_data;
 
@@ -46,22 +55,28 @@ int curr_pedal = 1;
 
 void usage()
 {
-    fprintf(stderr, "Usage: scythe [-123] [-r] [-a <key>] [-m <modifier>] [-b <button>]\n"
+    fprintf(stderr, "Usage: scythe [-123] [-r] [-a <key>] [-m <modifier>] [-b <button>] [-c <combo>]\n"
         "   -r          - read all pedals\n"
         "   -1          - program the first pedal\n"
         "   -2          - program the second pedal (default)\n"
         "   -3          - program the third pedal\n"
         "   -a key      - append the specified key\n"
         "   -m modifier - ctrl|shift|alt|win\n"
-        "   -b button   - mouse_left|mouse_middle|mouse_right|mouse_double\n\n"
+        "   -b button   - mouse_left|mouse_middle|mouse_right|mouse_double\n"
+        "   -c combo    - keys and modifiers or a button joined with +, e.g. ctrl+h+o\n"
+        DEVICE_USAGE "\n"
         "You cannot mix -a and -m options with -b option for one and the same pedal\n");
     exit(1);
 }
 
 void init()
 {
+    static const unsigned short vid_pid[][2] = {
+        SCYTHE_DEVICES(LAYOUT_VID_PID)
+    };
+
     hid_init();
-    dev = hid_open(0x0426, 0x3011, NULL);
+    dev = open_device(vid_pid, sizeof(vid_pid) / sizeof(vid_pid[0]), -1);
     if (dev == NULL) {
         fatal("Cannot find Scythe pedal with VID:PID=0426:3011.\nCheck that a Scythe device is connected and that you have the correct permissions to access it.");
     }
@@ -69,95 +84,109 @@ void init()
 
 void deinit()
 {
-    hid_close(dev);
+    close_device(dev);
     hid_exit();
 }
 
-void print_mouse(unsigned char data[])
+#define DESCRIPTION_SIZE 128
+
+// The decoders append a pedal, in the layout of a query response, to out
+void describe_mouse(const unsigned char data[], char *out)
 {
-    switch (data[1]) {
+    switch (data[SCYTHE_RESPONSE_BUTTON]) {
         case 0x81:
-            printf("mouse_left");
+            strcat(out, "mouse_left");
             break;
         case 0x82:
-            printf("mouse_right");
+            strcat(out, "mouse_right");
             break;
         case 0x84:
-            printf("mouse_middle");
+            strcat(out, "mouse_middle");
             break;
         case 0x80:
-            printf("mouse_double");
+            strcat(out, "mouse_double");
             break;
     }
 }
 
-void print_key(unsigned char data[])
+void describe_key(const unsigned char data[], char *out)
 {
     char combo[128] = {0};
-    int ind = 3;
-    if ((data[1] & CTRL) != 0) {
+    const layout_field *keys = LAYOUT_FIELD(SCYTHE_RESPONSE, KEY1);
+    if ((data[SCYTHE_RESPONSE_MOD] & CTRL) != 0) {
         strcat(combo, "ctrl+");
     }
-    if ((data[1] & SHIFT) != 0) {
+    if ((data[SCYTHE_RESPONSE_MOD] & SHIFT) != 0) {
         strcat(combo, "shift+");
     }
-    if ((data[1] & ALT) != 0) {
+    if ((data[SCYTHE_RESPONSE_MOD] & ALT) != 0) {
         strcat(combo, "alt+");
     }
-    if ((data[1] & WIN) != 0) {
+    if ((data[SCYTHE_RESPONSE_MOD] & WIN) != 0) {
         strcat(combo, "win+");
     }
-    while (data[ind] != 0 && ind <= 7) {
-        const char *key = decode_byte(data[ind]);
+    for (int i = 0 ; i < 5 && data[keys[i].offset] != 0 ; i++) {
+        const char *key = decode_byte(data[keys[i].offset]);
         strcat(combo, key);
         strcat(combo, "+");
-        ind++;
     }
     size_t len = strlen(combo);
     if (len > 0) {
         combo[len - 1] = 0; // remove the last +
     }
-    printf("%s", combo);
+    strcat(out, combo);
 }
 
-void read_pedals()
+bool is_mouse(unsigned char type)
+{
+    return (type >= 0x80 && type <= 0x82) || type == 0x84;
+}
+
+void query_pedal(int num, unsigned char response[SCYTHE_RESPONSE_SIZE])
 {
-    int r = 0, i = 0;
     unsigned char query[8] = {0x06, 0xbb, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
-    unsigned char response[20];
+    int r = 0;
 
-    for (i = 0 ; i < 3 ; i++) {
-        query[0] = 6;
-        query[1] = 0xbb;
-        query[2] = i + 1;
-        r = hid_send_feature_report(dev, query, 8);
-        if (r < 0) {
-            fatal("error sending feature report (%ls)", hid_error(dev));
-        }
-        r = hid_get_feature_report(dev, response, 8);
-        if (r < 0) {
-            fatal("error getting feature report (%ls)", hid_error(dev));
-        }
-        //debug_arr(response, 8);
+    query[2] = num + 1;
+    r = xfer_send_feature(dev, query, 8);
+    if (r < 0) {
+        fatal("error sending feature report (%ls)", xfer_error(dev));
+    }
+    r = xfer_get_feature(dev, response, SCYTHE_RESPONSE_SIZE);
+    if (r < 0) {
+        fatal("error getting feature report (%ls)", xfer_error(dev));
+    }
+}
 
-        printf("[switch %d]: ", i + 1);
-        if ((response[1] >= 0x80 && response[1] <= 0x82) || response[1] == 0x84) {
-            print_mouse(response);
-        } else if (response[1] == 0xff) {
-            printf("undefined");
-        } else {
-            print_key(response);
-        }
-        printf("\n");
+void describe_pedal(const unsigned char response[SCYTHE_RESPONSE_SIZE], char out[DESCRIPTION_SIZE])
+{
+    unsigned char type = response[SCYTHE_RESPONSE_MOD];
+
+    out[0] = 0;
+    if (is_mouse(type)) {
+        describe_mouse(response, out);
+    } else if (type == 0xff) {
+        strcat(out, "undefined");
+    } else {
+        describe_key(response, out);
     }
 }
 
-void compile_key_repeat(const char *key)
+void read_pedals()
 {
-    unsigned char b = 0;
-    int i;
-    int indarr[5] = {6, 7, 9, 10, 11};
+    int i = 0;
+    unsigned char response[SCYTHE_RESPONSE_SIZE];
+    char text[DESCRIPTION_SIZE];
 
+    for (i = 0 ; i < 3 ; i++) {
+        query_pedal(i, response);
+        describe_pedal(response, text);
+        printf("[switch %d]: %s\n", i + 1, text);
+    }
+}
+
+void set_key_type()
+{
     if (pedals[curr_pedal].data_len == 12) {
         fprintf(stderr, "Invalid combination of options\n");
         usage();
@@ -166,14 +195,17 @@ void compile_key_repeat(const char *key)
         memcpy(pedals[curr_pedal].data, KEY_DATA, 13);
         pedals[curr_pedal].data_len = 13;
     }
-    pedals[curr_pedal].data[1] = curr_pedal + 1;
+    pedals[curr_pedal].data[SCYTHE_PEDAL] = curr_pedal + 1;
+}
 
-    if (!encode_key(key, &b)) {
-        fprintf(stderr, "Cannot encode key '%s'\n", key);
-        exit(1);
-    }
+void add_key(unsigned char b)
+{
+    int i;
+    const layout_field *keys = LAYOUT_FIELD(SCYTHE, KEY1);
+
+    set_key_type();
     for (i = 0 ; i < 5 ; i++) {
-        int ind = indarr[i];
+        int ind = keys[i].offset;
         if (pedals[curr_pedal].data[ind] == 0) {
             pedals[curr_pedal].data[ind] = b;
             return;
@@ -183,36 +215,33 @@ void compile_key_repeat(const char *key)
     exit(1);
 }
 
-void compile_modifier(const char *mod_str)
+void compile_key_repeat(const char *key)
 {
-    enum modifier mod;
+    unsigned char b = 0;
 
-    if (pedals[curr_pedal].data_len == 12) {
-        fprintf(stderr, "Invalid combination of options\n");
-        usage();
-    }
-    if (pedals[curr_pedal].data_len == 0) {
-        memcpy(pedals[curr_pedal].data, KEY_DATA, 13);
-        pedals[curr_pedal].data_len = 13;
+    set_key_type();
+    if (!encode_key(key, &b)) {
+        fprintf(stderr, "Cannot encode key '%s'\n", key);
+        exit(1);
     }
-    pedals[curr_pedal].data[1] = curr_pedal + 1;
+    add_key(b);
+}
 
+void compile_modifier(const char *mod_str)
+{
+    enum modifier mod;
+
+    set_key_type();
     if (!parse_modifier(mod_str, &mod)) {
         fprintf(stderr, "Invlalid modifier '%s'\n", mod_str);
         exit(1);
     }
 
-    pedals[curr_pedal].data[4] |= mod;
+    pedals[curr_pedal].data[SCYTHE_MOD] |= mod;
 }
 
-void compile_mouse_button(const char *btn_str)
+void set_mouse_button(enum mouse_button btn)
 {
-    enum mouse_button btn;
-
-    if (!parse_mouse_button(btn_str, &btn)) {
-        fprintf(stderr, "Invalid mouse button '%s'\n", btn_str);
-        exit(1);
-    }
     if (pedals[curr_pedal].data_len == 13) {
         fprintf(stderr, "Invalid combination of options\n");
         usage();
@@ -221,71 +250,270 @@ void compile_mouse_button(const char *btn_str)
         memcpy(pedals[curr_pedal].data, MOUSE_DATA, 12);
         pedals[curr_pedal].data_len = 12;
     }
-    pedals[curr_pedal].data[1] = curr_pedal + 1;
+    pedals[curr_pedal].data[SCYTHE_PEDAL] = curr_pedal + 1;
     switch (btn) {
         case MOUSE_LEFT:
-            pedals[curr_pedal].data[4] = 0x81;
+            pedals[curr_pedal].data[SCYTHE_BUTTON] = 0x81;
             break;
         case MOUSE_RIGHT:
-            pedals[curr_pedal].data[4] = 0x82;
+            pedals[curr_pedal].data[SCYTHE_BUTTON] = 0x82;
             break;
         case MOUSE_MIDDLE:
-            pedals[curr_pedal].data[4] = 0x84;
+            pedals[curr_pedal].data[SCYTHE_BUTTON] = 0x84;
             break;
         case MOUSE_DOUBLE:
-            pedals[curr_pedal].data[4] = 0x80;
+            pedals[curr_pedal].data[SCYTHE_BUTTON] = 0x80;
             break;
     }
 }
 
-void send_report(unsigned char *ptr, int len)
+void compile_mouse_button(const char *btn_str)
 {
-    int r;
-    //debug_arr(ptr, len);
-    r = hid_send_feature_report(dev, ptr, len);
-    if (r < 0) {
-        fprintf(stderr, "Error sending feature report\n");
+    enum mouse_button btn;
+
+    if (!parse_mouse_button(btn_str, &btn)) {
+        fprintf(stderr, "Invalid mouse button '%s'\n", btn_str);
+        exit(1);
     }
-    usleep(200 * 1000);
+    set_mouse_button(btn);
 }
 
-void write_pedals() {
+void compile_combo(const char *expr)
+{
+    combo c;
+    char err[128];
+    int count = parse_combos(expr, &c, 1, err, sizeof(err));
+
+    if (count < 0) {
+        fprintf(stderr, "%s\n", err);
+        exit(1);
+    }
+    if (c.buttons != 0) {
+        // a pedal sends one button only, without modifiers
+        if ((c.buttons & (c.buttons - 1)) != 0 || c.key_count != 0 || c.modifiers != 0) {
+            fprintf(stderr, "Invalid combination of options\n");
+            usage();
+        }
+        set_mouse_button(c.buttons);
+        return;
+    }
+    set_key_type();
+    pedals[curr_pedal].data[SCYTHE_MOD] |= c.modifiers;
+    for (int i = 0 ; i < c.key_count ; i++) {
+        add_key(c.keys[i]);
+    }
+}
+
+void send_report(plan *p, unsigned char *ptr, int len, int flags)
+{
+    //debug_arr(ptr, len);
+    plan_add(p, PACKET_FEATURE, ptr, len, 200 * 1000, flags);
+}
+
+void build_plan(plan *p) {
     int i = 0;
     unsigned char nop[8] = {0x06, 0x00, 0x00, 0xff, 0x00, 0x00, 0x00, 0x00};
     unsigned char end[8] = {0x06, 0xaa, 0xff, 0xff, 0x00, 0x00, 0x00, 0x00};
 
-    send_report(nop, 8);
+    send_report(p, nop, 8, PACKET_COMMIT | PACKET_PREAMBLE);
 
+    // a configured pedal takes two reports, both are sent again if either fails
     for (i = 0 ; i < 3 ; i++) {
         if (pedals[i].data_len > 0) {
-            send_report(&pedals[i].data[0], 8);
-            send_report(&pedals[i].data[8], 8);
+            send_report(p, &pedals[i].data[0], 8, 0);
+            send_report(p, &pedals[i].data[8], 8, PACKET_COMMIT);
         } else {
             nop[1] = i + 1;
-            send_report(nop, 8);
+            send_report(p, nop, 8, PACKET_COMMIT);
         }
     }
     nop[1] = 4;
-    send_report(nop, 8);
+    send_report(p, nop, 8, PACKET_COMMIT);
     nop[1] = 5;
-    send_report(nop, 8);
-    send_report(end, 8);
-    printf("Done. Unplug the footswitch and then plug it back again.\n");
+    send_report(p, nop, 8, PACKET_COMMIT);
+    send_report(p, end, 8, PACKET_COMMIT);
 }
 
-int main(int argc, char *argv[]) {
-    int opt;
+// The pedals configured by a plan, taken from its packets so that images
+// can be checked as well. first[] is the packet which starts each pedal.
+// Returns a mask of the pedals.
+int planned_pedals(const plan *p, unsigned char data[3][SCYTHE_SIZE], int first[3])
+{
+    int mask = 0;
 
-    if (argc == 1) {
-        usage();
+    for (int i = 0 ; i + 1 < p->count ; i++) {
+        const uint8_t *packet = p->packets[i].data;
+        int num = packet[SCYTHE_PEDAL] - 1;
+        if (packet[2] != 0x08 || num < 0 || num > 2) {
+            continue;
+        }
+        memcpy(data[num], packet, 8);
+        memcpy(&data[num][8], p->packets[i + 1].data, 8);
+        first[num] = i;
+        mask |= 1 << num;
+        i++;
     }
-    if (argc == 2 && strcmp(argv[1], "-r") == 0) {
-        init();
-        read_pedals();
-        deinit();
-        return 0;
+    return mask;
+}
+
+// What a query of the pedal answers once data is active
+void expected_response(const unsigned char data[SCYTHE_SIZE], unsigned char response[SCYTHE_RESPONSE_SIZE])
+{
+    const layout_field *keys = LAYOUT_FIELD(SCYTHE, KEY1);
+    const layout_field *response_keys = LAYOUT_FIELD(SCYTHE_RESPONSE, KEY1);
+
+    memset(response, 0, SCYTHE_RESPONSE_SIZE);
+    response[SCYTHE_RESPONSE_MOD] = data[SCYTHE_MOD];
+    for (int k = 0 ; k < 5 && !is_mouse(data[SCYTHE_MOD]) ; k++) {
+        response[response_keys[k].offset] = data[keys[k].offset];
+    }
+}
+
+bool pedal_matches(const unsigned char data[SCYTHE_SIZE], const unsigned char response[SCYTHE_RESPONSE_SIZE])
+{
+    unsigned char expected[SCYTHE_RESPONSE_SIZE];
+
+    expected_response(data, expected);
+    if (is_mouse(data[SCYTHE_MOD])) {
+        return response[SCYTHE_RESPONSE_MOD] == expected[SCYTHE_RESPONSE_MOD];
+    }
+    return response[SCYTHE_RESPONSE_MOD] == expected[SCYTHE_RESPONSE_MOD] &&
+        memcmp(&response[SCYTHE_RESPONSE_KEY1], &expected[SCYTHE_RESPONSE_KEY1], 5) == 0;
+}
+
+// Checks that the device reports the configuration of the plan
+bool plan_active(const plan *p)
+{
+    unsigned char data[3][SCYTHE_SIZE], response[SCYTHE_RESPONSE_SIZE];
+    int first[3];
+    int mask = planned_pedals(p, data, first);
+
+    for (int i = 0 ; i < 3 ; i++) {
+        if ((mask & (1 << i)) == 0) {
+            continue;
+        }
+        query_pedal(i, response);
+        if (!pedal_matches(data[i], response)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void reset_and_reopen()
+{
+    if ((dev = reset_device(dev, RESET_TIMEOUT_MS)) == NULL) {
+        fatal("The footswitch hasn't come back after the reset, unplug it and plug it back again.");
+    }
+}
+
+/**
+ * Reads back the pedals which a plan has programmed and sends only the ones
+ * which differ from it again, up to VERIFY_ATTEMPTS times. The device
+ * reports a new configuration only after a reset, so the packets which end
+ * programming are sent again as well and the device is reset again.
+ */
+void verify_plan(const plan *p)
+{
+    unsigned char data[3][SCYTHE_SIZE], response[SCYTHE_RESPONSE_SIZE], expected[SCYTHE_RESPONSE_SIZE];
+    char want[DESCRIPTION_SIZE], got[DESCRIPTION_SIZE];
+    int first[3], tail = 1;
+    int mask = planned_pedals(p, data, first);
+    int *resend = calloc(p->count, sizeof(int));
+
+    if (resend == NULL) {
+        fatal("Not enough memory");
+    }
+    for (int i = 0 ; i < 3 ; i++) {
+        if ((mask & (1 << i)) != 0 && first[i] + 2 > tail) {
+            tail = first[i] + 2;
+        }
+    }
+    for (int attempt = 0 ; mask != 0 ; attempt++) {
+        uint64_t start = metrics_now();
+        plan retry = {0};
+        int count = 0, pedals = 0;
+
+        for (int i = 0 ; i < 3 ; i++) {
+            if ((mask & (1 << i)) == 0) {
+                continue;
+            }
+            query_pedal(i, response);
+            if (pedal_matches(data[i], response)) {
+                mask &= ~(1 << i);
+                continue;
+            }
+            expected_response(data[i], expected);
+            describe_pedal(expected, want);
+            describe_pedal(response, got);
+            fprintf(stderr, "Pedal %d reads back as '%s' instead of '%s'\n", i + 1, got, want);
+            resend[count++] = first[i];
+        }
+        metrics_observe(METRIC_READBACK, start);
+        if (count == 0) {
+            break;
+        }
+        if (attempt == VERIFY_ATTEMPTS) {
+            fatal("%d pedal(s) don't verify after %d attempts", count, VERIFY_ATTEMPTS);
+        }
+        metrics_add(METRIC_MISMATCHES, count);
+        pedals = count;
+        for (int i = tail ; i < p->count ; i++) {
+            if (i == tail || (p->packets[i - 1].flags & PACKET_COMMIT)) {
+                resend[count++] = i;
+            }
+        }
+        plan_add_units(&retry, p, resend, count);
+        diag("Sending %d pedal(s) again", pedals);
+        if (!plan_run(dev, &retry)) {
+            fatal("error sending feature report (%ls)", xfer_error(dev));
+        }
+        plan_free(&retry);
+        reset_and_reopen();
+    }
+    free(resend);
+}
+
+void run_plan(const plan *p) {
+    uint64_t start = metrics_now();
+
+    if (!plan_run(dev, p)) {
+        fatal("error sending feature report (%ls)", xfer_error(dev));
+    }
+    if (!reset_after_write && !verify_after_write) {
+        printf("Done. Unplug the footswitch and then plug it back again.\n");
+        return;
+    }
+    // --verify resets the device, which reports the new configuration only after that
+    reset_and_reopen();
+    if (verify_after_write) {
+        verify_plan(p);
+    } else if (!plan_active(p)) {
+        fatal("The footswitch doesn't report the new configuration after the reset.");
     }
-    while ((opt = getopt(argc, argv, "123ra:m:b:")) != -1) {
+    printf("Done. The new configuration is active after %.3f s.\n", (metrics_now() - start) / 1e6);
+}
+
+void write_pedals() {
+    plan p = {0};
+
+    build_plan(&p);
+    run_plan(&p);
+    plan_free(&p);
+}
+
+int main(int argc, char *argv[]) {
+    static const struct option long_options[] = {
+        DEVICE_LONG_OPTIONS,
+        {NULL, 0, NULL, 0}
+    };
+    bool read = false, write = false;
+    int opt;
+
+    while ((opt = getopt_long(argc, argv, "123ra:m:b:c:o:", long_options, NULL)) != -1) {
+        if (opt != 'r' && !is_device_option(opt)) {
+            write = true;
+        }
         switch (opt) {
             case '1':
                 curr_pedal = 0;
@@ -297,8 +525,8 @@ int main(int argc, char *argv[]) {
                 curr_pedal = 2;
                 break;
             case 'r':
-                fprintf(stderr, "Cannot use -r with other options\n");
-                return 1;
+                read = true;
+                break;
             case 'a':
                 compile_key_repeat(optarg);
                 break;
@@ -308,13 +536,36 @@ int main(int argc, char *argv[]) {
             case 'b':
                 compile_mouse_button(optarg);
                 break;
+            case 'c':
+                compile_combo(optarg);
+                break;
             default:
-                usage();
+                if (!parse_device_option(opt, optarg)) {
+                    usage();
+                }
                 break;
         }
     }
+    if (optind < argc || (!read && !write && !compile_only && !flash_path && !db_path) ||
+            !image_options_valid(write, read)) {
+        usage();
+    }
+    if (read && write) {
+        fprintf(stderr, "Cannot use -r with other options\n");
+        return 1;
+    }
+    const image_tool tool = {"scythe", build_plan, init, run_plan, deinit};
+    if (run_image_options(&tool)) {
+        return 0;
+    }
     init();
-    write_pedals();
+    if (read) {
+        uint64_t start = metrics_now();
+        read_pedals();
+        metrics_observe(METRIC_READBACK, start);
+    } else {
+        write_pedals();
+    }
     deinit();
     return 0;
 }
@@ -7,10 +7,19 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include "common.h"
+#include "device.h"
+#include "layout.h"
+#include "metrics.h"
+#include "plan.h"
+#include "profiledb.h"
+#include "transfer.h"
 #include "debug.h"
 
 #define MAX_KEYS 255
 
+// How long the device may take to come back after --reset
+#define RESET_TIMEOUT_MS 5000
+
 hid_device *dev = NULL;
 
 enum event_type {
@@ -37,7 +46,7 @@ int curr_pedal = 0;
 
 void usage()
 {
-    fprintf(stderr, "Usage: scythe2 [-123456] [-r] [-k <key>] [-a <key>] [-m <modifier>] [-b <button>]\n"
+    fprintf(stderr, "Usage: scythe2 [-123456] [-r] [-k <key>] [-a <key>] [-m <modifier>] [-b <button>] [-c <combo>]\n"
         "   -r          - read all pedals\n"
         "   -1          - program the first pedal\n"
         "   -2          - program the second pedal (default)\n"
@@ -49,14 +58,21 @@ void usage()
         "   -a key      - write the specified key (no repeat)\n"
         "   -k key      - write the specified key (repeat)\n"
         "   -m modifier - ctrl|shift|alt|win\n"
-        "   -b button   - mouse_left|mouse_middle|mouse_right|mouse_double\n");
+        "   -b button   - mouse_left|mouse_middle|mouse_right|mouse_double\n"
+        "   -c combo    - a key with modifiers or a button joined with +, e.g. ctrl+c,\n"
+        "                 or a sequence of them separated with commas, e.g. ctrl+c,ctrl+v\n"
+        DEVICE_USAGE);
     exit(1);
 }
 
 void init()
 {
+    static const unsigned short vid_pid[][2] = {
+        SCYTHE2_DEVICES(LAYOUT_VID_PID)
+    };
+
     hid_init();
-    dev = hid_open(0x055a, 0x0998, NULL);
+    dev = open_device(vid_pid, sizeof(vid_pid) / sizeof(vid_pid[0]), -1);
     if (dev == NULL) {
         fatal("Cannot find Scythe pedal with VID:PID=055a:0998.\nCheck that a Scythe device is connected and that you have the correct permissions to access it.");
     }
@@ -64,69 +80,97 @@ void init()
 
 void deinit()
 {
-    hid_close(dev);
+    close_device(dev);
     hid_exit();
 }
 
-void send_report(unsigned char *ptr, int len)
+bool send_report(unsigned char *ptr, int len)
 {
     int r;
     //debug_arr(ptr, len);
-    r = hid_send_feature_report(dev, ptr, len);
-    if (r < 0) {
-        fprintf(stderr, "Error sending feature report\n");
+    r = xfer_send_feature(dev, ptr, len);
+    if (r == XFER_PERMANENT) {
+        fatal("error sending feature report (%ls)", xfer_error(dev));
     }
     usleep(200 * 1000);
+    return r >= 0;
 }
 
 // BXKBSettingLib.dll + 0x10B0
 void checksum(uint8_t *data, int len)
 {
     uint8_t sum = 0;
-    data[7] = 0;
+    data[SCYTHE2_CHECKSUM] = 0;
     for (int i = 0; i < len; i++) {
         sum += data[i];
     }
-    data[7] = sum;
+    data[SCYTHE2_CHECKSUM] = sum;
 }
 
-// BXKBSettingLib.dll + 0x10E0
-void SetUpdateEx(uint8_t *data, int len)
+static void PrepareUpdateEx(uint8_t *data, int len)
 {
-    data[0] = 0x05;
-    data[1] = 0x96;
-    data[2] = 0xa5;
+    data[SCYTHE2_REPORT_ID] = 0x05;
+    data[SCYTHE2_MAGIC1] = 0x96;
+    data[SCYTHE2_MAGIC2] = 0xa5;
     checksum(data, len);
-    send_report(data, len);
+}
+
+// BXKBSettingLib.dll + 0x10E0
+bool SetUpdateEx(uint8_t *data, int len)
+{
+    PrepareUpdateEx(data, len);
+    return send_report(data, len);
+}
+
+// The first SCYTHE2_SIZE bytes of the settings, after the report ID
+static void query_settings(uint8_t buff[SCYTHE2_SIZE])
+{
+    memset(buff, 0, SCYTHE2_SIZE);
+    buff[SCYTHE2_COMMAND] = 0x5a;
+    if (!SetUpdateEx(buff, SCYTHE2_SIZE)) {
+        fatal("error sending feature report (%ls)", xfer_error(dev));
+    }
+    int r = xfer_get_feature(dev, buff, SCYTHE2_SIZE);
+    if (r < 0) {
+        fatal("error getting feature report (%ls)", xfer_error(dev));
+    }
+}
+
+static void PlanUpdateEx(plan *p, uint8_t *data, int len, int flags)
+{
+    PrepareUpdateEx(data, len);
+    plan_add(p, PACKET_FEATURE, data, len, 200 * 1000, flags);
 }
 
 // BXKBSettingLib.dll + 0x1540
-void UpdateSetting(uint8_t *data, int len)
+void UpdateSetting(plan *p, uint8_t *data, int len)
 {
-    uint8_t buff[0x48] = {0};
-    buff[3] = 0x2c;         // local_45
-    buff[6] = 0x02;         // local_42
-    SetUpdateEx(buff, 0x48);
+    uint8_t buff[SCYTHE2_SIZE] = {0};
+    buff[SCYTHE2_COMMAND] = 0x2c;       // local_45
+    buff[SCYTHE2_COUNT] = 0x02;         // local_42
+    PlanUpdateEx(p, buff, SCYTHE2_SIZE, PACKET_COMMIT | PACKET_PREAMBLE);
+    // chunks are addressed by offset, so after a failure only the current
+    // chunk has to be sent again
     for (int offset = 0; offset < len; offset += 0x20) {
         int count = len - offset;
         if (count > 0x20) {
             count = 0x20;
         }
-        buff[3] = 0x26;             // local_45
-        buff[4] = offset >> 8;       // local_44
-        buff[5] = offset;            // local_43
-        buff[6] = count;            // local_42
+        buff[SCYTHE2_COMMAND] = 0x26;       // local_45
+        buff[SCYTHE2_OFFSET_HI] = offset >> 8;  // local_44
+        buff[SCYTHE2_OFFSET_LO] = offset;   // local_43
+        buff[SCYTHE2_COUNT] = count;        // local_42
         for (int i = 0; i < count; i++) {
-            buff[8+i] = data[offset+i];
+            buff[SCYTHE2_PAYLOAD + i] = data[offset + i];
         }
-        SetUpdateEx(buff, 0x48);
-        SetUpdateEx(buff, 0x48);
-    }
-    buff[3] = 0x2b;             // local_45
-    buff[4] = 0x14;             // local_44
-    buff[5] = 0x23;             // local_43
-    buff[6] = 0x00;             // local_42
-    SetUpdateEx(buff, 0x48);
+        PlanUpdateEx(p, buff, SCYTHE2_SIZE, 0);
+        PlanUpdateEx(p, buff, SCYTHE2_SIZE, PACKET_COMMIT);
+    }
+    buff[SCYTHE2_COMMAND] = 0x2b;       // local_45
+    buff[SCYTHE2_OFFSET_HI] = 0x14;     // local_44
+    buff[SCYTHE2_OFFSET_LO] = 0x23;     // local_43
+    buff[SCYTHE2_COUNT] = 0x00;         // local_42
+    PlanUpdateEx(p, buff, SCYTHE2_SIZE, PACKET_COMMIT);
 }
 
 static bool set_pedal_type(enum event_type new_type)
@@ -144,17 +188,25 @@ void compile_string(const char *str)
         fprintf(stderr, "Invalid combination of options\n");
         usage();
     }
-    int len = strlen(str);
-    if (len > MAX_KEYS) {
+    static keystroke keys[MAX_KEYS];
+    int len = encode_text(str, keys, MAX_KEYS);
+    if (len == -2) {
         fprintf(stderr, "The string length exceeds %d\n", MAX_KEYS);
         exit(1);
     }
+    if (len < 0) {
+        fprintf(stderr, "Cannot encode string: '%s'\n", str);
+        exit(1);
+    }
     pedals[curr_pedal].count = len;
-    for (int i = 0; i < strlen(str); i++) {
-        pedals[curr_pedal].keys[i].mod = 0xf0;
-        uint8_t code = 0;
-        encode_char(str[i], &code);
-        pedals[curr_pedal].keys[i].code = code;
+    for (int i = 0; i < len; i++) {
+        // only the left modifiers fit next to the 0xf0 marker
+        if ((keys[i].modifiers & 0xf0) != 0) {
+            fprintf(stderr, "Cannot type '%s' without AltGr\n", str);
+            exit(1);
+        }
+        pedals[curr_pedal].keys[i].mod = 0xf0 | keys[i].modifiers;
+        pedals[curr_pedal].keys[i].code = keys[i].code;
     }
 }
 
@@ -217,7 +269,51 @@ void compile_mouse_button(const char *btn_str)
     pedals[curr_pedal].keys[0].code = btn;
 }
 
-void write_pedals()
+void compile_combo(const char *expr)
+{
+    static combo combos[MAX_KEYS];
+    char err[128];
+    int count = parse_combos(expr, combos, MAX_KEYS, err, sizeof(err));
+
+    if (count < 0) {
+        fprintf(stderr, "%s\n", err);
+        exit(1);
+    }
+    if (count == 1 && combos[0].buttons != 0) {
+        if ((combos[0].buttons & (combos[0].buttons - 1)) != 0 || combos[0].key_count != 0 || combos[0].modifiers != 0) {
+            fprintf(stderr, "Invalid combination of options\n");
+            usage();
+        }
+        if (!set_pedal_type(SINGLE_KEY_REPEAT)) {
+            fprintf(stderr, "Invalid combination of options\n");
+            usage();
+        }
+        pedals[curr_pedal].count = 1;
+        pedals[curr_pedal].keys[0].mod = 0xc0;
+        pedals[curr_pedal].keys[0].code = combos[0].buttons;
+        return;
+    }
+    if (!set_pedal_type(count == 1 ? SINGLE_KEY_REPEAT : MULTIPLE_KEYS)) {
+        fprintf(stderr, "Invalid combination of options\n");
+        usage();
+    }
+    for (int i = 0 ; i < count ; i++) {
+        if (combos[i].key_count != 1 || combos[i].buttons != 0) {
+            fprintf(stderr, "Each combo must have exactly one key: '%s'\n", expr);
+            exit(1);
+        }
+        // only the left modifiers fit next to the 0xf0 marker
+        if ((combos[i].modifiers & 0xf0) != 0) {
+            fprintf(stderr, "Only the left modifiers can be used in combos: '%s'\n", expr);
+            exit(1);
+        }
+        pedals[curr_pedal].keys[i].mod = 0xf0 | combos[i].modifiers;
+        pedals[curr_pedal].keys[i].code = combos[i].keys[0];
+    }
+    pedals[curr_pedal].count = count;
+}
+
+void build_plan(plan *p)
 {
     int data_length = 2;
     for (int i = 0; i < 6; i++) {
@@ -264,13 +360,69 @@ void write_pedals()
     // }
     // printf("\n");
 
-    uint8_t buff[0x48] = {0};
-    SetUpdateEx(buff, 0x48);
-    UpdateSetting(data, data_length);
-    printf("Done. Unplug the footswitch and then plug it back again.\n");
+    uint8_t buff[SCYTHE2_SIZE] = {0};
+    PlanUpdateEx(p, buff, SCYTHE2_SIZE, PACKET_COMMIT | PACKET_PREAMBLE);
+    UpdateSetting(p, data, data_length);
     free(data);
 }
 
+// Checks that the device reports the settings written by the plan, as far
+// as they can be read back. The settings are taken from the chunks of the
+// plan, so images can be checked as well.
+static bool plan_active(const plan *p)
+{
+    uint8_t settings[SCYTHE2_SIZE] = {0}, buff[SCYTHE2_SIZE];
+    int len = 0;
+
+    for (int i = 0; i < p->count; i++) {
+        const uint8_t *data = p->packets[i].data;
+        int offset = data[SCYTHE2_OFFSET_HI] << 8 | data[SCYTHE2_OFFSET_LO];
+        int count = data[SCYTHE2_COUNT];
+        if (data[SCYTHE2_COMMAND] != 0x26 || offset >= SCYTHE2_SIZE) {
+            continue;
+        }
+        if (offset + count > SCYTHE2_SIZE) {
+            count = SCYTHE2_SIZE - offset;
+        }
+        memcpy(&settings[offset], &data[SCYTHE2_PAYLOAD], count);
+        if (offset + count > len) {
+            len = offset + count;
+        }
+    }
+    query_settings(buff);
+    // the first byte of the answer is the report ID instead of the length
+    return len <= 2 || memcmp(&buff[2], &settings[2], len - 2) == 0;
+}
+
+void run_plan(const plan *p)
+{
+    uint64_t start = metrics_now();
+
+    if (!plan_run(dev, p)) {
+        fatal("error sending feature report (%ls)", xfer_error(dev));
+    }
+    if (!reset_after_write) {
+        printf("Done. Unplug the footswitch and then plug it back again.\n");
+        return;
+    }
+    if ((dev = reset_device(dev, RESET_TIMEOUT_MS)) == NULL) {
+        fatal("The footswitch hasn't come back after the reset, unplug it and plug it back again.");
+    }
+    if (!plan_active(p)) {
+        fatal("The footswitch doesn't report the new configuration after the reset.");
+    }
+    printf("Done. The new configuration is active after %.3f s.\n", (metrics_now() - start) / 1e6);
+}
+
+void write_pedals()
+{
+    plan p = {0};
+
+    build_plan(&p);
+    run_plan(&p);
+    plan_free(&p);
+}
+
 static void print_key(int mod, uint8_t code)
 {
     if (mod == 0xc0) {
@@ -299,21 +451,21 @@ static void print_key(int mod, uint8_t code)
 
 static void print_pedal(int num, const uint8_t *data)
 {
-    int count = data[0];
-    int type = data[1];
+    int count = data[SCYTHE2_PEDAL_COUNT];
+    int type = data[SCYTHE2_PEDAL_TYPE];
     switch (type) {
     case SINGLE_KEY_REPEAT:
         printf("Pedal %d (single key repeat): ", num);
-        print_key(data[2], data[3]);
+        print_key(data[SCYTHE2_PEDAL_MOD], data[SCYTHE2_PEDAL_CODE]);
         break;
     case SINGLE_KEY_NOREPEAT:
         printf("Pedal %d (single key no repeat): ", num);
-        print_key(data[2], data[3]);
+        print_key(data[SCYTHE2_PEDAL_MOD], data[SCYTHE2_PEDAL_CODE]);
         break;
     case MULTIPLE_KEYS:
         printf("Pedal %d (multiple keys): ", num);
         for (int i = 0; i < count; i++) {
-            printf("%s", decode_byte(data[3+i*2]));
+            printf("%s", decode_byte(data[SCYTHE2_PEDAL_CODE + i*2]));
         }
         printf("\n");
         break;
@@ -322,18 +474,13 @@ static void print_pedal(int num, const uint8_t *data)
 
 static void read_pedals()
 {
-    uint8_t buff[0x48] = {0};
-    buff[3] = 0x5a;
-    SetUpdateEx(buff, 0x48);
-    int r = hid_get_feature_report(dev, buff, 0x48);
-    if (r < 0) {
-        fatal("error getting feature report (%ls)", hid_error(dev));
-    }
+    uint8_t buff[SCYTHE2_SIZE];
+    query_settings(buff);
     int ind = 2;
     for (int i = 0; i < 6; i++) {
         int count = buff[ind];
         int length = count*2 + 2;
-        if (ind + length > 0x48) {
+        if (ind + length > SCYTHE2_SIZE) {
             // TODO: find how to get the data after 0x48
             break;
         }
@@ -343,18 +490,17 @@ static void read_pedals()
 }
 
 int main(int argc, char *argv[]) {
+    static const struct option long_options[] = {
+        DEVICE_LONG_OPTIONS,
+        {NULL, 0, NULL, 0}
+    };
+    bool read = false, write = false;
     int opt;
 
-    if (argc == 1) {
-        usage();
-    }
-    if (argc == 2 && strcmp(argv[1], "-r") == 0) {
-        init();
-        read_pedals();
-        deinit();
-        return 0;
-    }
-    while ((opt = getopt(argc, argv, "123456rs:a:k:m:b:")) != -1) {
+    while ((opt = getopt_long(argc, argv, "123456rs:a:k:m:b:c:o:", long_options, NULL)) != -1) {
+        if (opt != 'r' && !is_device_option(opt)) {
+            write = true;
+        }
         switch (opt) {
             case '1':
                 curr_pedal = 0;
@@ -375,8 +521,8 @@ int main(int argc, char *argv[]) {
                 curr_pedal = 5;
                 break;
             case 'r':
-                fprintf(stderr, "Cannot use -r with other options\n");
-                return 1;
+                read = true;
+                break;
             case 's':
                 compile_string(optarg);
                 break;
@@ -392,13 +538,36 @@ int main(int argc, char *argv[]) {
             case 'b':
                 compile_mouse_button(optarg);
                 break;
+            case 'c':
+                compile_combo(optarg);
+                break;
             default:
-                usage();
+                if (!parse_device_option(opt, optarg)) {
+                    usage();
+                }
                 break;
         }
     }
+    if (optind < argc || (!read && !write && !compile_only && !flash_path && !db_path) ||
+            !image_options_valid(write, read)) {
+        usage();
+    }
+    if (read && write) {
+        fprintf(stderr, "Cannot use -r with other options\n");
+        return 1;
+    }
+    const image_tool tool = {"scythe2", build_plan, init, run_plan, deinit};
+    if (run_image_options(&tool)) {
+        return 0;
+    }
     init();
-    write_pedals();
+    if (read) {
+        uint64_t start = metrics_now();
+        read_pedals();
+        metrics_observe(METRIC_READBACK, start);
+    } else {
+        write_pedals();
+    }
     deinit();
     return 0;
 }
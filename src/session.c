@@ -0,0 +1,222 @@
+/*
+Copyright (c) 2012 Radoslav Gerganov <rgerganov@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include "session.h"
+
+#define SESSION_MAGIC "FSR1"
+
+const char *record_path = NULL;
+const char *replay_path = NULL;
+
+static FILE *record_file = NULL;
+static uint64_t start_us = 0;
+
+// the replayed session
+static bool replaying = false;
+static uint8_t *log_data = NULL;
+static size_t log_size = 0;
+static size_t next_output = 0, next_input = 0;
+static int outputs = 0, inputs = 0, sent = 0, used = 0, differ = 0, extra = 0;
+static uint32_t recorded_us = 0;
+static int stand_in;
+
+static uint64_t now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static bool is_output(int op) {
+    return op == OP_WRITE || op == OP_SEND_FEATURE;
+}
+
+static void record_done() {
+    if (record_file != NULL && fclose(record_file) != 0) {
+        perror(record_path);
+    }
+    record_file = NULL;
+}
+
+bool session_record_start(const device_id *id) {
+    session_header hdr = {{0}};
+
+    record_file = fopen(record_path, "wb");
+    if (record_file == NULL) {
+        return false;
+    }
+    memcpy(hdr.magic, SESSION_MAGIC, 4);
+    hdr.vid = id->vid;
+    hdr.pid = id->pid;
+    hdr.release = id->release;
+    if (fwrite(&hdr, sizeof(hdr), 1, record_file) != 1) {
+        return false;
+    }
+    start_us = now_us();
+    atexit(record_done);
+    return true;
+}
+
+void session_record(enum xfer_op op, const unsigned char *data, size_t len, int result, int err) {
+    session_entry rec = {0};
+
+    // nothing to recreate from empty polls
+    if (record_file == NULL || (op == OP_DRAIN && result <= 0)) {
+        return;
+    }
+    rec.time_us = now_us() - start_us;
+    rec.op = op;
+    rec.err = result < 0 ? err : 0;
+    rec.result = result;
+    if (is_output(op)) {
+        rec.len = len;
+    } else {
+        rec.len = result > 0 ? result : 0;
+    }
+    fwrite(&rec, sizeof(rec), 1, record_file);
+    fwrite(data, 1, rec.len, record_file);
+}
+
+/**
+ * Copies the record at *pos (records are not aligned) and moves pos to the
+ * next one. Returns the data of the record or NULL at the end of the log.
+ */
+static const uint8_t *next_record(size_t *pos, session_entry *rec) {
+    const uint8_t *data = NULL;
+
+    if (*pos + sizeof(session_entry) > log_size) {
+        return NULL;
+    }
+    memcpy(rec, log_data + *pos, sizeof(session_entry));
+    data = log_data + *pos + sizeof(session_entry);
+    if (*pos + sizeof(session_entry) + rec->len > log_size) {
+        return NULL;
+    }
+    *pos += sizeof(session_entry) + rec->len;
+    return data;
+}
+
+// Finds the next recorded output or input
+static const uint8_t *next_of(size_t *pos, bool output, session_entry *rec) {
+    const uint8_t *data = NULL;
+
+    while ((data = next_record(pos, rec)) != NULL && is_output(rec->op) != output) {
+    }
+    return data;
+}
+
+static void replay_done() {
+    fprintf(stderr, "Replayed %d of %d recorded output reports (%d differ, %d extra), %d of %d input reports\n",
+            sent, outputs, differ, extra, used, inputs);
+    fprintf(stderr, "Recorded session took %.3f s, replayed session took %.3f s\n",
+            recorded_us / 1e6, (now_us() - start_us) / 1e6);
+    free(log_data);
+}
+
+hid_device *session_replay_start(device_id *id) {
+    const session_header *hdr = NULL;
+    session_entry rec;
+    size_t pos = sizeof(session_header);
+    FILE *f = fopen(replay_path, "rb");
+
+    if (f == NULL) {
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    log_size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    log_data = malloc(log_size);
+    if (log_data == NULL || fread(log_data, 1, log_size, f) != log_size ||
+            log_size < sizeof(session_header) || memcmp(log_data, SESSION_MAGIC, 4) != 0) {
+        fclose(f);
+        free(log_data);
+        log_data = NULL;
+        return NULL;
+    }
+    fclose(f);
+    hdr = (const session_header *) log_data;
+    id->vid = hdr->vid;
+    id->pid = hdr->pid;
+    id->release = hdr->release;
+    while (next_record(&pos, &rec) != NULL) {
+        if (is_output(rec.op)) {
+            outputs++;
+        } else {
+            inputs++;
+        }
+        recorded_us = rec.time_us;
+    }
+    next_output = next_input = sizeof(session_header);
+    replaying = true;
+    start_us = now_us();
+    atexit(replay_done);
+    // never passed to hidapi
+    return (hid_device *) &stand_in;
+}
+
+bool session_replaying() {
+    return replaying;
+}
+
+int session_replay(enum xfer_op op, unsigned char *data, size_t len) {
+    session_entry rec;
+    const uint8_t *recorded = NULL;
+
+    if (is_output(op)) {
+        recorded = next_of(&next_output, true, &rec);
+        if (recorded == NULL) {
+            extra++;
+            return len;
+        }
+        sent++;
+        if (rec.op != op || rec.len != len || memcmp(recorded, data, len) != 0) {
+            differ++;
+        }
+    } else {
+        size_t pos = next_input;
+        // only reports which were pending are drained, and reads skip them
+        while ((recorded = next_of(&pos, false, &rec)) != NULL && op != OP_DRAIN && rec.op == OP_DRAIN) {
+            next_input = pos;
+        }
+        if (op == OP_DRAIN && (recorded == NULL || rec.op != OP_DRAIN)) {
+            return 0;
+        }
+        if (recorded == NULL) {
+            // the end of the session, nothing more will come
+            errno = ENODEV;
+            return -1;
+        }
+        next_input = pos;
+        used++;
+        memcpy(data, recorded, rec.len < len ? rec.len : len);
+        // like hidapi, a report longer than the buffer is cut to it
+        if (rec.result > 0 && (size_t) rec.result > len) {
+            errno = rec.err;
+            return len;
+        }
+    }
+    errno = rec.err;
+    return rec.result;
+}
@@ -0,0 +1,276 @@
+/*
+Copyright (c) 2012 Radoslav Gerganov <rgerganov@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <wchar.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include "hidraw.h"
+#include "metrics.h"
+#include "session.h"
+#include "transfer.h"
+
+#define MAX_BACKOFF_MS 2000
+
+struct xfer_policy xfer_policy = {
+    .timeout_ms = 1000,
+    .retries = 4,
+    .backoff_ms = 20,
+    .watchdog_ms = 0,
+};
+
+enum xfer_backend xfer_backend = BACKEND_HIDAPI;
+
+struct backend {
+    int (*write)(hid_device *dev, const unsigned char *data, size_t len);
+    int (*read_timeout)(hid_device *dev, unsigned char *data, size_t len, int timeout_ms);
+    int (*send_feature)(hid_device *dev, const unsigned char *data, size_t len);
+    int (*get_feature)(hid_device *dev, unsigned char *data, size_t len);
+    const wchar_t *(*error)(hid_device *dev);
+};
+
+static const struct backend backends[] = {
+    [BACKEND_HIDAPI] = {hid_write, hid_read_timeout, hid_send_feature_report, hid_get_feature_report, hid_error},
+    [BACKEND_HIDRAW] = {hidraw_write, hidraw_read_timeout, hidraw_send_feature, hidraw_get_feature, hidraw_error},
+};
+
+static const char *op_names[] = {"write", "read", "send feature", "get feature", "drain"};
+
+static struct {
+    unsigned long count;
+    unsigned long long total_us;
+    unsigned long max_us;
+} stats[OP_DRAIN + 1];
+
+static unsigned long long now_us() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+/*
+ * A device which stops responding can block a transfer forever inside
+ * hidapi or the kernel, where a timeout cannot reach it. The watchdog gives
+ * each transfer a deadline and ends the process with XFER_HUNG_EXIT when it
+ * passes, so that a supervisor (footswitchd) can reset the device and run
+ * the tool again.
+ */
+static void on_watchdog(int sig) {
+    static const char msg[] = "The device has stopped responding\n";
+
+    if (write(STDERR_FILENO, msg, sizeof(msg) - 1) < 0) {
+        // exiting anyway
+    }
+    _exit(XFER_HUNG_EXIT);
+}
+
+static void watchdog_arm(int ms) {
+    static bool installed = false;
+    struct itimerval it = {{0, 0}, {ms / 1000, (ms % 1000) * 1000}};
+
+    if (xfer_policy.watchdog_ms <= 0) {
+        return;
+    }
+    if (!installed) {
+        signal(SIGALRM, on_watchdog);
+        installed = true;
+    }
+    setitimer(ITIMER_REAL, &it, NULL);
+}
+
+static void watchdog_disarm() {
+    struct itimerval it = {{0, 0}, {0, 0}};
+
+    if (xfer_policy.watchdog_ms > 0) {
+        setitimer(ITIMER_REAL, &it, NULL);
+    }
+}
+
+static int do_op(enum xfer_op op, hid_device *dev, unsigned char *data, size_t len) {
+    const struct backend *b = &backends[xfer_backend];
+    unsigned long long start = 0, us = 0;
+    int r = -1;
+
+    if (session_replaying()) {
+        return session_replay(op, data, len);
+    }
+    // a read may take its own timeout before it fails
+    watchdog_arm(xfer_policy.watchdog_ms + (op == OP_READ ? xfer_policy.timeout_ms : 0));
+    errno = 0;
+    start = now_us();
+    switch (op) {
+        case OP_WRITE:
+            r = b->write(dev, data, len);
+            break;
+        case OP_READ:
+            r = b->read_timeout(dev, data, len, xfer_policy.timeout_ms);
+            if (r == 0) {
+                errno = ETIMEDOUT;
+                r = -1;
+            }
+            break;
+        case OP_SEND_FEATURE:
+            r = b->send_feature(dev, data, len);
+            break;
+        case OP_GET_FEATURE:
+            r = b->get_feature(dev, data, len);
+            break;
+        case OP_DRAIN:
+            r = b->read_timeout(dev, data, len, 0);
+            break;
+    }
+    us = now_us() - start;
+    watchdog_disarm();
+    if (r > 0) {
+        metrics_add(METRIC_TRANSFERS, 1);
+        metrics_add(METRIC_BYTES, r);
+    }
+    stats[op].count++;
+    stats[op].total_us += us;
+    if (us > stats[op].max_us) {
+        stats[op].max_us = us;
+    }
+    if (record_path != NULL) {
+        int err = errno;
+        session_record(op, data, len, r, err);
+        errno = err;
+    }
+    return r;
+}
+
+// LIBUSB_ERROR_NO_DEVICE, by its name and by its libusb_strerror() text;
+// libusb doesn't set errno, so the error string of hidapi-libusb is all
+// that is left
+static const wchar_t *gone_errors[] = {L"NO_DEVICE", L"No such device"};
+
+// hidapi doesn't return error codes, so errno is the best thing we have.
+// Everything which doesn't clearly say that the device is unusable is
+// considered a glitch worth retrying. A failure which doesn't set errno at
+// all (hidapi-libusb) is retried unless its error string says that the
+// device is gone, which must not wait for the whole backoff.
+static int classify(hid_device *dev, int err) {
+    const wchar_t *msg = NULL;
+
+    switch (err) {
+        case ENODEV:
+        case ENOENT:
+        case ENXIO:
+        case EACCES:
+        case EPERM:
+        case EBADF:
+            return XFER_PERMANENT;
+        case 0:
+            msg = xfer_error(dev);
+            for (size_t i = 0 ; msg != NULL && i < sizeof(gone_errors) / sizeof(gone_errors[0]) ; i++) {
+                if (wcsstr(msg, gone_errors[i]) != NULL) {
+                    return XFER_PERMANENT;
+                }
+            }
+            break;
+    }
+    return XFER_TRANSIENT;
+}
+
+static int transfer(enum xfer_op op, hid_device *dev, unsigned char *data, size_t len, int retries) {
+    int r = 0, status = 0;
+
+    for (int attempt = 0 ; ; attempt++) {
+        r = do_op(op, dev, data, len);
+        if (r >= 0) {
+            return r;
+        }
+        status = classify(dev, errno);
+        if (status == XFER_PERMANENT || attempt >= retries) {
+            return status;
+        }
+        metrics_add(METRIC_RETRIES, 1);
+        xfer_backoff(attempt);
+    }
+}
+
+int xfer_write(hid_device *dev, const unsigned char *data, size_t len) {
+    return transfer(OP_WRITE, dev, (unsigned char *) data, len, xfer_policy.retries);
+}
+
+int xfer_read(hid_device *dev, unsigned char *data, size_t len) {
+    return transfer(OP_READ, dev, data, len, 0);
+}
+
+int xfer_send_feature(hid_device *dev, const unsigned char *data, size_t len) {
+    return transfer(OP_SEND_FEATURE, dev, (unsigned char *) data, len, xfer_policy.retries);
+}
+
+int xfer_get_feature(hid_device *dev, unsigned char *data, size_t len) {
+    return transfer(OP_GET_FEATURE, dev, data, len, xfer_policy.retries);
+}
+
+void xfer_drain(hid_device *dev) {
+    unsigned char buf[64];
+
+    while (do_op(OP_DRAIN, dev, buf, sizeof(buf)) > 0) {
+    }
+}
+
+bool xfer_sequence(bool (*seq)(void *arg), void *arg) {
+    for (int attempt = 0 ; ; attempt++) {
+        if (seq(arg)) {
+            return true;
+        }
+        if (attempt >= xfer_policy.retries) {
+            return false;
+        }
+        metrics_add(METRIC_RETRIES, 1);
+        xfer_backoff(attempt);
+    }
+}
+
+void xfer_backoff(int attempt) {
+    int ms = xfer_policy.backoff_ms;
+
+    while (attempt-- > 0 && ms < MAX_BACKOFF_MS) {
+        ms *= 2;
+    }
+    if (ms > MAX_BACKOFF_MS) {
+        ms = MAX_BACKOFF_MS;
+    }
+    usleep(ms * 1000);
+}
+
+const wchar_t *xfer_error(hid_device *dev) {
+    if (session_replaying()) {
+        return L"replayed session";
+    }
+    return backends[xfer_backend].error(dev);
+}
+
+void xfer_print_stats(FILE *out) {
+    fprintf(out, "%s transfers:\n", xfer_backend == BACKEND_HIDRAW ? "hidraw" : "hidapi");
+    for (int op = 0 ; op <= OP_DRAIN ; op++) {
+        if (stats[op].count == 0) {
+            continue;
+        }
+        fprintf(out, "  %-13s %5lu, avg %6llu us, max %6lu us\n", op_names[op], stats[op].count,
+                stats[op].total_us / stats[op].count, stats[op].max_us);
+    }
+}
@@ -0,0 +1,141 @@
+/*
+Copyright (c) 2012 Radoslav Gerganov <rgerganov@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <unistd.h>
+#include <linux/uhid.h>
+#include "vdev.h"
+
+const uint8_t vdev_keyboard_rdesc[] = {
+    0x05, 0x01, 0x09, 0x06, 0xa1, 0x01, 0x05, 0x07, 0x19, 0xe0, 0x29, 0xe7, 0x15, 0x00,
+    0x25, 0x01, 0x75, 0x01, 0x95, 0x08, 0x81, 0x02, 0x95, 0x01, 0x75, 0x08, 0x81, 0x01,
+    0x95, 0x06, 0x75, 0x08, 0x15, 0x00, 0x25, 0x65, 0x05, 0x07, 0x19, 0x00, 0x29, 0x65,
+    0x81, 0x00, 0xc0,
+};
+const size_t vdev_keyboard_rdesc_size = sizeof(vdev_keyboard_rdesc);
+
+bool vdev_create(vdev *d, const char *name, const char *role, unsigned short vid, unsigned short pid,
+                 const uint8_t *rdesc, size_t size) {
+    struct uhid_event ev;
+
+    d->path[0] = 0;
+    d->fd = open("/dev/uhid", O_RDWR | O_CLOEXEC);
+    if (d->fd < 0) {
+        perror("/dev/uhid");
+        return false;
+    }
+    snprintf(d->uniq, sizeof(d->uniq), "fsemu-%d-%s", getpid(), role);
+    memset(&ev, 0, sizeof(ev));
+    ev.type = UHID_CREATE2;
+    snprintf((char *) ev.u.create2.name, sizeof(ev.u.create2.name), "fsemu %s %s", name, role);
+    snprintf((char *) ev.u.create2.uniq, sizeof(ev.u.create2.uniq), "%s", d->uniq);
+    ev.u.create2.rd_size = size;
+    ev.u.create2.bus = BUS_USB;
+    ev.u.create2.vendor = vid;
+    ev.u.create2.product = pid;
+    memcpy(ev.u.create2.rd_data, rdesc, size);
+    if (write(d->fd, &ev, sizeof(ev)) < 0) {
+        perror("uhid create");
+        return false;
+    }
+    return true;
+}
+
+void vdev_destroy(vdev *d) {
+    struct uhid_event ev;
+
+    if (d->fd < 0) {
+        return;
+    }
+    memset(&ev, 0, sizeof(ev));
+    ev.type = UHID_DESTROY;
+    if (write(d->fd, &ev, sizeof(ev)) < 0) {
+        perror("uhid destroy");
+    }
+    close(d->fd);
+    d->fd = -1;
+}
+
+bool vdev_input(vdev *d, const uint8_t *data, size_t len) {
+    struct uhid_event ev;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.type = UHID_INPUT2;
+    ev.u.input2.size = len;
+    memcpy(ev.u.input2.data, data, len);
+    if (write(d->fd, &ev, sizeof(ev)) < 0) {
+        perror("uhid");
+        return false;
+    }
+    return true;
+}
+
+bool vdev_find_hidraw(vdev *d) {
+    char needle[96], line[256];
+    glob_t g;
+    bool found = false;
+
+    snprintf(needle, sizeof(needle), "HID_UNIQ=%s\n", d->uniq);
+    if (glob("/sys/class/hidraw/hidraw*/device/uevent", 0, NULL, &g) != 0) {
+        return false;
+    }
+    for (size_t i = 0 ; i < g.gl_pathc && !found ; i++) {
+        FILE *f = fopen(g.gl_pathv[i], "r");
+        if (f == NULL) {
+            continue;
+        }
+        while (fgets(line, sizeof(line), f) != NULL) {
+            if (strcmp(line, needle) == 0) {
+                const char *node = g.gl_pathv[i] + strlen("/sys/class/hidraw/");
+                snprintf(d->path, sizeof(d->path), "/dev/%.*s", (int) strcspn(node, "/"), node);
+                found = true;
+                break;
+            }
+        }
+        fclose(f);
+    }
+    globfree(&g);
+    return found;
+}
+
+bool vdev_find_event(const vdev *d, char *path, size_t size) {
+    char pattern[128];
+    glob_t g;
+    bool found = false;
+
+    if (d->path[0] == 0) {
+        return false;
+    }
+    // the input device is a sibling of the hidraw node under the HID device
+    snprintf(pattern, sizeof(pattern), "/sys/class/hidraw/%s/device/input/input*/event*", d->path + strlen("/dev/"));
+    if (glob(pattern, 0, NULL, &g) != 0) {
+        return false;
+    }
+    if (g.gl_pathc > 0) {
+        snprintf(path, size, "/dev/input/%s", strrchr(g.gl_pathv[0], '/') + 1);
+        found = true;
+    }
+    globfree(&g);
+    return found;
+}